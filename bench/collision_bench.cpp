@@ -0,0 +1,1949 @@
+// Collision benchmarks, run with `make bench`. Builds the broadphase over a
+// synthetic level and times building it and sweeping ellipsoids through it.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "adjacency.h"
+#include "batch.h"
+#include "bvh.h"
+#include "collision.h"
+#include "entity.h"
+#include "grid.h"
+#include "octree.h"
+#include "qbvh.h"
+#include "simulation.h"
+#include "sweepprune.h"
+#include "timestep.h"
+#include "trianglestore.h"
+#include "triplebuffer.h"
+#include "workers.h"
+#include "world.h"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using std::vector;
+
+static double now()
+{
+  return std::chrono::duration<double>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// checks that came out wrong, the bench exits with a failure if any did
+static unsigned int failures;
+
+// counts a failed check and returns its note for the report, "" if it passed
+static const char *failIf(bool failed, const char *note)
+{
+  failures += failed;
+  return failed ? note : "";
+}
+
+static float randomFloat()
+{
+  return rand() / (float)RAND_MAX;
+}
+
+// rolling terrain with about 'triangleCount' triangles, one unit per quad
+static vector<vec3> makeLevel(unsigned int triangleCount)
+{
+  unsigned int size = (unsigned int)sqrt(triangleCount / 2.0);
+  vector<vec3> triangles;
+  triangles.reserve(size * size * 6);
+
+  for (unsigned int z = 0; z < size; z++) {
+    for (unsigned int x = 0; x < size; x++) {
+      vec3 p[4];
+      for (int i = 0; i < 4; i++) {
+        float px = (float)(x + (i & 1));
+        float pz = (float)(z + (i >> 1));
+        p[i] = vec3(px, 2.0f * sinf(px * 0.05f) * cosf(pz * 0.07f), pz);
+      }
+      triangles.push_back(p[0]); triangles.push_back(p[2]); triangles.push_back(p[1]);
+      triangles.push_back(p[1]); triangles.push_back(p[2]); triangles.push_back(p[3]);
+    }
+  }
+  return triangles;
+}
+
+struct Sweep {
+  vec3 position;
+  vec3 velocity;
+};
+
+static vector<Sweep> makeSweeps(const AABB& bounds, unsigned int count)
+{
+  vector<Sweep> sweeps(count);
+  vec3 extent = bounds.upper - bounds.lower;
+  for (unsigned int i = 0; i < count; i++) {
+    sweeps[i].position = bounds.lower + vec3(randomFloat() * extent[0], 1.5f, randomFloat() * extent[2]);
+    sweeps[i].velocity = vec3(randomFloat() - 0.5f, -0.5f * randomFloat(), randomFloat() - 0.5f);
+  }
+  return sweeps;
+}
+
+static void setupPacket(CollisionPacket& packet, const Sweep& sweep, const vec3& radius)
+{
+  packet.eRadius = radius;
+  packet.basePoint = sweep.position / radius;
+  packet.velocity = sweep.velocity / radius;
+  packet.normalizedVelocity = normalize(packet.velocity);
+  packet.foundCollision = false;
+  packet.nearestDistance = FLT_MAX;
+}
+
+static AABB sweepBounds(const Sweep& sweep, const vec3& radius)
+{
+  vec3 end = sweep.position + sweep.velocity;
+  return AABB(min(sweep.position, end) - radius, max(sweep.position, end) + radius);
+}
+
+static void benchBuild(const vector<vec3>& triangles, BVH& bvh)
+{
+  unsigned int cores = MAX(std::thread::hardware_concurrency(), 1u);
+  printf("build (%u triangles)\n", (unsigned int)(triangles.size() / 3));
+
+  // powers of two up to the core count, then every core
+  vector<unsigned int> threadCounts;
+  for (unsigned int threads = 1; threads < cores; threads *= 2)
+    threadCounts.push_back(threads);
+  threadCounts.push_back(cores);
+
+  for (unsigned int i = 0; i < threadCounts.size(); i++) {
+    double start = now();
+    bvh.build(triangles, threadCounts[i]);
+    printf("  %2u threads: %8.1f ms\n", threadCounts[i], (now() - start) * 1000.0);
+  }
+
+  BVHStats stats = bvh.stats();
+  printf("  sah cost %.2f, %u nodes, %u leaves, depth %u, leaf fill %.2f (max %u)%s\n",
+         stats.sahCost, stats.nodeCount, stats.leafCount, stats.maxDepth,
+         stats.averageLeafSize, stats.maxLeafSize,
+         failIf(stats.maxLeafSize > BVH_LEAF_SIZE, " ERROR: leaf over BVH_LEAF_SIZE"));
+}
+
+static void benchQueries(const vector<vec3>& triangles, const BVH& bvh,
+                         const vector<Sweep>& sweeps, const vec3& radius)
+{
+  vector<unsigned int> candidates;
+  unsigned long long candidateCount = 0;
+  int hits = 0;
+
+  double start = now();
+  for (unsigned int i = 0; i < sweeps.size(); i++) {
+    candidates.clear();
+    bvh.query(sweepBounds(sweeps[i], radius), candidates);
+    candidateCount += candidates.size();
+  }
+  double queryTime = now() - start;
+
+  start = now();
+  for (unsigned int i = 0; i < sweeps.size(); i++) {
+    CollisionPacket packet;
+    setupPacket(packet, sweeps[i], radius);
+    candidates.clear();
+    bvh.query(sweepBounds(sweeps[i], radius), candidates);
+    for (unsigned int j = 0; j < candidates.size(); j++) {
+      unsigned int t = candidates[j] * 3;
+      checkTriangle(&packet, triangles[t] / radius, triangles[t+1] / radius,
+                    triangles[t+2] / radius);
+    }
+    hits += packet.foundCollision;
+  }
+  double checkTime = now() - start;
+
+  printf("traversal (%u sweeps)\n", (unsigned int)sweeps.size());
+  printf("  query:        %8.3f us/sweep, %.1f candidates/sweep\n",
+         queryTime * 1e6 / sweeps.size(), (double)candidateCount / sweeps.size());
+  printf("  query+narrow: %8.3f us/sweep, %d hits\n",
+         checkTime * 1e6 / sweeps.size(), hits);
+}
+
+// axes of a random orientation, one per column
+static mat3 randomRotation()
+{
+  vec3 x = normalize(vec3(randomFloat(), randomFloat(), randomFloat()) - vec3(0.5f));
+  vec3 y = normalize(cross(x, vec3(randomFloat(), randomFloat(), randomFloat()) - vec3(0.5f)));
+  mat3 m;
+  m[0] = x;
+  m[1] = y;
+  m[2] = cross(x, y);
+  return m;
+}
+
+// Both narrowphases must hit exactly the same point at the same distance.
+static bool sameHit(const CollisionPacket& a, const CollisionPacket& b)
+{
+  return a.foundCollision == b.foundCollision &&
+         (!a.foundCollision ||
+          (memcmp(&a.nearestDistance, &b.nearestDistance, sizeof(a.nearestDistance)) == 0 &&
+           memcmp(&a.intersectionPoint, &b.intersectionPoint, sizeof(a.intersectionPoint)) == 0));
+}
+
+#ifdef COLLISION_X86
+// Random triangle soups with degenerate and flat triangles, some with
+// random features, random sweeps through them, a random earlier hit and a
+// random range of the store: the AVX2 narrowphase against the scalar one.
+static void compareAVX2(unsigned int sweepCount)
+{
+  unsigned int differ = 0, hits = 0, sphereDiffer = 0, sphereHits = 0;
+  unsigned int capsuleDiffer = 0, capsuleHits = 0, boxDiffer = 0, boxHits = 0;
+  TriangleStore store;
+  for (unsigned int i = 0; i < sweepCount; i++) {
+    vec3 radius(0.3f + randomFloat(), 0.3f + randomFloat(), 0.3f + randomFloat());
+    unsigned int count = 1 + rand() % 40;
+    store.clear();
+    for (unsigned int j = 0; j < count; j++) {
+      vec3 p[3];
+      for (int k = 0; k < 3; k++)
+        p[k] = vec3(randomFloat(), randomFloat(), randomFloat()) * 4.0f - vec3(2.0f);
+      if (rand() % 10 == 0)
+        p[2] = p[1];
+      if (rand() % 10 == 0)
+        p[1][1] = p[2][1] = p[0][1];
+      unsigned int features = rand() % 2 ? FEATURES_ALL : rand() & 0xffffff;
+      vec3 neighbours[3];
+      for (int k = 0; k < 3; k++)
+        neighbours[k] = rand() % 4 ? normalize(vec3(randomFloat(), randomFloat(), randomFloat()) -
+                                               vec3(0.5f)) : vec3(0.0f);
+      store.add(p[0], p[1], p[2], radius, features, neighbours);
+    }
+
+    Sweep sweep;
+    sweep.position = vec3(randomFloat(), randomFloat(), randomFloat()) * 4.0f - vec3(2.0f);
+    sweep.velocity = vec3(randomFloat(), randomFloat(), randomFloat()) * 4.0f - vec3(2.0f);
+    if (rand() % 8 == 0)
+      sweep.velocity[1] = 0.0f;
+    CollisionPacket scalar, wide;
+    setupPacket(scalar, sweep, radius);
+    if (rand() % 4 == 0) {
+      scalar.foundCollision = true;
+      scalar.nearestDistance = randomFloat() * 2.0f;
+    }
+    wide = scalar;
+    // the same store as R3 triangles against a sphere of radius[0]
+    CollisionPacket sphere = scalar, sphereWide;
+    sphere.eRadius = vec3(radius[0]);
+    sphereWide = sphere;
+
+    unsigned int first = rand() % count;
+    unsigned int length = rand() % (count - first + 1);
+    AABB all(vec3(-FLT_MAX), vec3(FLT_MAX));
+    checkTrianglesScalar(&scalar, store, first, length, all);
+    checkTrianglesAVX2(&wide, store, first, length, all);
+    differ += !sameHit(scalar, wide);
+    hits += scalar.foundCollision;
+    checkSphereTrianglesScalar(&sphere, store, first, length, all);
+    checkSphereTrianglesAVX2(&sphereWide, store, first, length, all);
+    sphereDiffer += !sameHit(sphere, sphereWide);
+    sphereHits += sphere.foundCollision;
+
+    // capsules, some without a segment, and boxes turned any way
+    CollisionPacket capsule = sphere, capsuleWide;
+    capsule.eRadius = vec3(radius[0], radius[0] + (rand() % 4 ? randomFloat() : 0.0f),
+                           radius[0]);
+    capsuleWide = capsule;
+    checkCapsuleTrianglesScalar(&capsule, store, first, length, all);
+    checkCapsuleTrianglesAVX2(&capsuleWide, store, first, length, all);
+    capsuleDiffer += !sameHit(capsule, capsuleWide);
+    capsuleHits += capsule.foundCollision;
+
+    CollisionPacket box = sphere, boxWide;
+    box.eRadius = radius;
+    box.orientation = randomRotation();
+    boxWide = box;
+    checkBoxTrianglesScalar(&box, store, first, length, all);
+    checkBoxTrianglesAVX2(&boxWide, store, first, length, all);
+    boxDiffer += !sameHit(box, boxWide);
+    boxHits += box.foundCollision;
+  }
+  printf("  avx2 vs scalar: %u random soups, %u hits, %u differ%s\n", sweepCount, hits, differ,
+         failIf(differ, " (ERROR)"));
+  printf("  spheres:        %u random soups, %u hits, %u differ%s\n", sweepCount, sphereHits,
+         sphereDiffer, failIf(sphereDiffer, " (ERROR)"));
+  printf("  capsules:       %u random soups, %u hits, %u differ%s\n", sweepCount, capsuleHits,
+         capsuleDiffer, failIf(capsuleDiffer, " (ERROR)"));
+  printf("  boxes:          %u random soups, %u hits, %u differ%s\n", sweepCount, boxHits,
+         boxDiffer, failIf(boxDiffer, " (ERROR)"));
+}
+#endif
+
+// The narrowphase alone, on the candidates of every sweep laid out one
+// sweep after the other like the working set of a CharacterEntity:
+// checkTriangle on e-space triangles against the precomputed store.
+static void benchNarrowphase(const vector<vec3>& triangles, const BVH& bvh,
+                             const vector<Sweep>& sweeps, const vec3& radius)
+{
+  vector<unsigned int> candidates;
+  vector<unsigned int> offsets(sweeps.size() + 1, 0);
+  vector<vec3> eTriangles;
+  for (unsigned int i = 0; i < sweeps.size(); i++) {
+    unsigned int first = candidates.size();
+    bvh.query(sweepBounds(sweeps[i], radius), candidates);
+    for (unsigned int j = first; j < candidates.size(); j++) {
+      for (int k = 0; k < 3; k++)
+        eTriangles.push_back(triangles[candidates[j] * 3 + k] / radius);
+    }
+    offsets[i+1] = eTriangles.size() / 3;
+  }
+  unsigned int candidateCount = offsets.back();
+
+  TriangleStore store;
+  store.reserve(candidateCount);
+  double start = now();
+  for (unsigned int t = 0; t < candidateCount * 3; t += 3)
+    store.add(eTriangles[t], eTriangles[t+1], eTriangles[t+2]);
+  double storeTime = now() - start;
+
+  // one small store cleared for each sweep, like a CharacterEntity's;
+  // in steady state a character gathers around the same spot every frame,
+  // so the same 1000 sweeps are repeated as 100 frames
+  unsigned int frameSweeps = MIN((unsigned int)sweeps.size(), 1000u);
+  TriangleStore gathered;
+  start = now();
+  for (int frame = 0; frame < 100; frame++) {
+    for (unsigned int i = 0; i < frameSweeps; i++) {
+      gathered.clear();
+      for (unsigned int j = offsets[i]; j < offsets[i+1]; j++) {
+        unsigned int t = candidates[j] * 3;
+        gathered.add(triangles[t], triangles[t+1], triangles[t+2], radius);
+      }
+    }
+  }
+  double convertTime = now() - start;
+  unsigned int gatherCount = offsets[frameSweeps] * 100;
+
+  // each narrowphase over every working set, taking turns and keeping the
+  // fastest of a few rounds, one timing alone is at the mercy of the machine
+  vector<CollisionPacket> plain(sweeps.size()), stored(sweeps.size());
+  double plainTime = FLT_MAX, storedTime = FLT_MAX;
+#ifdef COLLISION_X86
+  bool avx2 = cpuCollisionISA() >= COLLISION_AVX2;
+  vector<CollisionPacket> wide(sweeps.size());
+  double wideTime = FLT_MAX;
+#endif
+  for (int round = 0; round < 5; round++) {
+    start = now();
+    for (unsigned int i = 0; i < sweeps.size(); i++) {
+      setupPacket(plain[i], sweeps[i], radius);
+      for (unsigned int t = offsets[i] * 3; t < offsets[i+1] * 3; t += 3)
+        checkTriangle(&plain[i], eTriangles[t], eTriangles[t+1], eTriangles[t+2]);
+    }
+    plainTime = MIN(plainTime, now() - start);
+
+    start = now();
+    for (unsigned int i = 0; i < sweeps.size(); i++) {
+      setupPacket(stored[i], sweeps[i], radius);
+      AABB box = sweepBounds(sweeps[i], radius);
+      checkTrianglesScalar(&stored[i], store, offsets[i], offsets[i+1] - offsets[i],
+                           AABB(box.lower / radius, box.upper / radius));
+    }
+    storedTime = MIN(storedTime, now() - start);
+
+#ifdef COLLISION_X86
+    start = now();
+    for (unsigned int i = 0; avx2 && i < sweeps.size(); i++) {
+      setupPacket(wide[i], sweeps[i], radius);
+      AABB box = sweepBounds(sweeps[i], radius);
+      checkTrianglesAVX2(&wide[i], store, offsets[i], offsets[i+1] - offsets[i],
+                         AABB(box.lower / radius, box.upper / radius));
+    }
+    wideTime = MIN(wideTime, now() - start);
+#endif
+  }
+
+#ifdef COLLISION_X86
+  int wideDiffer = 0;
+  for (unsigned int i = 0; avx2 && i < sweeps.size(); i++)
+    wideDiffer += !sameHit(stored[i], wide[i]);
+#endif
+
+  int differ = 0;
+  for (unsigned int i = 0; i < sweeps.size(); i++) {
+    if (plain[i].foundCollision != stored[i].foundCollision ||
+        (plain[i].foundCollision &&
+         fabs(plain[i].nearestDistance - stored[i].nearestDistance) > 1e-4))
+      differ++;
+  }
+
+  printf("narrowphase (%u triangles)\n", candidateCount);
+  printf("  store build:    %8.2f ns/triangle\n", storeTime * 1e9 / candidateCount);
+  printf("  gather:         %8.2f ns/triangle\n", convertTime * 1e9 / gatherCount);
+  printf("  checkTriangle:  %8.2f ns/triangle\n", plainTime * 1e9 / candidateCount);
+  printf("  triangle store: %8.2f ns/triangle%s\n", storedTime * 1e9 / candidateCount,
+         failIf(differ, " (ERROR: results differ)"));
+#ifdef COLLISION_X86
+  if (avx2) {
+    printf("  avx2:           %8.2f ns/triangle%s\n", wideTime * 1e9 / candidateCount,
+           failIf(wideDiffer, " (ERROR: results differ)"));
+    compareAVX2(20000);
+  }
+#endif
+}
+
+// Every kernel at every level the CPU runs, each against the generic
+// version: the instance transform, the quantized sweep traversal and the
+// narrowphase on the store.
+static void benchKernels(const vector<vec3>& triangles, const BVH& bvh,
+                         const vector<Sweep>& sweeps, const vec3& radius)
+{
+  QuantizedBVH quantized;
+  quantized.build(bvh);
+  mat4 transform = glm::translate(mat4(1.0f), vec3(3.0f, -1.0f, 7.0f)) *
+                   glm::rotate(mat4(1.0f), 0.7f, glm::normalize(vec3(1.0f, 2.0f, 3.0f)));
+
+  unsigned int sweepCount = MIN((unsigned int)sweeps.size(), 20000u);
+  vector<unsigned int> offsets(sweepCount + 1, 0);
+  TriangleStore store;
+  vector<TriangleSpan> spans(4096);
+  for (unsigned int i = 0; i < sweepCount; i++) {
+    vec3 end = sweeps[i].position + sweeps[i].velocity;
+    unsigned int spanCount = quantized.querySpans(sweeps[i].position, end, radius,
+                                                  &spans[0], spans.size());
+    for (unsigned int j = 0; j < spanCount && j < spans.size(); j++) {
+      for (unsigned int k = 0; k < spans[j].count; k++) {
+        unsigned int t = spans[j].indices[k] * 3;
+        store.add(triangles[t], triangles[t+1], triangles[t+2], radius);
+      }
+    }
+    offsets[i+1] = store.size();
+  }
+
+  CollisionISA cpu = cpuCollisionISA();
+  vector<vec3> expected, transformed(triangles.size());
+  vector<unsigned int> expectedSpans, foundSpans;
+  vector<CollisionPacket> expectedHits, hits(sweepCount);
+
+  printf("kernels (cpu: %s)\n", collisionISAName(cpu));
+  for (int isa = COLLISION_GENERIC; isa <= cpu; isa++) {
+    setCollisionISA((CollisionISA)isa);
+    const CollisionKernels& kernels = collisionKernels();
+
+    double start = now();
+    kernels.transformPoints(transform, &triangles[0], &transformed[0], triangles.size());
+    double transformTime = now() - start;
+
+    foundSpans.clear();
+    start = now();
+    for (unsigned int i = 0; i < sweepCount; i++) {
+      vec3 end = sweeps[i].position + sweeps[i].velocity;
+      unsigned int spanCount = quantized.querySpans(sweeps[i].position, end, radius,
+                                                    &spans[0], spans.size());
+      for (unsigned int j = 0; j < spanCount && j < spans.size(); j++)
+        foundSpans.push_back(spans[j].indices - &quantized.indices[0]);
+    }
+    double queryTime = now() - start;
+
+    start = now();
+    for (unsigned int i = 0; i < sweepCount; i++) {
+      setupPacket(hits[i], sweeps[i], radius);
+      AABB box = sweepBounds(sweeps[i], radius);
+      kernels.checkTriangles(&hits[i], store, offsets[i], offsets[i+1] - offsets[i],
+                             AABB(box.lower / radius, box.upper / radius));
+    }
+    double checkTime = now() - start;
+
+    if (isa == COLLISION_GENERIC) {
+      expected = transformed;
+      expectedSpans = foundSpans;
+      expectedHits = hits;
+    }
+    unsigned int differ = 0;
+    differ += memcmp(&expected[0], &transformed[0], triangles.size() * sizeof(vec3)) != 0;
+    differ += expectedSpans != foundSpans;
+    for (unsigned int i = 0; i < sweepCount; i++)
+      differ += !sameHit(expectedHits[i], hits[i]);
+
+    printf("  %-8s transform %6.2f ns/vertex, sweep query %7.3f us, narrowphase %6.2f ns/triangle%s\n",
+           collisionISAName((CollisionISA)isa), transformTime * 1e9 / triangles.size(),
+           queryTime * 1e6 / sweepCount, checkTime * 1e9 / MAX(store.size(), 1u),
+           failIf(differ, " (ERROR: results differ)"));
+  }
+  setCollisionISA(cpu);
+}
+
+// A uniform radius through the ellipsoid path, scaling the candidates
+// into e-space, against the sphere path on the triangles as they are.
+static void benchSphere(const vector<vec3>& triangles, const BVH& bvh,
+                        const vector<Sweep>& sweeps, float sphereRadius)
+{
+  vec3 radius(sphereRadius);
+  unsigned int sweepCount = MIN((unsigned int)sweeps.size(), 20000u);
+  vector<unsigned int> candidates;
+  vector<unsigned int> offsets(sweepCount + 1, 0);
+  for (unsigned int i = 0; i < sweepCount; i++) {
+    bvh.query(sweepBounds(sweeps[i], radius), candidates);
+    offsets[i+1] = candidates.size();
+  }
+
+  TriangleStore store;
+  vector<CollisionPacket> ellipsoid(sweepCount), sphere(sweepCount);
+  double start = now();
+  for (unsigned int i = 0; i < sweepCount; i++) {
+    store.clear();
+    for (unsigned int j = offsets[i]; j < offsets[i+1]; j++) {
+      unsigned int t = candidates[j] * 3;
+      store.add(triangles[t], triangles[t+1], triangles[t+2], radius);
+    }
+    setupPacket(ellipsoid[i], sweeps[i], radius);
+    AABB box = sweepBounds(sweeps[i], radius);
+    checkTriangles(&ellipsoid[i], store, 0, store.size(),
+                   AABB(box.lower / radius, box.upper / radius));
+  }
+  double ellipsoidTime = now() - start;
+
+  start = now();
+  for (unsigned int i = 0; i < sweepCount; i++) {
+    store.clear();
+    for (unsigned int j = offsets[i]; j < offsets[i+1]; j++) {
+      unsigned int t = candidates[j] * 3;
+      store.add(triangles[t], triangles[t+1], triangles[t+2]);
+    }
+    setupPacket(sphere[i], sweeps[i], vec3(1.0f));
+    sphere[i].eRadius = radius;
+    checkSphereTriangles(&sphere[i], store, 0, store.size(), sweepBounds(sweeps[i], radius));
+  }
+  double sphereTime = now() - start;
+
+  // the same hits, up to rounding, distances in R3
+  unsigned int differ = 0, hits = 0;
+  for (unsigned int i = 0; i < sweepCount; i++) {
+    hits += sphere[i].foundCollision;
+    if (ellipsoid[i].foundCollision != sphere[i].foundCollision ||
+        (sphere[i].foundCollision &&
+         fabs(ellipsoid[i].nearestDistance * sphereRadius - sphere[i].nearestDistance) > 1e-4))
+      differ++;
+  }
+
+  printf("sphere (radius %.2f, %u sweeps, %u hits)\n", sphereRadius, sweepCount, hits);
+  printf("  as ellipsoid: %8.3f us/sweep\n", ellipsoidTime * 1e6 / sweepCount);
+  printf("  as sphere:    %8.3f us/sweep%s\n", sphereTime * 1e6 / sweepCount,
+         failIf(differ, " (ERROR: results differ)"));
+}
+
+// The ellipsoid of radius against a capsule and a box of the same size,
+// the box turned a little about y, each on the candidates of its own
+// bounds laid out one sweep after the other, in R3 for the capsule and
+// the box. Scalar and the dispatched kernels for the new shapes.
+static void benchShapes(const vector<vec3>& triangles, const BVH& bvh,
+                        const vector<Sweep>& sweeps, const vec3& radius)
+{
+  typedef void (*Kernel)(CollisionPacket*, const TriangleStore&, unsigned int, unsigned int,
+                         const AABB&);
+  unsigned int sweepCount = MIN((unsigned int)sweeps.size(), 20000u);
+  CollisionPacket shape;
+  shape.eRadius = radius;
+  float angle = 0.5f;
+  shape.orientation = mat3(1.0f);
+  shape.orientation[0] = vec3(cosf(angle), 0.0f, -sinf(angle));
+  shape.orientation[2] = vec3(sinf(angle), 0.0f, cosf(angle));
+  vec3 boxBounds = BoxShape::bounds(shape);
+
+  const char *names[] = { "ellipsoid", "capsule", "box" };
+  vec3 bounds[] = { radius, radius, boxBounds };
+  Kernel scalar[] = { checkTrianglesScalar, checkCapsuleTrianglesScalar, checkBoxTrianglesScalar };
+  Kernel dispatched[] = { checkTriangles, checkCapsuleTriangles, checkBoxTriangles };
+
+  printf("shapes (%.2f x %.2f x %.2f, %u sweeps)\n", radius[0], radius[1], radius[2], sweepCount);
+  vector<unsigned int> candidates;
+  vector<CollisionPacket> packets(sweepCount);
+  for (int s = 0; s < 3; s++) {
+    // e-space for the ellipsoid, R3 for the others
+    vec3 scale = s == 0 ? radius : vec3(1.0f);
+    TriangleStore store;
+    vector<unsigned int> offsets(sweepCount + 1, 0);
+    for (unsigned int i = 0; i < sweepCount; i++) {
+      candidates.clear();
+      bvh.query(sweepBounds(sweeps[i], bounds[s]), candidates);
+      for (unsigned int j = 0; j < candidates.size(); j++) {
+        unsigned int t = candidates[j] * 3;
+        store.add(triangles[t], triangles[t+1], triangles[t+2], scale);
+      }
+      offsets[i+1] = store.size();
+    }
+
+    double times[2];
+    unsigned int hits = 0;
+    for (int k = 0; k < 2; k++) {
+      Kernel kernel = k == 0 ? scalar[s] : dispatched[s];
+      hits = 0;
+      double start = now();
+      for (unsigned int i = 0; i < sweepCount; i++) {
+        setupPacket(packets[i], sweeps[i], scale);
+        packets[i].eRadius = radius;
+        packets[i].orientation = shape.orientation;
+        AABB box = sweepBounds(sweeps[i], bounds[s]);
+        kernel(&packets[i], store, offsets[i], offsets[i+1] - offsets[i],
+               AABB(box.lower / scale, box.upper / scale));
+        hits += packets[i].foundCollision;
+      }
+      times[k] = now() - start;
+    }
+
+    printf("  %-9s %6.1f candidates/sweep, %8.3f us/sweep scalar, %8.3f %s, %u hits\n",
+           names[s], store.size() / (float)sweepCount, times[0] * 1e6 / sweepCount,
+           times[1] * 1e6 / sweepCount, collisionISAName(collisionKernels().isa), hits);
+  }
+}
+
+// The store features of the candidates, with internal edges and vertices
+// treated as any other or kept as built.
+static void addFeatures(vector<unsigned int>& features, const MeshAdjacency& adjacency,
+                        const vector<unsigned int>& candidates, unsigned int first,
+                        unsigned int last, bool internal)
+{
+  features.clear();
+  for (unsigned int j = first; j < last; j++) {
+    TriangleFeatures f = adjacency.triangles[candidates[j]];
+    if (!internal)
+      f.internal = 0;
+    features.push_back(storeFeatures(f));
+  }
+}
+
+// Adjacency of the level: how long it takes to build, how much of it is
+// internal, and the narrowphase testing each shared edge and vertex once
+// against the one testing every triangle in full. With nothing internal
+// both find the same hits. Spheres sliding along a flat tessellated floor,
+// sunk into it a little as rounding leaves them, catch on its edges unless
+// internal ones are skipped.
+static void benchAdjacency(const vector<vec3>& triangles, const BVH& bvh,
+                           const vector<Sweep>& sweeps, const vec3& radius)
+{
+  MeshAdjacency adjacency;
+  double start = now();
+  adjacency.build(triangles, triangles.size() / 3);
+  double buildTime = now() - start;
+
+  unsigned int internalEdges = 0, internalVertices = 0;
+  for (unsigned int i = 0; i < adjacency.triangles.size(); i++) {
+    for (int k = 0; k < 3; k++) {
+      internalEdges += adjacency.triangles[i].internal >> k & 1;
+      internalVertices += adjacency.triangles[i].internal >> (3 + k) & 1;
+    }
+  }
+
+  unsigned int sweepCount = MIN((unsigned int)sweeps.size(), 20000u);
+  vector<unsigned int> candidates;
+  vector<unsigned int> offsets(sweepCount + 1, 0);
+  for (unsigned int i = 0; i < sweepCount; i++) {
+    bvh.query(sweepBounds(sweeps[i], radius), candidates);
+    offsets[i+1] = candidates.size();
+  }
+
+  TriangleStore store, owned, linked;
+  vector<unsigned int> features;
+  vector<CollisionPacket> plain(sweepCount), shared(sweepCount), skipped(sweepCount);
+  double plainTime = 0.0, sharedTime = 0.0, skippedTime = 0.0;
+  for (unsigned int i = 0; i < sweepCount; i++) {
+    store.clear();
+    owned.clear();
+    linked.clear();
+    addFeatures(features, adjacency, candidates, offsets[i], offsets[i+1], false);
+    for (unsigned int j = offsets[i]; j < offsets[i+1]; j++) {
+      unsigned int t = candidates[j];
+      ESpaceTriangle triangle(triangles[t*3], triangles[t*3+1], triangles[t*3+2], radius);
+      store.add(triangle);
+      vec3 neighbours[3];
+      unsigned int tested = features[j - offsets[i]];
+      adjacency.neighbourNormals(triangles, t, radius, tested, neighbours);
+      owned.add(triangle, tested, neighbours);
+      tested = adjacency.features[t];
+      adjacency.neighbourNormals(triangles, t, radius, tested, neighbours);
+      linked.add(triangle, tested, neighbours);
+    }
+    AABB box = sweepBounds(sweeps[i], radius);
+    box = AABB(box.lower / radius, box.upper / radius);
+
+    setupPacket(plain[i], sweeps[i], radius);
+    start = now();
+    checkTriangles(&plain[i], store, 0, store.size(), box);
+    plainTime += now() - start;
+
+    setupPacket(shared[i], sweeps[i], radius);
+    start = now();
+    checkTriangles(&shared[i], owned, 0, owned.size(), box);
+    sharedTime += now() - start;
+
+    setupPacket(skipped[i], sweeps[i], radius);
+    start = now();
+    checkTriangles(&skipped[i], linked, 0, linked.size(), box);
+    skippedTime += now() - start;
+  }
+
+  // the same hits up to rounding, as shared edges are tested from one side
+  // or the other
+  unsigned int earlier = 0, later = 0, hits = 0, skippedHits = 0;
+  for (unsigned int i = 0; i < sweepCount; i++) {
+    hits += plain[i].foundCollision;
+    skippedHits += skipped[i].foundCollision;
+    float distance = plain[i].foundCollision ? plain[i].nearestDistance : FLT_MAX;
+    float sharedDistance = shared[i].foundCollision ? shared[i].nearestDistance : FLT_MAX;
+    earlier += sharedDistance < distance - 1e-4f;
+    later += sharedDistance > distance + 1e-4f;
+  }
+
+  // a flat floor of unit quads, two triangles each
+  vector<vec3> floor;
+  for (int z = -8; z < 8; z++) {
+    for (int x = -8; x < 8; x++) {
+      vec3 p[4];
+      for (int i = 0; i < 4; i++)
+        p[i] = vec3((float)(x + (i & 1)), 0.0f, (float)(z + (i >> 1)));
+      floor.push_back(p[0]); floor.push_back(p[2]); floor.push_back(p[1]);
+      floor.push_back(p[1]); floor.push_back(p[2]); floor.push_back(p[3]);
+    }
+  }
+  MeshAdjacency floorAdjacency;
+  floorAdjacency.build(floor, floor.size() / 3);
+  store.clear();
+  linked.clear();
+  for (unsigned int i = 0; i < floor.size() / 3; i++) {
+    store.add(floor[i*3], floor[i*3+1], floor[i*3+2]);
+    vec3 neighbours[3];
+    unsigned int tested = floorAdjacency.features[i];
+    floorAdjacency.neighbourNormals(floor, i, vec3(1.0f), tested, neighbours);
+    linked.add(floor[i*3], floor[i*3+1], floor[i*3+2], vec3(1.0f), tested, neighbours);
+  }
+
+  unsigned int slides = 1000, ghosts = 0, skippedGhosts = 0;
+  for (unsigned int i = 0; i < slides; i++) {
+    float angle = randomFloat() * 6.2831853f;
+    Sweep sweep;
+    sweep.position = vec3(randomFloat() * 8.0f - 4.0f, 0.999f, randomFloat() * 8.0f - 4.0f);
+    sweep.velocity = vec3(cosf(angle), 0.0f, sinf(angle)) * 0.25f;
+    AABB box = sweepBounds(sweep, vec3(1.0f));
+
+    CollisionPacket packet;
+    setupPacket(packet, sweep, vec3(1.0f));
+    checkTriangles(&packet, store, 0, store.size(), box);
+    ghosts += packet.foundCollision;
+    setupPacket(packet, sweep, vec3(1.0f));
+    checkTriangles(&packet, linked, 0, linked.size(), box);
+    skippedGhosts += packet.foundCollision;
+  }
+
+  // a pose of the whole level, as updateMesh gets for a skinned mesh:
+  // refolding must find what a fresh build finds
+  vector<vec3> posed = triangles;
+  vector<unsigned int> moved(posed.size() / 3);
+  for (unsigned int i = 0; i < posed.size(); i++)
+    posed[i][1] += 3.0f * sinf(posed[i][0] * 0.3f) * cosf(posed[i][2] * 0.2f);
+  for (unsigned int i = 0; i < moved.size(); i++)
+    moved[i] = i;
+  MeshAdjacency folded;
+  folded.build(triangles, triangles.size() / 3);
+  start = now();
+  folded.refold(posed, moved);
+  double refoldTime = now() - start;
+  MeshAdjacency fresh;
+  fresh.build(posed, posed.size() / 3);
+  unsigned int wrong = 0, flipped = 0;
+  for (unsigned int i = 0; i < moved.size(); i++) {
+    wrong += folded.features[i] != fresh.features[i];
+    flipped += folded.triangles[i].internal != adjacency.triangles[i].internal;
+  }
+
+  printf("adjacency (%u vertices, %u edges)\n", adjacency.vertexCount, adjacency.edgeCount);
+  printf("  build:    %8.1f ms\n", buildTime * 1000.0);
+  printf("  refold:   %8.1f ms after a pose, %u triangles folded differently\n",
+         refoldTime * 1000.0, flipped);
+  if (wrong > 0) {
+    failures++;
+    printf("  ERROR: %u triangles refolded unlike a fresh build\n", wrong);
+  }
+  printf("  internal: %5.1f%% of edges, %5.1f%% of vertices\n",
+         internalEdges * 100.0 / (adjacency.triangles.size() * 3),
+         internalVertices * 100.0 / (adjacency.triangles.size() * 3));
+  printf("  every triangle:   %8.3f us/sweep, %u hits\n", plainTime * 1e6 / sweepCount, hits);
+  printf("  shared once:      %8.3f us/sweep, %u hits earlier, %u later%s\n",
+         sharedTime * 1e6 / sweepCount, earlier, later,
+         failIf(earlier || later, " (ERROR: sharing changes hits)"));
+  printf("  internal skipped: %8.3f us/sweep, %u hits\n", skippedTime * 1e6 / sweepCount,
+         skippedHits);
+  printf("  ghost hits sliding on a flat floor: %u of %u, %u with internal skipped\n",
+         ghosts, slides, skippedGhosts);
+}
+
+// Many characters' sweeps in one tick: each on its own, querying and
+// converting its candidates like CharacterEntity does, against one
+// CollisionBatch call. Characters stand in crowds of 100 on 16 x 16 units,
+// as they gather in towns and arenas, spread over the level.
+static void benchBatch(const vector<vec3>& triangles, const vec3& radius)
+{
+  CollisionWorld world;
+  world.addTriangles(triangles);
+  AABB bounds = world.bvh.nodes[0].bounds;
+  vec3 extent = bounds.upper - bounds.lower;
+
+  vector<TriangleSpan> spans(64);
+  vector<vec3> vertices;
+  vector<unsigned int> features, indices;
+  TriangleStore store;
+  CollisionBatch batch;
+
+  printf("batch (crowds of 100)\n");
+  unsigned int counts[] = { 1000, 10000, 100000 };
+  for (unsigned int c = 0; c < 3; c++) {
+    unsigned int count = counts[c];
+    vector<Sweep> sweeps(count);
+    vec3 center;
+    for (unsigned int i = 0; i < count; i++) {
+      if (i % 100 == 0)
+        center = bounds.lower + vec3(randomFloat() * extent[0], 1.5f, randomFloat() * extent[2]);
+      sweeps[i].position = center + vec3(randomFloat() * 16.0f - 8.0f, 0.0f,
+                                         randomFloat() * 16.0f - 8.0f);
+      sweeps[i].velocity = vec3(randomFloat() - 0.5f, -0.5f * randomFloat(), randomFloat() - 0.5f);
+    }
+
+    // taking turns and keeping the fastest of a few rounds
+    vector<CollisionPacket> single(count), batched(count);
+    double singleTime = FLT_MAX, batchTime = FLT_MAX;
+    for (int round = 0; round < 3; round++) {
+      for (unsigned int i = 0; i < count; i++) {
+        setupPacket(single[i], sweeps[i], radius);
+        setupPacket(batched[i], sweeps[i], radius);
+      }
+
+      double start = now();
+      for (unsigned int i = 0; i < count; i++) {
+        AABB box = sweepBounds(sweeps[i], radius);
+        unsigned int spanCount = world.querySpans(box, &spans[0], spans.size());
+        if (spanCount > spans.size()) {
+          spans.resize(spanCount);
+          world.querySpans(box, &spans[0], spans.size());
+        }
+        store.clear();
+        world.gatherSpans(&spans[0], spanCount, box, radius, store, vertices, features, indices);
+        checkTriangles(&single[i], store, 0, store.size(),
+                       AABB(box.lower / radius, box.upper / radius));
+      }
+      singleTime = MIN(singleTime, now() - start);
+
+      start = now();
+      batch.check(world, &batched[0], count);
+      batchTime = MIN(batchTime, now() - start);
+    }
+
+    // the same hits up to rounding, blocks restart from the nearest hit
+    unsigned int differ = 0;
+    for (unsigned int i = 0; i < count; i++) {
+      if (single[i].foundCollision != batched[i].foundCollision ||
+          (single[i].foundCollision &&
+           fabs(single[i].nearestDistance - batched[i].nearestDistance) > 1e-4))
+        differ++;
+    }
+
+    // the batch isn't expected to win here, the ratio shows by how much
+    // it loses or gains
+    printf("  %6u packets: %10.0f queries/s one by one, %10.0f batched (%.2fx), %u groups%s\n",
+           count, count / singleTime, count / batchTime, singleTime / batchTime,
+           batch.groupCount, differ ? " (ERROR: results differ)" : "");
+  }
+}
+
+static void benchCache(const vector<vec3>& triangles, const BVH& bvh)
+{
+  vector<unsigned int> all(triangles.size() / 3);
+  for (unsigned int i = 0; i < all.size(); i++)
+    all[i] = i;
+
+  double start = now();
+  unsigned long long key = hashBVHInput(triangles, all);
+  double hashTime = now() - start;
+
+  const char *path = "/tmp/collision_bench.bvh";
+  start = now();
+  bool saved = bvh.save(path, key);
+  double saveTime = now() - start;
+
+  BVH cached;
+  start = now();
+  bool loaded = cached.load(path, key, all.size());
+  double loadTime = now() - start;
+
+  // a body of the right length with a node or an index broken must not
+  // load, the header can't tell
+  vector<char> file;
+  FILE *in = fopen(path, "rb");
+  for (int c; in && (c = fgetc(in)) != EOF; )
+    file.push_back((char)c);
+  if (in)
+    fclose(in);
+  size_t body = file.size() - bvh.nodeCount * sizeof(BVHNode) -
+                bvh.indexCount * sizeof(unsigned int);
+  unsigned int interior = 0, leaf = 0;
+  while (bvh.nodes[interior].count > 0)
+    interior++;
+  while (bvh.nodes[leaf].count == 0)
+    leaf++;
+  const char *breaks[] = { "leaf past the indices", "child past the nodes",
+                           "child pointing back", "index past the triangles" };
+  unsigned int rejected = 0, breakCount = sizeof(breaks) / sizeof(breaks[0]);
+  for (unsigned int b = 0; b < breakCount; b++) {
+    vector<char> broken = file;
+    BVHNode *nodes = (BVHNode*)&broken[body];
+    unsigned int *indices = (unsigned int*)&broken[body + bvh.nodeCount * sizeof(BVHNode)];
+    if (b == 0)
+      nodes[leaf].left = bvh.indexCount;
+    else if (b == 1)
+      nodes[interior].left = bvh.nodeCount - 1;
+    else if (b == 2)
+      nodes[interior].left = interior;
+    else
+      indices[bvh.indexCount / 2] = all.size();
+    FILE *out = fopen(path, "wb");
+    fwrite(broken.data(), 1, broken.size(), out);
+    fclose(out);
+    BVH loadedBroken;
+    bool accepted = loadedBroken.load(path, key, all.size());
+    rejected += !accepted;
+    if (accepted)
+      printf("  ERROR: loaded a cache with a %s\n", breaks[b]);
+    failures += accepted;
+  }
+  remove(path);
+
+  // writers racing on the same tree must each get their own temporary file,
+  // whichever rename lands last leaves a whole tree behind
+  const unsigned int writerCount = 4;
+  std::atomic<unsigned int> racedSaves(0);
+  vector<std::thread> writers;
+  for (unsigned int i = 0; i < writerCount; i++)
+    writers.push_back(std::thread([&] { racedSaves += bvh.save(path, key); }));
+  for (unsigned int i = 0; i < writerCount; i++)
+    writers[i].join();
+  BVH raced;
+  bool racedLoad = raced.load(path, key, all.size()) && raced.nodeCount == bvh.nodeCount;
+  remove(path);
+
+  printf("cache\n");
+  printf("  hash: %8.1f ms\n", hashTime * 1000.0);
+  printf("  save: %8.1f ms%s\n", saveTime * 1000.0, failIf(!saved, " (failed)"));
+  printf("  load: %8.3f ms%s\n", loadTime * 1000.0,
+         failIf(!loaded || cached.nodeCount != bvh.nodeCount, " (failed)"));
+  printf("  concurrent saves: %u of %u%s\n", racedSaves.load(), writerCount,
+         failIf(racedSaves != writerCount || !racedLoad, " (failed)"));
+  printf("  broken bodies rejected: %u of %u\n", rejected, breakCount);
+}
+
+// Characters wandering around a square, a little each tick like a server
+// full of players, and the pairs the sweep-and-prune finds among them.
+static void benchSweepAndPrune(unsigned int characterCount)
+{
+  vec3 radius = vec3(0.5f, 1.0f, 0.5f);
+  float size = sqrtf((float)characterCount) * 3.0f;
+  vector<vec3> positions(characterCount);
+  vector<AABB> boxes(characterCount);
+  for (unsigned int i = 0; i < characterCount; i++) {
+    positions[i] = vec3(randomFloat() * size, 0.0f, randomFloat() * size);
+    boxes[i] = AABB(positions[i] - radius, positions[i] + radius);
+  }
+
+  SweepAndPrune sap;
+  vector<unsigned int> handles(characterCount);
+  double start = now();
+  for (unsigned int i = 0; i < characterCount; i++)
+    handles[i] = sap.add(boxes[i]);
+  sap.sort();
+  double addTime = now() - start;
+
+  vector<std::pair<unsigned int, unsigned int> > pairs;
+  unsigned long long pairCount = 0;
+  unsigned int ticks = 100;
+  start = now();
+  for (unsigned int tick = 0; tick < ticks; tick++) {
+    for (unsigned int i = 0; i < characterCount; i++) {
+      positions[i] += vec3(randomFloat() - 0.5f, 0.0f, randomFloat() - 0.5f) * 0.2f;
+      boxes[i] = AABB(positions[i] - radius, positions[i] + radius);
+      sap.update(handles[i], boxes[i]);
+    }
+    sap.sort();
+    pairs.clear();
+    sap.pairs(pairs);
+    pairCount += pairs.size();
+  }
+  double tickTime = (now() - start) / ticks;
+
+  // every pair the brute force finds must be there, in handle order
+  unsigned long long expected = 0;
+  for (unsigned int i = 0; i < characterCount; i++)
+    for (unsigned int j = i + 1; j < characterCount; j++)
+      expected += boxes[i].overlaps(boxes[j]);
+  bool matched = pairs.size() == expected;
+  bool sorted = std::is_sorted(pairs.begin(), pairs.end());
+
+  // drop every tenth box, none of its pairs may be left behind
+  start = now();
+  for (unsigned int i = 0; i < characterCount; i += 10)
+    sap.remove(handles[i]);
+  double removeTime = now() - start;
+  sap.sort();
+  unsigned long long remaining = 0;
+  for (unsigned int i = 0; i < characterCount; i++)
+    for (unsigned int j = i + 1; j < characterCount; j++)
+      remaining += i % 10 && j % 10 && boxes[i].overlaps(boxes[j]);
+  pairs.clear();
+  sap.pairs(pairs);
+
+  printf("sweep and prune (%u characters)\n", characterCount);
+  printf("  add:    %8.3f ms\n", addTime * 1000.0);
+  printf("  tick:   %8.3f ms, %.1f pairs/tick%s%s\n", tickTime * 1000.0,
+         (double)pairCount / ticks, failIf(!matched, " (ERROR: pairs differ)"),
+         failIf(!sorted, " (ERROR: pairs out of order)"));
+  printf("  remove: %8.3f ms for %u boxes%s\n", removeTime * 1000.0,
+         (characterCount + 9) / 10, failIf(pairs.size() != remaining, " (ERROR: pairs differ)"));
+}
+
+// Triangles first to first + count - 1 and a sample of the rest that
+// tree doesn't find where they are now.
+static unsigned int missedTriangles(const Broadphase& tree, const vector<vec3>& moved,
+                                    unsigned int first, unsigned int count)
+{
+  vector<unsigned int> found;
+  unsigned int missing = 0;
+  for (unsigned int j = 0; j < count + 10000; j++) {
+    unsigned int t = j < count ? first + j : rand() % (moved.size() / 3);
+    AABB box(moved[t*3], moved[t*3]);
+    box.grow(moved[t*3+1]);
+    box.grow(moved[t*3+2]);
+    found.clear();
+    tree.query(box, found);
+    missing += std::find(found.begin(), found.end(), t) == found.end();
+  }
+  return missing;
+}
+
+static void benchRefit(const vector<vec3>& triangles)
+{
+  // the level with a platform of 25 by 20 quads floating over its middle
+  vector<vec3> moved = triangles;
+  AABB level;
+  for (unsigned int i = 0; i < triangles.size(); i++)
+    level.grow(triangles[i]);
+  vec3 corner = level.center() - vec3(12.5f, 0.0f, 10.0f);
+  unsigned int first = moved.size() / 3, count = 1000;
+  for (int z = 0; z < 20; z++) {
+    for (int x = 0; x < 25; x++) {
+      vec3 p = corner + vec3((float)x, 0.0f, (float)z);
+      moved.push_back(p); moved.push_back(p + vec3(0.0f, 0.0f, 1.0f)); moved.push_back(p + vec3(1.0f, 0.0f, 0.0f));
+      moved.push_back(p + vec3(1.0f, 0.0f, 0.0f)); moved.push_back(p + vec3(0.0f, 0.0f, 1.0f)); moved.push_back(p + vec3(1.0f, 0.0f, 1.0f));
+    }
+  }
+  BVH bvh;
+  bvh.build(moved);
+  BVHRebuilder rebuilder;
+  rebuilder.reset(bvh, true);
+  printf("refit\n");
+
+  // the whole level rolls like a wave, the tree keeps its shape; the
+  // first edit also takes the rebuilder's copy of the triangles
+  for (unsigned int i = 0; i < moved.size(); i++)
+    moved[i][1] += sinf(moved[i][0] * 0.1f);
+  double start = now();
+  rebuilder.update(bvh, moved);
+  printf("  full:     %8.1f ms, sah cost %.2f -> %.2f\n",
+         (now() - start) * 1000.0, rebuilder.buildCost, rebuilder.cost);
+
+  // the platform lifted a unit at a time, the first partial refit also
+  // links up the parents, then far above the level: that grows the root,
+  // which every quantized box is relative to, and repacks the whole copy.
+  // the quantized copy follows the refits the way the world's does
+  QuantizedBVH quantized;
+  start = now();
+  quantized.build(bvh);
+  double packTime = now() - start;
+  const float lifts[] = { 1.0f, 1.0f, 1000.0f };
+  unsigned int missing = 0;
+  for (int step = 0; step < 3; step++) {
+    for (unsigned int i = first * 3; i < (first + count) * 3; i++)
+      moved[i][1] += lifts[step];
+    start = now();
+    rebuilder.update(bvh, moved, first, count);
+    double refitTime = now() - start;
+    start = now();
+    quantized.refit(bvh, first, count);
+    printf("  platform up %6.1f: %8.3f ms, quantized %8.3f ms (pack %.1f ms)\n", lifts[step],
+           refitTime * 1000.0, (now() - start) * 1000.0, packTime * 1000.0);
+    // every moved triangle and a sample of the rest must still be found
+    missing += missedTriangles(quantized, moved, first, count);
+  }
+  if (missing > 0) {
+    failures++;
+    printf("  ERROR: %u triangles missed by the refitted quantized tree\n", missing);
+  }
+
+  // triangles swapping places all over the level wreck the tree until the
+  // background rebuild replaces it; the platform stays in one piece
+  for (unsigned int i = 0; i < first; i += 7) {
+    unsigned int j = rand() % first;
+    for (int k = 0; k < 3; k++)
+      std::swap(moved[i*3+k], moved[j*3+k]);
+  }
+  start = now();
+  rebuilder.update(bvh, moved);
+  printf("  scrambled: sah cost %.2f, refit %.1f ms\n", rebuilder.cost,
+         (now() - start) * 1000.0);
+  if (rebuilder.cost <= rebuilder.buildCost * BVH_REBUILD_RATIO)
+    return;
+
+  // the platform keeps sinking a little each tick while the thread builds,
+  // from right after it started; no edit waits for it, and the swap-in
+  // only refits the platform into the new tree and its quantized copy
+  double longestEdit = 0.0, swapTime = 0.0;
+  unsigned int edits = 0;
+  start = now();
+  for (;;) {
+    for (unsigned int i = first * 3; i < (first + count) * 3; i++)
+      moved[i][1] -= 0.05f;
+    double editStart = now();
+    rebuilder.update(bvh, moved, first, count);
+    quantized.refit(bvh, first, count);
+    longestEdit = MAX(longestEdit, now() - editStart);
+    edits++;
+
+    double pollStart = now();
+    if (rebuilder.poll(bvh, moved, &quantized)) {
+      swapTime = now() - pollStart;
+      break;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  unsigned int missed = missedTriangles(bvh, moved, first, count) +
+                        missedTriangles(quantized, moved, first, count);
+  printf("  rebuilt in the background after %.1f ms, sah cost %.2f\n",
+         (now() - start) * 1000.0, rebuilder.buildCost);
+  printf("  %u edits meanwhile, longest %.3f ms; swap-in %.3f ms%s\n", edits,
+         longestEdit * 1000.0, swapTime * 1000.0,
+         failIf(missed, " (ERROR: rebuilt trees miss triangles)"));
+}
+
+static void benchSweeps(const Broadphase& broadphase, const vector<Sweep>& sweeps,
+                        const vec3& radius)
+{
+  vector<unsigned int> candidates;
+  unsigned long long candidateCount = 0;
+  double start = now();
+  for (unsigned int i = 0; i < sweeps.size(); i++) {
+    candidates.clear();
+    broadphase.querySweep(sweeps[i].position, sweeps[i].position + sweeps[i].velocity,
+                          radius, candidates);
+    candidateCount += candidates.size();
+  }
+  double queryTime = now() - start;
+
+  // the same through spans into a fixed buffer, no allocation at all
+  TriangleSpan spans[256];
+  unsigned long long spanCount = 0, spanTriangles = 0;
+  start = now();
+  for (unsigned int i = 0; i < sweeps.size(); i++) {
+    unsigned int n = broadphase.querySpans(sweeps[i].position,
+                                           sweeps[i].position + sweeps[i].velocity,
+                                           radius, spans, 256);
+    spanCount += n;
+    for (unsigned int j = 0; j < n && j < 256; j++)
+      spanTriangles += spans[j].count;
+  }
+  double spanTime = now() - start;
+
+  printf("  query:  %8.3f us/sweep, %.1f candidates/sweep\n",
+         queryTime * 1e6 / sweeps.size(), (double)candidateCount / sweeps.size());
+  printf("  spans:  %8.3f us/sweep, %.1f spans, %.1f triangles/sweep\n",
+         spanTime * 1e6 / sweeps.size(), (double)spanCount / sweeps.size(),
+         (double)spanTriangles / sweeps.size());
+}
+
+// Hardware cache event counted around a block of code, -1 where perf
+// events aren't available (other systems, containers, paranoid kernels).
+struct CacheCounter {
+  int fd;
+
+  CacheCounter(unsigned long long config)
+  {
+    fd = -1;
+#ifdef __linux__
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+  }
+
+  ~CacheCounter()
+  {
+#ifdef __linux__
+    if (fd >= 0)
+      close(fd);
+#endif
+  }
+
+  void start()
+  {
+#ifdef __linux__
+    if (fd >= 0) {
+      ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+      ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+  }
+
+  long long stop()
+  {
+    long long count = -1;
+#ifdef __linux__
+    if (fd >= 0) {
+      ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+      if (read(fd, &count, sizeof(count)) != sizeof(count))
+        count = -1;
+    }
+#endif
+    return count;
+  }
+};
+
+// There's no generic L2 miss event; last level cache references are the
+// requests that missed L2 on most x86 parts, so they stand in for it.
+static void benchLayout(const char *name, const Broadphase& broadphase,
+                        const vector<Sweep>& sweeps, const vec3& radius, bool segment)
+{
+#ifdef __linux__
+  CacheCounter l2Misses(PERF_COUNT_HW_CACHE_REFERENCES);
+  CacheCounter llcMisses(PERF_COUNT_HW_CACHE_MISSES);
+#else
+  CacheCounter l2Misses(0), llcMisses(0);
+#endif
+
+  vector<unsigned int> candidates;
+  unsigned long long candidateCount = 0;
+  l2Misses.start();
+  llcMisses.start();
+  double start = now();
+  for (unsigned int i = 0; i < sweeps.size(); i++) {
+    candidates.clear();
+    const Sweep& sweep = sweeps[i];
+    if (segment)
+      broadphase.querySweep(sweep.position, sweep.position + sweep.velocity, radius, candidates);
+    else
+      broadphase.query(sweepBounds(sweep, radius), candidates);
+    candidateCount += candidates.size();
+  }
+  double queryTime = now() - start;
+  long long l2 = l2Misses.stop();
+  long long llc = llcMisses.stop();
+
+  printf("  %-16s %8.3f us/sweep, %5.1f candidates/sweep", name,
+         queryTime * 1e6 / sweeps.size(), (double)candidateCount / sweeps.size());
+  if (l2 >= 0 && llc >= 0)
+    printf(", %6.1f l2 misses/sweep, %6.1f llc misses/sweep",
+           (double)l2 / sweeps.size(), (double)llc / sweeps.size());
+  else
+    printf(", cache counters unavailable");
+  printf("\n");
+}
+
+static void benchQuantized(const BVH& bvh, const vector<Sweep>& sweeps, const vec3& radius)
+{
+  QuantizedBVH quantized;
+  double start = now();
+  quantized.build(bvh);
+  double packTime = now() - start;
+
+  size_t bvhBytes = bvh.nodeCount * sizeof(BVHNode) + bvh.indexCount * sizeof(unsigned int);
+  printf("quantized bvh\n");
+  printf("  pack: %8.1f ms, %u nodes, %.1f MB (binary %.1f MB)\n", packTime * 1000.0,
+         (unsigned int)quantized.nodes.size(), quantized.memoryUsage() / 1048576.0,
+         bvhBytes / 1048576.0);
+
+  // quantized boxes only ever grow, so they must find everything the
+  // binary tree finds
+  vector<unsigned int> exact, packed;
+  unsigned int missing = 0;
+  for (unsigned int i = 0; i < sweeps.size() && i < 10000; i++) {
+    AABB box = sweepBounds(sweeps[i], radius);
+    exact.clear();
+    packed.clear();
+    bvh.query(box, exact);
+    quantized.query(box, packed);
+    std::sort(packed.begin(), packed.end());
+    for (unsigned int j = 0; j < exact.size(); j++)
+      missing += !std::binary_search(packed.begin(), packed.end(), exact[j]);
+  }
+  if (missing > 0) {
+    failures++;
+    printf("  ERROR: %u triangles missed by the quantized tree\n", missing);
+  }
+
+  benchLayout("binary, box:", bvh, sweeps, radius, false);
+  benchLayout("quantized, box:", quantized, sweeps, radius, false);
+  benchLayout("quantized, sweep:", quantized, sweeps, radius, true);
+  printf(" binary\n");
+  benchSweeps(bvh, sweeps, radius);
+  printf(" quantized\n");
+  benchSweeps(quantized, sweeps, radius);
+}
+
+// The same sweeps through a world on some broadphase, gathered the way
+// CharacterEntity does: only the triangles of the spans near the sweep,
+// each once, get to the narrowphase.
+static void benchGather(const CollisionWorld& world, const vector<Sweep>& sweeps,
+                        const vec3& radius)
+{
+  vector<TriangleSpan> spans(256);
+  vector<vec3> vertices;
+  vector<unsigned int> features, indices;
+  TriangleStore store;
+  unsigned long long gathered = 0;
+  double start = now();
+  for (unsigned int i = 0; i < sweeps.size(); i++) {
+    AABB box = sweepBounds(sweeps[i], radius);
+    unsigned int spanCount = world.querySpans(box, &spans[0], spans.size());
+    if (spanCount > spans.size()) {
+      spans.resize(spanCount);
+      world.querySpans(box, &spans[0], spans.size());
+    }
+    store.clear();
+    world.gatherSpans(&spans[0], spanCount, box, radius, store, vertices, features, indices);
+    gathered += store.size();
+  }
+  double gatherTime = now() - start;
+
+  printf("  gather: %8.3f us/sweep, %.1f triangles/sweep\n",
+         gatherTime * 1e6 / sweeps.size(), (double)gathered / sweeps.size());
+}
+
+static void benchOctree(const vector<vec3>& triangles, const AABB& bounds,
+                        const vector<Sweep>& sweeps, const vec3& radius)
+{
+  unsigned int triangleCount = triangles.size() / 3;
+  LooseOctree octree;
+
+  double start = now();
+  octree.clear(bounds);
+  for (unsigned int i = 0; i < triangleCount; i++)
+    octree.insert(triangles, i);
+  double insertTime = now() - start;
+
+  // churn a tenth of the level, as an editor moving props around would
+  unsigned int churn = triangleCount / 10;
+  start = now();
+  for (unsigned int i = 0; i < churn; i++)
+    octree.remove(i);
+  for (unsigned int i = 0; i < churn; i++)
+    octree.insert(triangles, i);
+  double churnTime = now() - start;
+
+  printf("loose octree\n");
+  printf("  insert: %8.1f ms, %u nodes\n", insertTime * 1000.0,
+         (unsigned int)octree.nodes.size());
+  printf("  remove+insert %u triangles: %8.1f ms\n", churn, churnTime * 1000.0);
+  benchSweeps(octree, sweeps, radius);
+
+  // the octree sizes itself to the triangles when the world switches to it
+  CollisionWorld world(BROADPHASE_GRID);
+  world.addTriangles(triangles);
+  world.setBroadphase(BROADPHASE_OCTREE);
+  benchGather(world, sweeps, radius);
+}
+
+static void benchGrid(const vector<vec3>& triangles, const vector<Sweep>& sweeps,
+                      const vec3& radius)
+{
+  unsigned int triangleCount = triangles.size() / 3;
+  float cellSizes[] = { 1.0f, 2.0f, 4.0f };
+
+  for (int c = 0; c < 3; c++) {
+    UniformGrid grid(cellSizes[c]);
+
+    double start = now();
+    for (unsigned int i = 0; i < triangleCount; i++)
+      grid.insert(triangles, i);
+    double insertTime = now() - start;
+
+    printf("uniform grid (cell size %.1f)\n", cellSizes[c]);
+    printf("  insert: %8.1f ms\n", insertTime * 1000.0);
+    benchSweeps(grid, sweeps, radius);
+
+    CollisionWorld world(BROADPHASE_GRID);
+    world.setGridCellSize(cellSizes[c]);
+    world.addTriangles(triangles);
+    benchGather(world, sweeps, radius);
+  }
+}
+
+// The scripted run below draws from this rather than rand(), which
+// differs between C libraries. 24 bits in [0, 1), exact in a float.
+static unsigned int scriptState;
+
+static float scriptFloat()
+{
+  scriptState = scriptState * 1664525u + 1013904223u;
+  return (scriptState >> 8) * (1.0f / 16777216.0f);
+}
+
+// FNV-1a over the bits of the floats
+static unsigned long long hashFloats(unsigned long long hash, const float *values,
+                                     unsigned int count)
+{
+  for (unsigned int i = 0; i < count; i++) {
+    unsigned int bits;
+    memcpy(&bits, &values[i], sizeof(bits));
+    for (int b = 0; b < 4; b++) {
+      hash ^= (bits >> (8 * b)) & 0xff;
+      hash *= 1099511628211ull;
+    }
+  }
+  return hash;
+}
+
+// bumpy ground size units square with posts in it, drawn from the script
+static vector<vec3> makeScriptLevel(unsigned int size)
+{
+  vector<float> heights((size + 1) * (size + 1));
+  for (unsigned int i = 0; i < heights.size(); i++)
+    heights[i] = scriptFloat() < 0.03f ? 3.0f : 0.4f * scriptFloat();
+  vector<vec3> triangles;
+  for (unsigned int z = 0; z < size; z++) {
+    for (unsigned int x = 0; x < size; x++) {
+      vec3 p[4];
+      for (int i = 0; i < 4; i++) {
+        unsigned int px = x + (i & 1), pz = z + (i >> 1);
+        p[i] = vec3((float)px, heights[pz * (size + 1) + px], (float)pz);
+      }
+      triangles.push_back(p[0]); triangles.push_back(p[2]); triangles.push_back(p[1]);
+      triangles.push_back(p[1]); triangles.push_back(p[2]); triangles.push_back(p[3]);
+    }
+  }
+  return triangles;
+}
+
+// what a scripted run cost
+struct ScriptStats {
+  double updateTime;
+  unsigned long long iterations;
+  unsigned int maxIterations;
+};
+
+// A crowd of every shape wandering over bumpy ground with posts in it for
+// ticks steps, the way main moves its character, and the hash of where
+// they all are after each step. The level and script use nothing but
+// exactly rounded arithmetic, so a build that computes anything
+// differently hashes differently. The level grows with the crowd, 48
+// units square for 64 characters, and the group moves them across the
+// workers of pool if there is one.
+static unsigned long long runScript(unsigned int characterCount, unsigned int ticks,
+                                    const SlideBudget& budget, ScriptStats *stats,
+                                    WorkerPool *pool = NULL)
+{
+  scriptState = 12345u;
+
+  unsigned int size = MAX((unsigned int)sqrtf((float)characterCount) * 6, 48u);
+  float spread = (float)(size - 8);
+  CollisionWorld world;
+  world.addTriangles(makeScriptLevel(size));
+
+  vec3 radii[] = { vec3(0.5f, 1.0f, 0.5f), vec3(0.5f), vec3(0.4f, 0.6f, 0.4f),
+                   vec3(0.4f, 0.8f, 0.3f) };
+  CharacterShape shapes[] = { SHAPE_ELLIPSOID, SHAPE_ELLIPSOID, SHAPE_CAPSULE, SHAPE_BOX };
+  vector<CharacterEntity*> characters(characterCount);
+  vector<vec3> walks(characterCount);
+  CharacterGroup group;
+  for (unsigned int i = 0; i < characterCount; i++) {
+    characters[i] = new CharacterEntity(&world, radii[i % 4], shapes[i % 4]);
+    characters[i]->budget = budget;
+    // boxes turned by a 3-4-5 triangle, no sine needed
+    characters[i]->orientation[0] = vec3(0.6f, 0.0f, -0.8f);
+    characters[i]->orientation[2] = vec3(0.8f, 0.0f, 0.6f);
+    group.add(characters[i]);
+  }
+
+  unsigned long long hash = 14695981039346656037ull;
+  stats->updateTime = 0.0;
+  stats->iterations = 0;
+  stats->maxIterations = 0;
+  for (unsigned int tick = 0; tick < ticks; tick++) {
+    for (unsigned int i = 0; i < characterCount; i++) {
+      CharacterEntity *character = characters[i];
+      // dropped in again after falling off the edge
+      if (tick == 0 || character->position[1] < -10.0f) {
+        character->teleport(vec3(4.0f + spread * scriptFloat(), 4.0f + 2.0f * scriptFloat(),
+                                 4.0f + spread * scriptFloat()));
+        character->velocity = vec3(0.0f);
+      }
+      if (tick % 60 == i % 60)
+        walks[i] = vec3(scriptFloat() - 0.5f, 0.0f, scriptFloat() - 0.5f) * 0.3f;
+      float fall = character->grounded ? 0.0f : character->velocity[1] - 0.01f;
+      character->velocity = vec3(walks[i][0], fall, walks[i][2]);
+    }
+
+    double start = now();
+    group.update(pool);
+    stats->updateTime += now() - start;
+
+    for (unsigned int i = 0; i < characterCount; i++) {
+      stats->iterations += characters[i]->iterations;
+      stats->maxIterations = MAX(stats->maxIterations, characters[i]->iterations);
+      float state[4] = { characters[i]->position[0], characters[i]->position[1],
+                         characters[i]->position[2], (float)characters[i]->grounded };
+      hash = hashFloats(hash, state, 4);
+    }
+  }
+
+  for (unsigned int i = 0; i < characterCount; i++)
+    delete characters[i];
+  return hash;
+}
+
+// The script at every kernel level the CPU has, which must all agree.
+// `make determinism` compares the hash lines of builds at different
+// optimisation levels.
+static void benchDeterminism()
+{
+  unsigned int characterCount = 64, ticks = 2000;
+  CollisionISA cpu = collisionKernels().isa;
+  printf("determinism (%u characters, %u ticks)\n", characterCount, ticks);
+
+  unsigned long long first = 0;
+  ScriptStats stats;
+  for (int isa = COLLISION_GENERIC; isa <= cpu; isa++) {
+    if (!setCollisionISA((CollisionISA)isa))
+      continue;
+    unsigned long long hash = runScript(characterCount, ticks, SlideBudget(), &stats);
+    if (isa == COLLISION_GENERIC)
+      first = hash;
+    printf("  hash %016llx %s%s\n", hash, collisionISAName((CollisionISA)isa),
+           failIf(hash != first, " (ERROR: differs from generic)"));
+  }
+  setCollisionISA(cpu);
+
+  printf("  update: %8.3f us/character (%s)\n", stats.updateTime * 1e6 / (characterCount * ticks),
+#ifdef COLLISION_DETERMINISTIC
+         "deterministic"
+#else
+         "default"
+#endif
+         );
+}
+
+// The script again under tighter budgets: what each costs and how many
+// sweeps an update then takes.
+static void benchBudget()
+{
+  unsigned int characterCount = 64, ticks = 2000;
+  SlideBudget budgets[] = { SlideBudget(), SlideBudget(4), SlideBudget(2),
+                            SlideBudget(6, 0.001f), SlideBudget(6, 0.01f) };
+
+  printf("slide budget (%u characters, %u ticks)\n", characterCount, ticks);
+  for (int b = 0; b < 5; b++) {
+    ScriptStats stats;
+    runScript(characterCount, ticks, budgets[b], &stats);
+    printf("  %u iterations, %5.3f min distance: %7.3f us/character, %5.2f sweeps/update, "
+           "%u at most\n", budgets[b].iterations, budgets[b].minDistance,
+           stats.updateTime * 1e6 / (characterCount * ticks),
+           (double)stats.iterations / (characterCount * ticks), stats.maxIterations);
+  }
+}
+
+// A crowd of thousands moved by pools of 1 to 64 workers. Every pool must
+// end up where moving them one by one does.
+static void benchParallel()
+{
+  unsigned int characterCount = 4096, ticks = 100;
+  unsigned int cores = MAX(std::thread::hardware_concurrency(), 1u);
+  printf("parallel update (%u characters, %u ticks, %u cores)\n", characterCount, ticks, cores);
+
+  ScriptStats stats;
+  unsigned long long serial = runScript(characterCount, ticks, SlideBudget(), &stats);
+  double serialTime = stats.updateTime;
+  printf("  one by one: %8.3f ms/tick\n", serialTime * 1000.0 / ticks);
+
+  for (unsigned int threads = 1; threads <= 64; threads *= 2) {
+    WorkerPool pool(threads);
+    unsigned long long hash = runScript(characterCount, ticks, SlideBudget(), &stats, &pool);
+    printf("  %2u workers: %8.3f ms/tick, %5.2fx, %4u stolen in the last tick%s\n", threads,
+           stats.updateTime * 1000.0 / ticks, serialTime / stats.updateTime, pool.steals,
+           failIf(hash != serial, " (ERROR: differs from one by one)"));
+  }
+}
+
+// Ten seconds of frames at a few rates through a fixed timestep: the
+// ticks a frame runs, none of them wasted on frames faster than the tick
+// rate, and a half second hitch that is caught up on only in part.
+static void benchTimestep()
+{
+  const char *names[] = { "144 fps", "60 fps, jittery", "30 fps", "60 fps, 0.5 s hitch" };
+  printf("fixed timestep (%.0f ticks/s, at most %u a frame)\n", TICK_RATE, MAX_TICKS_PER_FRAME);
+  for (int run = 0; run < 4; run++) {
+    FixedTimestep timestep;
+    double frameTime = run == 0 ? 1.0 / 144.0 : run == 2 ? 1.0 / 30.0 : 1.0 / 60.0;
+    unsigned int frames = 0, ticks = 0, idle = 0, most = 0;
+    for (double time = 0.0; time < 10.0; frames++) {
+      double frame = frameTime;
+      if (run == 1)
+        frame *= 0.5 + randomFloat();
+      if (run == 3 && frames == 300)
+        frame = 0.5;
+      time += frame;
+      unsigned int due = timestep.advance(frame);
+      ticks += due;
+      idle += due == 0;
+      most = MAX(most, due);
+    }
+    printf("  %-20s %5u frames, %4u ticks, %4u frames without one, %u at most, %llu dropped\n",
+           names[run], frames, ticks, idle, most, timestep.dropped);
+  }
+}
+
+// A value of a triple buffer, every field the same so a torn one shows.
+struct BufferedValue {
+  unsigned long long fields[16];
+};
+
+// One thread publishing as fast as it can while another reads: the reader
+// must only ever see whole values, never older than one it saw before.
+static void benchTripleBuffer()
+{
+  TripleBuffer<BufferedValue> buffer;
+  unsigned long long count = 2000000;
+  std::atomic<bool> finished(false);
+
+  double start = now();
+  std::thread writer([&] {
+    for (unsigned long long i = 1; i <= count; i++) {
+      BufferedValue& value = buffer.write();
+      for (int f = 0; f < 16; f++)
+        value.fields[f] = i;
+      buffer.publish();
+    }
+    finished = true;
+  });
+
+  unsigned long long reads = 0, seen = 0, last = 0, errors = 0;
+  for (bool done = false; !done; ) {
+    done = finished;
+    const BufferedValue& value = buffer.read();
+    for (int f = 1; f < 16; f++)
+      errors += value.fields[f] != value.fields[0];
+    errors += value.fields[0] < last;
+    seen += value.fields[0] != last;
+    last = value.fields[0];
+    reads++;
+  }
+  writer.join();
+  double time = now() - start;
+
+  printf("triple buffer\n");
+  printf("  %10.0f publishes/s, %llu reads saw %llu values, the last %s%s\n", count / time,
+         reads, seen, last == count ? "included" : "missing",
+         failIf(errors || last != count, " (ERROR: torn or out of order)"));
+}
+
+// The render thread spending renderTime on each frame while the crowd
+// ticks at 60 Hz, first both on the one thread as main used to, then with
+// the simulation on its own thread.
+// p on the way from a to b, give or take rounding
+static bool between(const vec3& p, const vec3& a, const vec3& b)
+{
+  vec3 slack = vec3(1e-4f) + abs(a) * 1e-6f;
+  return AABB(min(a, b) - slack, max(a, b) + slack).overlaps(AABB(p, p));
+}
+
+static void benchSimulation()
+{
+  unsigned int characterCount = 1024;
+  double renderTime = 0.008, duration = 2.0;
+  unsigned int cores = MAX(std::thread::hardware_concurrency(), 1u);
+  printf("simulation thread (%u characters, %.0f ms to render a frame, %u cores)\n",
+         characterCount, renderTime * 1000.0, cores);
+
+  for (int threaded = 0; threaded < 2; threaded++) {
+    scriptState = 12345u;
+    unsigned int size = (unsigned int)sqrtf((float)characterCount) * 6;
+    CollisionWorld world;
+    world.addTriangles(makeScriptLevel(size));
+    vector<CharacterEntity*> characters(characterCount);
+    CharacterGroup group;
+    for (unsigned int i = 0; i < characterCount; i++) {
+      characters[i] = new CharacterEntity(&world, vec3(0.5f, 1.0f, 0.5f));
+      characters[i]->teleport(vec3(4.0f + (size - 8) * scriptFloat(), 1.5f,
+                                   4.0f + (size - 8) * scriptFloat()));
+      characters[i]->velocity = vec3(scriptFloat() - 0.5f, 0.0f, scriptFloat() - 0.5f) * 0.05f;
+      group.add(characters[i]);
+    }
+
+    // how far behind the clock what a frame draws is once it is shown,
+    // and how many characters it drew outside where the last two ticks
+    // left them, kept here as the ticks ran or snapshots came in
+    unsigned int frames = 0, strays = 0;
+    unsigned long long ticks = 0;
+    double behind = 0.0;
+    vector<vec3> older(characterCount), newer(characterCount);
+    for (unsigned int i = 0; i < characterCount; i++)
+      older[i] = newer[i] = characters[i]->position;
+    double start = now(), last = start;
+    if (!threaded) {
+      FixedTimestep timestep;
+      for (double t = start; t - start < duration; t = now()) {
+        unsigned int due = timestep.advance(t - last);
+        last = t;
+        for (unsigned int i = 0; i < due; i++) {
+          group.update();
+          characters[0]->velocity = characters[0]->velocity * 0.7f;
+          older.swap(newer);
+          for (unsigned int j = 0; j < characterCount; j++)
+            newer[j] = characters[j]->position;
+        }
+        ticks += due;
+        float alpha = timestep.alpha();
+        for (unsigned int i = 0; i < characterCount; i++)
+          strays += !between(characters[i]->interpolatedPosition(alpha), older[i], newer[i]);
+        for (double end = now() + renderTime; now() < end; )
+          ;
+        // the last tick less alpha of one, as of when it was due
+        behind += now() - (t - timestep.tickLength);
+        frames++;
+      }
+    } else {
+      SimulationThread simulation(&world, &group, characters[0]);
+      simulation.start();
+      unsigned long long seen = 0;
+      for (double t = start; t - start < duration; t = now()) {
+        const SimulationSnapshot& snapshot = simulation.latest();
+        // drawn between the last two ticks, as of a tick before the clock
+        double clock = simulation.clock();
+        double past = MIN(MAX(clock - snapshot.time, 0.0), snapshot.tickLength);
+        behind += clock + renderTime - (snapshot.time + past - snapshot.tickLength);
+        // a snapshot one tick on starts where the last one ended
+        if (snapshot.tick != seen) {
+          for (unsigned int i = 0; i < characterCount; i++) {
+            older[i] = snapshot.tick == seen + 1 ? newer[i] : snapshot.previousPositions[i];
+            newer[i] = snapshot.positions[i];
+          }
+          seen = snapshot.tick;
+        }
+        for (unsigned int i = 0; i < characterCount; i++)
+          strays += !between(snapshot.interpolated(i, clock), older[i], newer[i]);
+        ticks = snapshot.tick;
+        for (double end = now() + renderTime; now() < end; )
+          ;
+        frames++;
+      }
+      simulation.stop();
+    }
+
+    printf("  %-14s %6.1f frames/s, %6.1f ticks/s, drawn %5.1f ms behind%s\n", threaded ?
+           "own thread:" : "one thread:", frames / duration, ticks / duration,
+           behind / frames * 1000.0,
+           failIf(strays > 0, " (ERROR: drawn outside the last two ticks)"));
+    for (unsigned int i = 0; i < characterCount; i++)
+      delete characters[i];
+  }
+}
+
+// A crowd where four in five stand still, with and without sleeping.
+// Then a thousand edits far away in one tick, which must leave sleepers
+// be, followed by the platform some of them stand on taken away and one
+// teleported into the air: every one of those must wake and fall.
+static void benchSleep()
+{
+  unsigned int characterCount = 4096, ticks = 300;
+  printf("sleeping (%u characters, 80%% idle, %u ticks)\n", characterCount, ticks);
+
+  for (int sleeping = 0; sleeping < 2; sleeping++) {
+    scriptState = 12345u;
+    unsigned int size = (unsigned int)sqrtf((float)characterCount) * 6;
+    float spread = (float)(size - 8);
+    CollisionWorld world;
+    world.addTriangles(makeScriptLevel(size));
+    // a platform over one corner
+    vec3 p[4] = { vec3(4.0f, 5.0f, 4.0f), vec3(16.0f, 5.0f, 4.0f), vec3(4.0f, 5.0f, 16.0f),
+                  vec3(16.0f, 5.0f, 16.0f) };
+    vector<vec3> platform;
+    platform.push_back(p[0]); platform.push_back(p[2]); platform.push_back(p[1]);
+    platform.push_back(p[1]); platform.push_back(p[2]); platform.push_back(p[3]);
+    unsigned int platformSet = world.addTriangles(platform);
+    vector<vec3> far(3, vec3(-1000.0f));
+    far[1][0] += 1.0f;
+    far[2][2] += 1.0f;
+    unsigned int farSet = world.addTriangles(far);
+
+    vector<CharacterEntity*> characters(characterCount);
+    vector<vec3> walks(characterCount);
+    CharacterGroup group;
+    for (unsigned int i = 0; i < characterCount; i++) {
+      characters[i] = new CharacterEntity(&world, vec3(0.5f, 1.0f, 0.5f));
+      characters[i]->canSleep = sleeping != 0;
+      vec3 position(4.0f + spread * scriptFloat(), 4.0f, 4.0f + spread * scriptFloat());
+      if (i < 16)
+        position = vec3(5.0f + (i % 4) * 3.0f, 6.5f, 5.0f + (i / 4) * 3.0f);
+      characters[i]->teleport(position);
+      if (i >= 16 && i % 5 == 4)
+        walks[i] = vec3(scriptFloat() - 0.5f, 0.0f, scriptFloat() - 0.5f) * 0.1f;
+      else
+        walks[i] = vec3(0.0f);
+      group.add(characters[i]);
+    }
+
+    double updateTime = 0.0;
+    unsigned long long sweeps = 0, asleep = 0;
+    unsigned int burstAsleep = 0, platformAsleep = 0, lifted = 0;
+    unsigned int idle = 0, idleAsleep = 0;
+    float liftedTo = 0.0f;
+    for (unsigned int tick = 0; tick < ticks + 60; tick++) {
+      if (tick == ticks - 1) {
+        for (unsigned int i = 0; i < 16; i++)
+          burstAsleep += characters[i]->asleep;
+        // once everyone has landed, how many of those standing still sleep
+        for (unsigned int i = 16; i < characterCount; i++) {
+          idle += walks[i] == vec3(0.0f);
+          idleAsleep += walks[i] == vec3(0.0f) && characters[i]->asleep;
+        }
+        for (unsigned int i = 0; i < 1000; i++) {
+          far[0][1] = -1000.0f + (float)(i % 2);
+          world.moveTriangles(farSet, far);
+        }
+      }
+      if (tick == ticks) {
+        for (unsigned int i = 0; i < 16; i++)
+          platformAsleep += characters[i]->asleep;
+        world.removeTriangles(platformSet);
+        // the first sleeper on the ground, put right back up
+        for (lifted = 16; lifted < characterCount - 1 && !characters[lifted]->asleep; lifted++)
+          ;
+        liftedTo = characters[lifted]->position[1] + 8.0f;
+        characters[lifted]->teleport(characters[lifted]->position + vec3(0.0f, 8.0f, 0.0f));
+      }
+      world.update();
+      for (unsigned int i = 0; i < characterCount; i++) {
+        CharacterEntity *character = characters[i];
+        float fall = character->grounded ? 0.0f : character->velocity[1] - 0.01f;
+        character->velocity = vec3(walks[i][0], fall, walks[i][2]);
+      }
+
+      double start = now();
+      group.update();
+      if (tick < ticks)
+        updateTime += now() - start;
+
+      for (unsigned int i = 0; tick < ticks && i < characterCount; i++) {
+        sweeps += characters[i]->iterations;
+        asleep += characters[i]->asleep;
+      }
+    }
+
+    // the platform's characters all started out standing on it
+    unsigned int stuck = 0;
+    for (unsigned int i = 0; i < 16; i++)
+      stuck += characters[i]->position[1] > 5.5f;
+    stuck += characters[lifted]->position[1] > liftedTo - 4.0f;
+    printf("  %-14s %8.3f ms/tick, %5.2f sweeps/update, %5.1f%% asleep (%5.1f%% of the idle "
+           "at the end), platform removed under %2u sleepers, %u of 17 left in the air%s\n",
+           sleeping ? "sleeping:" : "always awake:", updateTime * 1000.0 / ticks,
+           (double)sweeps / ((double)characterCount * ticks),
+           100.0 * asleep / ((double)characterCount * ticks), 100.0 * idleAsleep / idle,
+           platformAsleep, stuck,
+           stuck ? failIf(true, " (ERROR: still there after the world or teleport moved them)") :
+           failIf(platformAsleep < burstAsleep, " (ERROR: edits far away woke them)"));
+    for (unsigned int i = 0; i < characterCount; i++)
+      delete characters[i];
+  }
+
+  // side by side on flat ground: a neighbour that never sleeps but stands
+  // still lets one fall asleep, one walking into it wakes it
+  CollisionWorld world;
+  vec3 p[4] = { vec3(0.0f), vec3(40.0f, 0.0f, 0.0f), vec3(0.0f, 0.0f, 40.0f),
+                vec3(40.0f, 0.0f, 40.0f) };
+  vector<vec3> ground;
+  ground.push_back(p[0]); ground.push_back(p[2]); ground.push_back(p[1]);
+  ground.push_back(p[1]); ground.push_back(p[2]); ground.push_back(p[3]);
+  world.addTriangles(ground);
+  CharacterEntity sleeper(&world, vec3(0.5f, 1.0f, 0.5f));
+  CharacterEntity neighbour(&world, vec3(0.5f, 1.0f, 0.5f));
+  CharacterEntity walker(&world, vec3(0.5f, 1.0f, 0.5f));
+  neighbour.canSleep = false;
+  sleeper.teleport(vec3(20.0f, 1.5f, 20.0f));
+  neighbour.teleport(vec3(21.0f, 1.5f, 20.0f));
+  walker.teleport(vec3(16.0f, 1.5f, 20.0f));
+  CharacterGroup group;
+  group.add(&sleeper);
+  group.add(&neighbour);
+  group.add(&walker);
+  CharacterEntity *all[3] = { &sleeper, &neighbour, &walker };
+  bool slept = false, woken = false;
+  for (unsigned int tick = 0; tick < 200; tick++) {
+    for (int i = 0; i < 3; i++) {
+      float fall = all[i]->grounded ? 0.0f : all[i]->velocity[1] - 0.01f;
+      all[i]->velocity = vec3(0.0f, fall, 0.0f);
+    }
+    if (tick >= 100)
+      walker.velocity[0] = 0.05f;
+    group.update();
+    if (tick == 99)
+      slept = sleeper.asleep;
+    woken |= tick >= 100 && !sleeper.asleep;
+  }
+  printf("  next to a still neighbour: %s, walked into: %s%s\n",
+         slept ? "asleep" : "awake", woken ? "woken" : "asleep",
+         failIf(!slept || !woken, " (ERROR: woken by standing still or not by walking)"));
+}
+
+int main(int argc, char **argv)
+{
+  // just the scripted run, see benchDeterminism()
+  if (argc > 1 && strcmp(argv[1], "determinism") == 0) {
+    benchDeterminism();
+    return failures > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+  }
+
+  unsigned int triangleCount = argc > 1 ? atoi(argv[1]) : 1000000;
+  unsigned int sweepCount = argc > 2 ? atoi(argv[2]) : 100000;
+  vec3 radius = vec3(0.5f, 1.0f, 0.5f);
+
+  vector<vec3> triangles = makeLevel(triangleCount);
+
+  BVH bvh;
+  benchBuild(triangles, bvh);
+
+  vector<Sweep> sweeps = makeSweeps(bvh.nodes[0].bounds, sweepCount);
+  benchQueries(triangles, bvh, sweeps, radius);
+  benchNarrowphase(triangles, bvh, sweeps, radius);
+  benchKernels(triangles, bvh, sweeps, radius);
+  benchSphere(triangles, bvh, sweeps, 0.5f);
+  benchShapes(triangles, bvh, sweeps, radius);
+  benchAdjacency(triangles, bvh, sweeps, radius);
+  benchBatch(triangles, radius);
+  benchCache(triangles, bvh);
+  benchQuantized(bvh, sweeps, radius);
+  benchRefit(triangles);
+  benchSweepAndPrune(1000);
+  benchSweepAndPrune(10000);
+  benchOctree(triangles, bvh.nodes[0].bounds, sweeps, radius);
+  benchGrid(triangles, sweeps, radius);
+  benchDeterminism();
+  benchBudget();
+  benchParallel();
+  benchTimestep();
+  benchTripleBuffer();
+  benchSimulation();
+  benchSleep();
+
+  if (failures > 0)
+    printf("%u checks failed\n", failures);
+  return failures > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
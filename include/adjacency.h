@@ -0,0 +1,103 @@
+#ifndef ADJACENCY_H
+#define ADJACENCY_H
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "collision.h"
+
+// an edge or vertex no other triangle shares
+#define FEATURE_NONE 0xffffffffu
+
+// faces meeting at less than about a quarter degree count as flat; a
+// sphere crossing a convex edge that flat sinks in by less than 3e-6 of
+// its radius, well within veryCloseDistance
+#define FEATURE_FLAT_COSINE 0.99999f
+
+// How one triangle connects to its neighbours. Vertex k is corner k and
+// edge k runs from corner k to corner k + 1, as in TriangleStore.
+struct TriangleFeatures {
+  // ids shared by every triangle touching the vertex or edge
+  unsigned int vertices[3];
+  unsigned int edges[3];
+  // bit k for edge k, bit 3 + k for vertex k: those this triangle tests
+  // where it faces the sweep and those that are internal
+  unsigned int owned;
+  unsigned int internal;
+  // edges with one neighbour across them, wound against it, neither of
+  // them degenerate
+  unsigned int paired;
+  // bit 3 + k where vertex k is left to the neighbour across edge k if
+  // that faces the sweep
+  unsigned int fan;
+};
+
+// Vertex and edge adjacency of a triangle soup, worked out at load time.
+// Vertices at the same position are welded and the edges between welded
+// vertices paired, so neighbours share ids.
+//
+// A shared edge or vertex is tested once where the triangles touching it
+// can tell which of them faces the sweep, and by every one that faces it
+// otherwise, so the same hits are found as if every triangle tested all
+// of its own. A paired edge is owned by its first triangle: a sweep that
+// may touch the edge overlaps the owner's bounds, so the owner is a
+// candidate whenever its neighbour is, and where the owner faces away it
+// tests the edge for the neighbour if that faces the sweep. The corners
+// at a vertex chain up across paired edges, each to the neighbour across
+// the edge leaving the vertex, and a corner leaves the vertex to that
+// neighbour if it faces the sweep; the first corner of a chain, and one
+// of a chain closing on itself, always tests it. Whether a neighbour faces
+// the sweep comes from its normal, stored with the triangle, see
+// TriangleStore::neighbours.
+//
+// An edge whose two faces are flat or fold concave is internal: a sweep
+// touches one of the faces no later than the edge, so the edge only
+// matters where rounding lets a hit slip between the faces. For a sphere
+// already sunk into the faces, as rounding leaves a sliding character, its
+// hits are the ghost hits that make characters bump along tessellated
+// floors, so only a sweep reaching the faces from outside tests it. A
+// vertex with nothing but internal edges is internal too. Edges on a
+// border, shared by three or more faces or between faces wound against
+// each other are never internal. Affine transforms keep all of this, so it
+// holds for every instance and in every e-space.
+class MeshAdjacency {
+public:
+  MeshAdjacency();
+
+  // links the first count triangles, three vertices each
+  void build(const std::vector<vec3>& triangles, unsigned int count);
+  // to count triangles, those added have no neighbours
+  void resize(unsigned int count);
+  // works out again which edges and vertices are internal after the
+  // listed triangles moved, as a skinned pose moves them. Welding and
+  // ownership stay as build() found them.
+  void refold(const std::vector<vec3>& triangles, const std::vector<unsigned int>& moved);
+  // The e-space normals of the triangles across triangle t's edges that
+  // features needs, from the triangles as given, worked out as
+  // TriangleStore::add() works out their own. features drops what is
+  // left to a neighbour that turns out degenerate.
+  void neighbourNormals(const std::vector<vec3>& triangles, unsigned int t,
+                        const vec3& radius, unsigned int& features, vec3 normals[3]) const;
+
+  std::vector<TriangleFeatures> triangles;
+  // storeFeatures() of each, to copy into stores as they are filled
+  std::vector<unsigned int> features;
+  // the corner on the other side of each corner's edge, FEATURE_NONE
+  // unless exactly two corners share it
+  std::vector<unsigned int> twins;
+  unsigned int vertexCount;
+  unsigned int edgeCount;
+};
+
+// The bits of TriangleStore::features for a triangle.
+unsigned int storeFeatures(const TriangleFeatures& features);
+// The same bits for the triangle with corners 1 and 2 swapped, as a
+// mirrored instance has them. The neighbours across edges 0 and 2 swap.
+unsigned int mirrorFeatures(unsigned int features);
+// Whether store features need the normal of the neighbour across edge k,
+// and the features with nothing left to that neighbour.
+bool needsNeighbour(unsigned int features, int k);
+unsigned int withoutNeighbour(unsigned int features, int k);
+
+#endif // ADJACENCY_H
@@ -0,0 +1,60 @@
+#ifndef BROADPHASE_H
+#define BROADPHASE_H
+
+#include <vector>
+
+#include "collision.h"
+
+// instance of a span over the world's own triangles
+#define SPAN_WORLD 0xffffffffu
+
+// A run of consecutive candidate triangle indices inside a broadphase's
+// own storage, valid until the broadphase changes. The indices refer to
+// the mesh of an instance, or the world's triangles for SPAN_WORLD.
+struct TriangleSpan {
+  const unsigned int *indices;
+  unsigned int count;
+  unsigned int instance;
+};
+
+// Common interface of the structures that find the world triangles near a
+// collision sweep, so a world can pick whichever suits its geometry.
+class Broadphase {
+public:
+  virtual ~Broadphase() {}
+
+  // appends the index of every triangle that may overlap box
+  virtual void query(const AABB& box, std::vector<unsigned int>& result) const = 0;
+
+  // appends every triangle that may touch an ellipsoid of the given radius
+  // moving from start to end, all in R3. Defaults to the sweep's bounds.
+  virtual void querySweep(const vec3& start, const vec3& end, const vec3& radius,
+                          std::vector<unsigned int>& result) const
+  {
+    query(AABB(min(start, end) - radius, max(start, end) + radius), result);
+  }
+
+  // Same candidates as querySweep, written as spans into the caller's
+  // buffer without allocating. Returns the number of spans found, of which
+  // only the first capacity are written. Spans are not filtered per
+  // triangle and may repeat a triangle.
+  virtual unsigned int querySpans(const vec3& start, const vec3& end, const vec3& radius,
+                                  TriangleSpan *spans, unsigned int capacity) const = 0;
+};
+
+// appends a span to a caller's buffer, counting it even if it's full
+inline void addSpan(TriangleSpan *spans, unsigned int capacity, unsigned int& spanCount,
+                    const unsigned int *indices, unsigned int count,
+                    unsigned int instance = SPAN_WORLD)
+{
+  if (count == 0)
+    return;
+  if (spanCount < capacity) {
+    spans[spanCount].indices = indices;
+    spans[spanCount].count = count;
+    spans[spanCount].instance = instance;
+  }
+  spanCount++;
+}
+
+#endif // BROADPHASE_H
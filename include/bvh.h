@@ -0,0 +1,250 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "broadphase.h"
+#include "collision.h"
+
+// maximum number of triangles stored in a single leaf
+#define BVH_LEAF_SIZE 4
+// number of bins the surface area heuristic is evaluated on per axis
+#define BVH_BIN_COUNT 16
+// traversal stack size, the builder keeps the tree shallower than this
+#define BVH_MAX_DEPTH 64
+// surface area heuristic costs of stepping through a node and of testing
+// one triangle, a leaf's triangles are tested together so they come cheap
+#define BVH_TRAVERSAL_COST 1.0f
+#define BVH_TRIANGLE_COST 0.5f
+
+// Interior nodes keep their two children next to each other starting at
+// 'left', leaves reference 'count' entries of BVH::indices starting at 'left'.
+struct BVHNode {
+  AABB bounds;
+  unsigned int left;
+  unsigned int count;
+};
+
+// Tree quality, reported after a build. The SAH cost is relative to the
+// root's surface area, with the builder's traversal and triangle costs.
+struct BVHStats {
+  float sahCost;
+  unsigned int nodeCount;
+  unsigned int leafCount;
+  unsigned int maxDepth;
+  unsigned int maxLeafSize;
+  float averageLeafSize;
+};
+
+// bumped whenever the layout of a cached BVH or the tree built changes
+#define BVH_CACHE_VERSION 2
+
+// Bounding volume hierarchy over a static triangle soup, built once at
+// load time and queried with the bounds of a collision sweep.
+class BVH : public Broadphase {
+public:
+  BVH();
+  ~BVH();
+
+  // nodes and indices point either at the BVH's own storage or straight
+  // into a mapped cache file
+  const BVHNode *nodes;
+  const unsigned int *indices;
+  unsigned int nodeCount;
+  unsigned int indexCount;
+
+  void clear();
+
+  // triangles holds three world space vertices per triangle. A threadCount
+  // of 0 uses every available core.
+  void build(const std::vector<vec3>& triangles, unsigned int threadCount = 0);
+  // builds over the listed triangles only
+  void build(const std::vector<vec3>& triangles,
+             const std::vector<unsigned int>& triangleIndices,
+             unsigned int threadCount = 0);
+  // builds over arbitrary primitives given by their bounds, e.g. instances
+  void build(const std::vector<AABB>& bounds,
+             const std::vector<unsigned int>& primitives,
+             unsigned int threadCount = 0);
+
+  // updates the nodes above one primitive after its bounds changed,
+  // in O(depth) rather than a rebuild
+  void refit(const std::vector<AABB>& bounds, unsigned int primitive);
+  // updates every node bottom up after the triangles moved, keeping the
+  // topology of the tree
+  void refit(const std::vector<vec3>& triangles);
+  // same for a few moved triangles, only walking the paths above them
+  void refit(const std::vector<vec3>& triangles, unsigned int first, unsigned int count);
+
+  void swap(BVH& other);
+
+  // appends the index of every triangle whose bounds overlap box
+  void query(const AABB& box, std::vector<unsigned int>& result) const;
+
+  unsigned int querySpans(const vec3& start, const vec3& end, const vec3& radius,
+                          TriangleSpan *spans, unsigned int capacity) const;
+
+  // calls visitor(primitive) for every primitive in a leaf overlapping box
+  template <class Visitor>
+  void visit(const AABB& box, Visitor& visitor) const;
+  // calls visitor(first, count) with the indices of every leaf overlapping box
+  template <class Visitor>
+  void visitLeaves(const AABB& box, Visitor& visitor) const;
+
+  BVHStats stats() const;
+  // stats().sahCost, but kept up to date through partial refits instead
+  // of walking the whole tree
+  float sahCost();
+
+  // Writes the tree to path, tagged with key. load() maps a file written
+  // with the same key and uses it in place, returning false if there is
+  // none, it doesn't match or its nodes don't make a tree over
+  // triangleCount triangles that traversal can walk safely.
+  bool save(const std::string& path, unsigned long long key) const;
+  bool load(const std::string& path, unsigned long long key, unsigned int triangleCount);
+
+private:
+  BVH(const BVH&);
+  BVH& operator=(const BVH&);
+  void detach();
+  bool wellFormed(unsigned int triangleCount) const;
+  void linkParents(unsigned int primitiveCount);
+  void setBounds(unsigned int node, const AABB& bounds);
+  void refitLeaf(unsigned int leaf, const AABB& bounds);
+
+  std::vector<BVHNode> nodeStorage;
+  std::vector<unsigned int> indexStorage;
+  std::vector<unsigned int> parents;
+  std::vector<unsigned int> primitiveLeaf;
+  // sum of node areas weighted like the SAH, negative until worked out
+  float areaSum;
+  void *mapping;
+  size_t mappingSize;
+};
+
+// rebuild once a refitted tree costs this many times what it did when built
+#define BVH_REBUILD_RATIO 1.5f
+
+// edits kept apart while a rebuild runs, past this many the catch up
+// refits the whole tree instead
+#define BVH_REBUILD_RANGES 64
+
+class QuantizedBVH;
+
+// What a background rebuild builds from: the triangles and the tree's
+// triangle indices as they were when it started.
+struct BVHSnapshot {
+  std::vector<vec3> triangles;
+  std::vector<unsigned int> indices;
+};
+
+// Keeps a BVH over moving triangles usable. update() refits the tree in
+// place and, once it has degraded past BVH_REBUILD_RATIO, starts building
+// a new one on a background thread. poll() swaps the new tree in when it
+// is done, so the caller never waits on it.
+//
+// The rebuilder keeps its own copy of the triangles, taken on the first
+// update() after a reset() and kept current by later ones, which the
+// thread builds from. Edits made while it runs leave that copy alone and
+// only note the triangles they moved, poll() refits just those into the
+// new tree. The thread also packs the quantized copy if reset() asked.
+class BVHRebuilder {
+public:
+  BVHRebuilder();
+  ~BVHRebuilder();
+
+  // takes the cost of a freshly built tree as the reference, quantize
+  // packs rebuilt trees for poll() too
+  void reset(BVH& bvh, bool quantize = false);
+  void update(BVH& bvh, const std::vector<vec3>& triangles);
+  void update(BVH& bvh, const std::vector<vec3>& triangles,
+              unsigned int first, unsigned int count);
+  // returns true if a rebuilt tree was swapped into bvh, and its quantized
+  // copy into quantized if that is given
+  bool poll(BVH& bvh, const std::vector<vec3>& triangles, QuantizedBVH *quantized = NULL);
+  // drops the running rebuild, e.g. after triangles were added or removed
+  void cancel();
+
+  // SAH cost after the last build and after the last refit
+  float buildCost;
+  float cost;
+
+private:
+  BVHRebuilder(const BVHRebuilder&);
+  BVHRebuilder& operator=(const BVHRebuilder&);
+  void keep(const BVH& bvh, const std::vector<vec3>& triangles,
+            unsigned int first, unsigned int count);
+  void check(BVH& bvh);
+  void run();
+
+  std::thread thread;
+  std::atomic<bool> finished;
+  bool running;
+  bool stale;
+  bool quantize;
+  // the copy edits go to, and the one the running thread reads; the same
+  // until reset() starts a new copy under a rebuild that is being dropped
+  std::shared_ptr<BVHSnapshot> snapshot;
+  std::shared_ptr<BVHSnapshot> building;
+  // triangles moved since the running rebuild started, first and count
+  std::vector<std::pair<unsigned int, unsigned int> > moved;
+  bool movedAll;
+  BVH result;
+  std::unique_ptr<QuantizedBVH> packed;
+};
+
+template <class Visitor>
+void BVH::visitLeaves(const AABB& box, Visitor& visitor) const
+{
+  if (nodeCount == 0)
+    return;
+
+  unsigned int stack[BVH_MAX_DEPTH];
+  int stackSize = 0;
+  stack[stackSize++] = 0;
+
+  while (stackSize > 0) {
+    const BVHNode& node = nodes[stack[--stackSize]];
+    if (!node.bounds.overlaps(box))
+      continue;
+
+    if (node.count > 0) {
+      visitor(indices + node.left, node.count);
+    }
+    else {
+      stack[stackSize++] = node.left;
+      stack[stackSize++] = node.left + 1;
+    }
+  }
+}
+
+template <class Visitor>
+struct BVHPrimitiveVisitor {
+  Visitor& visitor;
+  void operator()(const unsigned int *first, unsigned int count)
+  {
+    for (unsigned int i = 0; i < count; i++)
+      visitor(first[i]);
+  }
+};
+
+template <class Visitor>
+void BVH::visit(const AABB& box, Visitor& visitor) const
+{
+  BVHPrimitiveVisitor<Visitor> leaves = { visitor };
+  visitLeaves(box, leaves);
+}
+
+// Hash of everything a build depends on: the triangles, which of them are
+// included and the builder settings. Used as the key of cached trees.
+unsigned long long hashBVHInput(const std::vector<vec3>& triangles,
+                                const std::vector<unsigned int>& triangleIndices);
+
+#endif // BVH_H
@@ -2,6 +2,7 @@
 #define COLLISION_H
 
 #include <math.h>
+#include <float.h>
 #include <iostream>
 
 #include <glad/glad.h>
@@ -22,6 +23,7 @@
 
 using glm::vec3;
 using glm::vec4;
+using glm::mat3;
 using glm::mat4;
 using glm::perspective;
 using glm::length;
@@ -45,9 +47,8 @@ public:
 	bool foundCollision;
 	double nearestDistance;
 	vec3 intersectionPoint;
-
-  // iteration depth
-  int collisionRecursionDepth;
+  // axes of a box, one per column, see BoxShape
+  mat3 orientation;
 };
 
 class Plane {
@@ -63,6 +64,89 @@ public:
 	double signedDistanceTo(const vec3& point) const;
 };
 
+// Axis aligned bounding box, used by the collision broadphase
+class AABB {
+public:
+	vec3 lower;
+	vec3 upper;
+
+	AABB();
+	AABB(const vec3& lower, const vec3& upper);
+
+	void grow(const vec3& point);
+	void grow(const AABB& box);
+	bool overlaps(const AABB& box) const;
+	bool contains(const AABB& box) const;
+	vec3 center() const;
+	float surfaceArea() const;
+	// bounds of this box after transforming it by m
+	AABB transformed(const mat4& m) const;
+};
+
+// The shape being swept, a template argument of the collide and slide
+// code so each shape gets a pipeline of its own. Sweeps run in a space
+// scaled by spaceScale() on each axis, in which the slide response treats
+// the collider as a sphere of sweepRadius(): every narrowphase reports its
+// hits as a point that far from where the sweep's position is at the
+// time of the hit, against the contact normal. bounds() is the half size
+// of the box around the shape in that space and groundDepth() how far
+// below the position a hit on flat ground is reported.
+//
+// An ellipsoid is the unit sphere of its e-space.
+struct EllipsoidShape {
+  static vec3 spaceScale(const vec3& eRadius) { return eRadius; }
+  static float sweepRadius(const vec3&) { return 1.0f; }
+  static vec3 bounds(const CollisionPacket&) { return vec3(1.0f); }
+  // eRadius[1], as the grounded test has always had it
+  static float groundDepth(const vec3& eRadius) { return eRadius[1]; }
+};
+
+// A sphere, the same radius on every axis, needs no e-space: it is swept
+// in R3 against the triangles as they are.
+struct SphereShape {
+  static vec3 spaceScale(const vec3&) { return vec3(1.0f); }
+  static float sweepRadius(const vec3& eRadius) { return eRadius[0]; }
+  static vec3 bounds(const CollisionPacket& packet) { return vec3(packet.eRadius[0]); }
+  // the ellipsoid's test scaled to R3
+  static float groundDepth(const vec3& eRadius) { return eRadius[1] * eRadius[0]; }
+};
+
+// An upright capsule in R3: a vertical segment through the position,
+// swept by a sphere. eRadius[0] is the radius and eRadius[1] half the
+// height, from the position to the tip of either cap, no less than the
+// radius; eRadius[2] is unused.
+struct CapsuleShape {
+  static vec3 spaceScale(const vec3&) { return vec3(1.0f); }
+  static float sweepRadius(const vec3& eRadius) { return eRadius[0]; }
+  static vec3 bounds(const CollisionPacket& packet)
+  {
+    float radius = packet.eRadius[0];
+    return vec3(radius, MAX(packet.eRadius[1], radius), radius);
+  }
+  static float groundDepth(const vec3& eRadius) { return eRadius[0]; }
+};
+
+// An oriented box in R3, eRadius its half size along each column of the
+// packet's orientation. The response treats it as the largest sphere
+// inside it.
+struct BoxShape {
+  static vec3 spaceScale(const vec3&) { return vec3(1.0f); }
+  static float sweepRadius(const vec3& eRadius)
+  {
+    return MIN(MIN(eRadius[0], eRadius[1]), eRadius[2]);
+  }
+  static vec3 bounds(const CollisionPacket& packet)
+  {
+    vec3 half(0.0f);
+    for (int k = 0; k < 3; k++) {
+      for (int a = 0; a < 3; a++)
+        half[a] += fabsf(packet.orientation[k][a]) * packet.eRadius[k];
+    }
+    return half;
+  }
+  static float groundDepth(const vec3& eRadius) { return sweepRadius(eRadius); }
+};
+
 bool checkPointInTriangle(const vec3& point,
                           const vec3& pa,const vec3& pb, const vec3& pc);
 
@@ -72,4 +156,17 @@ bool getLowestRoot(float a, float b, float c, float maxR,
 void checkTriangle(CollisionPacket* colPackage,
                     const vec3& p1, const vec3& p2, const vec3& p3);
 
+// Sweeps the packet's ellipsoid against another, standing still at center
+// with the given radius, both in R3. Hits are recorded like triangle hits
+// so the slide response treats them the same. Shape is the space the
+// packet is in.
+template <class Shape = EllipsoidShape>
+void checkEllipsoid(CollisionPacket* colPackage,
+                    const vec3& center, const vec3& radius);
+// The same against an upright capsule standing still at center, see
+// CapsuleShape for radius and halfHeight.
+template <class Shape = EllipsoidShape>
+void checkCapsule(CollisionPacket* colPackage, const vec3& center, float radius,
+                  float halfHeight);
+
 #endif // COLLISION_H
@@ -0,0 +1,67 @@
+#ifndef DETERMINISM_H
+#define DETERMINISM_H
+
+#include <float.h>
+#include <fenv.h>
+
+#include "kernels.h"
+
+#ifdef COLLISION_X86
+#include <xmmintrin.h>
+#endif
+
+// Lockstep needs every build to turn the same inputs into the same bits.
+// The collision math only adds, subtracts, multiplies, divides and takes
+// square roots, which IEEE 754 rounds exactly, and every kernel level
+// gives the scalar results bit for bit, so floats are reproducible as
+// long as nothing rewrites the math: no contraction into fused multiply
+// adds (-ffp-contract=off, which the Makefile always passes), no fast math,
+// no x87 excess precision, round to nearest and denormals kept.
+//
+// Building with COLLISION_DETERMINISTIC turns what can't be checked here
+// into errors and makes every update run under FloatEnvironment, so a
+// library that changed the rounding mode or flushes denormals doesn't leak
+// into the simulation. `make determinism` compares whole runs across
+// optimisation levels.
+#ifdef COLLISION_DETERMINISTIC
+#ifdef __FAST_MATH__
+#error "COLLISION_DETERMINISTIC: -ffast-math reorders the collision math"
+#endif
+#if FLT_EVAL_METHOD != 0
+#error "COLLISION_DETERMINISTIC: floats are evaluated in extra precision, use SSE math"
+#endif
+#ifdef __clang__
+#pragma STDC FP_CONTRACT OFF
+#endif
+#endif
+
+// Round to nearest with denormals, for as long as it is in scope, and
+// whatever was set before once it goes out of scope.
+class FloatEnvironment {
+public:
+  FloatEnvironment()
+  {
+#ifdef COLLISION_X86
+    // every exception masked, round to nearest, no flush to zero
+    saved = _mm_getcsr();
+    _mm_setcsr(0x1f80);
+#else
+    saved = fegetround();
+    fesetround(FE_TONEAREST);
+#endif
+  }
+
+  ~FloatEnvironment()
+  {
+#ifdef COLLISION_X86
+    _mm_setcsr(saved);
+#else
+    fesetround(saved);
+#endif
+  }
+
+private:
+  unsigned int saved;
+};
+
+#endif // DETERMINISM_H
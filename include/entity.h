@@ -1,25 +1,177 @@
 #ifndef ENTITY_H
 #define ENTITY_H
 
+#include <utility>
 #include <vector>
 
 #include <glm/glm.hpp>
 
 #include "collision.h"
-#include "model.h"
+#include "sweepprune.h"
+#include "trianglestore.h"
+#include "workers.h"
+#include "world.h"
+
+// characters a worker of CharacterGroup::update() moves at a time
+#define CHARACTER_GRAIN 8
+
+// A grounded character that moved less than SLEEP_SPEED of its smallest
+// radius a tick for SLEEP_TICKS ticks in a row falls asleep, and only
+// wakes for a sideways change of velocity or an upward velocity of more
+// than WAKE_SPEED of it, so one that creeps or is nudged a little doesn't
+// flip back and forth.
+#define SLEEP_SPEED 0.002f
+#define WAKE_SPEED 0.01f
+#define SLEEP_TICKS 30
+
+// What a character collides as. radius is the ellipsoid's radius, the
+// capsule's radius and half height as in CapsuleShape, or the box's half
+// size along the axes of orientation.
+enum CharacterShape {
+  SHAPE_ELLIPSOID,
+  SHAPE_CAPSULE,
+  SHAPE_BOX
+};
+
+// How much work one pass of collide and slide may do, so a character
+// costs no more than its budget however cramped it gets. Each iteration
+// sweeps once and slides off what it hits.
+struct SlideBudget {
+  SlideBudget(unsigned int iterations = 6, float minDistance = 0.0f)
+    : iterations(iterations), minDistance(minDistance) {}
+
+  // sweeps per pass at most, update() makes two
+  unsigned int iterations;
+  // stop once less of the move than this is left, in R3
+  float minDistance;
+};
+
+// Where a pass of collide and slide ended up, in the space of the sweep.
+struct SlideResult {
+  vec3 position;
+  // sweeps it took
+  unsigned int iterations;
+  // whether a hit held it up from below
+  bool grounded;
+};
+
+// Another character as it stood when the tick began, which is what a
+// character slides off, so the order characters move in doesn't matter.
+struct NearbyCharacter {
+  vec3 position;
+  vec3 radius;
+  CharacterShape shape;
+  mat3 orientation;
+};
 
 class CharacterEntity {
 public:
-  CharacterEntity(std::vector<Model> models, vec3 radius);
+  CharacterEntity(CollisionWorld *world, vec3 radius, CharacterShape shape = SHAPE_ELLIPSOID);
+  // slides as a sphere if an ellipsoid's radius is the same on every
+  // axis, as its shape otherwise
   void update();
-  void checkCollision();
-  void collideAndSlide(const vec3& gravity);
-  vec3 collideWithWorld(const vec3& pos, const vec3& velocity);
+  bool isSphere() const;
+  // half size of the R3 box around the character
+  vec3 halfExtents() const;
+  // where to draw the character a fraction alpha of a tick after the last
+  // update(), see FixedTimestep::alpha()
+  vec3 interpolatedPosition(float alpha) const;
+
+  // puts the character somewhere without sweeping there, awake and
+  // without anything to interpolate from
+  void teleport(const vec3& position);
+
+  // A sleeping character's update() doesn't sweep at all, it stays where
+  // it is. It wakes by itself if it was teleported or its position set,
+  // its velocity changed or the world was edited near it; disturbed()
+  // tells whether any of that happened since the last update(), and
+  // wake() wakes it regardless.
+  bool disturbed();
+  void wake();
+
+  // The collide and slide pipeline, compiled once per shape, see
+  // EllipsoidShape, SphereShape, CapsuleShape and BoxShape. All but the
+  // ellipsoid's skip every conversion to and from e-space. The packet
+  // lives on the stack of collideAndSlide, which returns the sweeps both
+  // passes took.
+  template <class Shape> unsigned int collideAndSlide(const vec3& gravity);
+  template <class Shape> SlideResult collideWithWorld(CollisionPacket& packet, const vec3& pos,
+                                                      const vec3& velocity);
+  template <class Shape> void checkCollision(CollisionPacket& packet);
+  template <class Shape> void gatherCandidates(const AABB& box);
 
   vec3 position, velocity, radius;
-  CollisionPacket collisionPackage;
-  std::vector<Model> models;
+  // position before the last update(), see teleport()
+  vec3 previousPosition;
+  CharacterShape shape;
+  // the box's axes, one per column
+  mat3 orientation;
+  // limits of each pass, and the sweeps the last update() took
+  SlideBudget budget;
+  unsigned int iterations;
+  CollisionWorld *world;
+  // buffer the broadphase writes candidate spans to, grown when a query
+  // finds more than fit
+  std::vector<TriangleSpan> spans;
+  // R3 vertices of the span being converted
+  std::vector<vec3> spanVertices;
+  // candidate triangles in the space of the sweep, gathered once per
+  // collideAndSlide for the whole motion and reused at every iteration
+  TriangleStore eTriangles;
+  // the features of the span being gathered and the world triangles of
+  // all of them, see gatherSpans()
+  std::vector<unsigned int> spanFeatures;
+  std::vector<unsigned int> spanIndices;
+  // the box the candidates were gathered for, in the same space
+  AABB gathered;
+  // other characters that may be touched this tick, see CharacterGroup;
+  // boxes among them are swept against as their faces, with the candidates
+  std::vector<NearbyCharacter> nearby;
+  unsigned int proxy;
   int grounded;
+
+  // false keeps the character awake for good
+  bool canSleep;
+  bool asleep;
+  // updates in a row it has been still for
+  unsigned int stillTicks;
+  // velocity when it fell asleep, and the world edits it has seen
+  vec3 restVelocity;
+  unsigned int seenChanges;
+
+private:
+  void settle();
+};
+
+// Characters that collide with each other as well as with the world. A
+// sweep-and-prune over their motion bounds finds the pairs that may touch
+// each tick, and each character then slides off where the others it was
+// paired with stood at the start of the tick, just like off world
+// triangles. A character's update only writes to that character, so with
+// a pool they all move at once, with the same results as one by one.
+// Sleeping characters are only looked at to wake them: paired with one
+// that is awake and moving into it or away from under it, a sleeper wakes
+// too, see disturbs().
+class CharacterGroup {
+public:
+  void add(CharacterEntity *entity);
+  void remove(CharacterEntity *entity);
+  // finds this tick's pairs, then moves every character, across the
+  // workers of pool if there is one
+  void update(WorkerPool *pool = NULL);
+
+  std::vector<CharacterEntity*> entities;
+  SweepAndPrune sweepAndPrune;
+
+private:
+  AABB motionBounds(const CharacterEntity& entity) const;
+  bool disturbs(const CharacterEntity& mover, const CharacterEntity& sleeper) const;
+
+  // entity of each sweep-and-prune handle
+  std::vector<CharacterEntity*> owners;
+  std::vector<std::pair<unsigned int, unsigned int> > pairs;
+  // the characters awake this tick
+  std::vector<CharacterEntity*> moving;
 };
 
 #endif // ENTITY_H
@@ -0,0 +1,55 @@
+#ifndef GRID_H
+#define GRID_H
+
+#include <unordered_map>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "broadphase.h"
+#include "collision.h"
+
+// Hashed uniform grid over the world triangles. Each cell keyed by its
+// integer coordinates lists the triangles overlapping it. Suits flat,
+// sprawling levels where short sweeps only ever touch a few cells.
+class UniformGrid : public Broadphase {
+public:
+  UniformGrid(float cellSize = 2.0f);
+
+  // drops every triangle and switches to a new cell size
+  void clear(float cellSize);
+
+  // triangles holds three world space vertices per triangle
+  void insert(const std::vector<vec3>& triangles, unsigned int triangle);
+  void remove(unsigned int triangle);
+
+  void query(const AABB& box, std::vector<unsigned int>& result) const;
+
+  // walks the cells along the sweep with a 3D-DDA instead of visiting
+  // every cell in the sweep's bounds
+  void querySweep(const vec3& start, const vec3& end, const vec3& radius,
+                  std::vector<unsigned int>& result) const;
+  // one span per cell along the sweep, the cell's whole triangle list
+  unsigned int querySpans(const vec3& start, const vec3& end, const vec3& radius,
+                          TriangleSpan *spans, unsigned int capacity) const;
+
+  float cellSize;
+
+private:
+  typedef unsigned long long CellKey;
+
+  CellKey key(int x, int y, int z) const;
+  void cellOf(const vec3& point, int cell[3]) const;
+  void gatherCell(int x, int y, int z, const AABB& box,
+                  std::vector<unsigned int>& result) const;
+  // calls visitor(x, y, z) once for every cell the sweep may touch
+  template <class Visitor>
+  void walkSweep(const vec3& start, const vec3& end, const vec3& radius,
+                 Visitor& visitor) const;
+
+  std::unordered_map<CellKey, std::vector<unsigned int> > cells;
+  // per triangle bounds, indexed by triangle, empty once removed
+  std::vector<AABB> bounds;
+};
+
+#endif // GRID_H
@@ -0,0 +1,61 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include <glm/glm.hpp>
+
+#include "collision.h"
+
+// the SIMD versions need the target attributes of GCC or Clang on x86
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define COLLISION_X86
+#endif
+
+class TriangleStore;
+struct QBVHNode;
+struct QBVHSweep;
+
+// Instruction set levels, each one including those before it
+enum CollisionISA {
+  COLLISION_GENERIC,
+  COLLISION_SSE42,
+  COLLISION_AVX2,
+  COLLISION_AVX512
+};
+
+// The hot collision loops in the best version the CPU runs, so one build
+// makes use of whatever host it lands on. Every level gives bit for bit
+// the same results.
+struct CollisionKernels {
+  CollisionISA isa;
+
+  // the swept ellipsoid against triangles of a store, see checkTriangles
+  void (*checkTriangles)(CollisionPacket* colPackage, const TriangleStore& store,
+                         unsigned int first, unsigned int count, const AABB& box);
+  // the same for a sphere in R3, see checkSphereTriangles
+  void (*checkSphereTriangles)(CollisionPacket* colPackage, const TriangleStore& store,
+                               unsigned int first, unsigned int count, const AABB& box);
+  // capsules and boxes, see checkCapsuleTriangles and checkBoxTriangles
+  void (*checkCapsuleTriangles)(CollisionPacket* colPackage, const TriangleStore& store,
+                                unsigned int first, unsigned int count, const AABB& box);
+  void (*checkBoxTriangles)(CollisionPacket* colPackage, const TriangleStore& store,
+                            unsigned int first, unsigned int count, const AABB& box);
+  // decodes the children of a quantized node with the given box and
+  // returns the mask of those the sweep may touch
+  unsigned int (*sweepChildren)(const QBVHNode& node, const float box[6],
+                                const QBVHSweep& sweep, float childBoxes[][6]);
+  // out[i] = m * vec4(in[i], 1), in and out may be the same
+  void (*transformPoints)(const mat4& m, const vec3 *in, vec3 *out, unsigned int count);
+};
+
+// The kernels in use, picked on first use from what the CPU supports.
+// COLLISION_ISA=generic, sse4.2, avx2 or avx512 in the environment picks a
+// lower level instead, e.g. to compare them.
+const CollisionKernels& collisionKernels();
+// switches every kernel to the given level, false if the CPU lacks it;
+// not while other threads use the kernels
+bool setCollisionISA(CollisionISA isa);
+
+CollisionISA cpuCollisionISA();
+const char *collisionISAName(CollisionISA isa);
+
+#endif // KERNELS_H
@@ -0,0 +1,65 @@
+#ifndef OCTREE_H
+#define OCTREE_H
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "broadphase.h"
+#include "collision.h"
+
+// deepest level triangles are pushed down to
+#define OCTREE_MAX_DEPTH 12
+// marks a missing child or the root's parent
+#define OCTREE_NONE 0xffffffffu
+
+// A node's loose bounds are twice its cell, so a triangle no larger than
+// the cell can live in the node that holds its center.
+struct OctreeNode {
+  vec3 center;
+  float halfSize;
+  unsigned int parent;
+  unsigned int children[8];
+  unsigned int subtreeCount;  // triangles in this node and below
+  std::vector<unsigned int> triangles;
+};
+
+// Loose octree over the world triangles. Unlike the BVH, single triangles
+// can be inserted and removed cheaply, which suits geometry that changes
+// at runtime.
+class LooseOctree : public Broadphase {
+public:
+  LooseOctree();
+
+  // drops every triangle and starts over with a root cell around bounds
+  void clear(const AABB& bounds);
+
+  // triangles holds three world space vertices per triangle
+  void insert(const std::vector<vec3>& triangles, unsigned int triangle);
+  void remove(unsigned int triangle);
+
+  void query(const AABB& box, std::vector<unsigned int>& result) const;
+  // one span per overlapping node, the node's whole triangle list
+  unsigned int querySpans(const vec3& start, const vec3& end, const vec3& radius,
+                          TriangleSpan *spans, unsigned int capacity) const;
+
+  std::vector<OctreeNode> nodes;
+  unsigned int root;
+
+private:
+  bool fits(unsigned int node, const AABB& box) const;
+  void grow(const AABB& box);
+  unsigned int child(unsigned int node, int octant);
+  void queryNode(unsigned int node, const AABB& box,
+                 std::vector<unsigned int>& result) const;
+  void spanNode(unsigned int node, const AABB& box, TriangleSpan *spans,
+                unsigned int capacity, unsigned int& spanCount) const;
+
+  // per triangle bounds and location, indexed by triangle
+  std::vector<AABB> bounds;
+  std::vector<unsigned int> triangleNode;
+  std::vector<unsigned int> triangleSlot;
+  std::vector<unsigned int> freeNodes;
+};
+
+#endif // OCTREE_H
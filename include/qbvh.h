@@ -0,0 +1,111 @@
+#ifndef QBVH_H
+#define QBVH_H
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "broadphase.h"
+#include "bvh.h"
+#include "collision.h"
+#include "kernels.h"
+
+// children per node, four 16-bit boxes and references fill a cache line
+#define QBVH_WIDTH 4
+// child reference of an unused slot
+#define QBVH_EMPTY 0xffffffffu
+// child references with this bit set are leaves: 4 bits of triangle count
+// followed by 27 bits of the first entry in QuantizedBVH::indices
+#define QBVH_LEAF 0x80000000u
+#define QBVH_LEAF_SIZE 15
+// each level of the traversal leaves at most three siblings on the stack
+#define QBVH_STACK_SIZE (3 * BVH_MAX_DEPTH + 1)
+
+#if BVH_LEAF_SIZE > QBVH_LEAF_SIZE
+#error "BVH leaves don't fit the quantized leaf count"
+#endif
+
+// Four children with their bounds quantized to 16 bits inside the box of
+// the node itself, which the traversal decodes on the way down. Lower
+// bounds count steps up from the box's lower corner and upper bounds count
+// steps down from its upper corner, so 0 decodes to the box's own face.
+struct alignas(64) QBVHNode {
+  unsigned short lower[3][QBVH_WIDTH];
+  unsigned short upper[3][QBVH_WIDTH];
+  unsigned int children[QBVH_WIDTH];
+};
+
+// A sweep's segment ready for slab tests against child boxes grown by its
+// radius, the Minkowski sum of the box and the ellipsoid's bounds.
+struct QBVHSweep {
+  float start[3];
+  float inverse[3];
+  float radius[3];
+  bool moving[3];
+
+  QBVHSweep(const vec3& start, const vec3& end, const vec3& radius);
+  bool operator()(const float box[6]) const;
+};
+
+// Decodes the children of node, whose box is box, and returns the mask of
+// those the sweep may touch; see CollisionKernels::sweepChildren.
+unsigned int sweepChildren(const QBVHNode& node, const float box[6],
+                           const QBVHSweep& sweep, float childBoxes[][6]);
+#ifdef COLLISION_X86
+// all four children at once, the CPU must have SSE4.2
+unsigned int sweepChildrenSSE42(const QBVHNode& node, const float box[6],
+                                const QBVHSweep& sweep, float childBoxes[][6]);
+#endif
+
+// Compact copy of a built BVH for querying only: four wide nodes of one
+// cache line each instead of a 32 byte node per binary split. Rebuilt from
+// the BVH whenever that changes.
+class QuantizedBVH : public Broadphase {
+public:
+  QuantizedBVH();
+
+  void clear();
+  // collapses the binary tree, always opening the largest child first
+  void build(const BVH& bvh);
+  // follows a partial refit of the BVH it was built from, quantizing only
+  // the slots the moved triangles outgrew and the subtrees below them
+  void refit(const BVH& bvh, unsigned int first, unsigned int count);
+
+  void swap(QuantizedBVH& other);
+
+  void query(const AABB& box, std::vector<unsigned int>& result) const;
+
+  // tests the sweep's segment against every child box grown by radius,
+  // which culls far more than the sweep's bounds on diagonal moves
+  void querySweep(const vec3& start, const vec3& end, const vec3& radius,
+                  std::vector<unsigned int>& result) const;
+  unsigned int querySpans(const vec3& start, const vec3& end, const vec3& radius,
+                          TriangleSpan *spans, unsigned int capacity) const;
+
+  // bytes taken by the nodes and indices
+  size_t memoryUsage() const;
+
+  std::vector<QBVHNode> nodes;
+  std::vector<unsigned int> indices;
+  // the root's box, kept exact as everything below is relative to it
+  AABB bounds;
+
+private:
+  unsigned int pack(const BVH& bvh, unsigned int node, const AABB& box);
+  void linkLeaves();
+  void repack(const BVH& bvh, unsigned int node, const AABB& box);
+  void requantize(const BVH& bvh, unsigned int slot);
+
+  // for refits: the binary node behind every slot, the slot above every
+  // node, the box every node is quantized in and the leaf slot of every
+  // triangle, slots counting QBVH_WIDTH per node
+  std::vector<unsigned int> sources;
+  std::vector<unsigned int> parents;
+  std::vector<AABB> boxes;
+  std::vector<unsigned int> leafSlots;
+
+  template <class Test, class Visitor>
+  void traverse(const Test& test, Visitor& visitor) const;
+};
+
+#endif // QBVH_H
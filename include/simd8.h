@@ -0,0 +1,134 @@
+#ifndef SIMD8_H
+#define SIMD8_H
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "collision.h"
+#include "kernels.h"
+#include "trianglestore.h"
+
+#ifdef COLLISION_X86
+#include <immintrin.h>
+
+// Eight lanes of the narrowphase kernels' vector math, each helper doing
+// what the scalar code does in the same order. Only for functions marked
+// AVX2, which only run if the CPU has it.
+#define AVX2 __attribute__((target("avx2")))
+
+namespace {
+struct Vec8 {
+  __m256 x, y, z;
+};
+
+AVX2 inline Vec8 load8(const std::vector<float> v[3], unsigned int i)
+{
+  Vec8 r = { _mm256_loadu_ps(&v[0][i]), _mm256_loadu_ps(&v[1][i]), _mm256_loadu_ps(&v[2][i]) };
+  return r;
+}
+
+AVX2 inline Vec8 broadcast8(const vec3& v)
+{
+  Vec8 r = { _mm256_set1_ps(v[0]), _mm256_set1_ps(v[1]), _mm256_set1_ps(v[2]) };
+  return r;
+}
+
+AVX2 inline Vec8 sub8(const Vec8& a, const Vec8& b)
+{
+  Vec8 r = { _mm256_sub_ps(a.x, b.x), _mm256_sub_ps(a.y, b.y), _mm256_sub_ps(a.z, b.z) };
+  return r;
+}
+
+AVX2 inline __m256 dot8(const Vec8& a, const Vec8& b)
+{
+  return _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(a.x, b.x), _mm256_mul_ps(a.y, b.y)),
+                       _mm256_mul_ps(a.z, b.z));
+}
+
+AVX2 inline Vec8 cross8(const Vec8& a, const Vec8& b)
+{
+  Vec8 r = { _mm256_sub_ps(_mm256_mul_ps(a.y, b.z), _mm256_mul_ps(b.y, a.z)),
+             _mm256_sub_ps(_mm256_mul_ps(a.z, b.x), _mm256_mul_ps(b.z, a.x)),
+             _mm256_sub_ps(_mm256_mul_ps(a.x, b.y), _mm256_mul_ps(b.x, a.y)) };
+  return r;
+}
+
+// p + f * v
+AVX2 inline Vec8 madd8(const Vec8& p, __m256 f, const Vec8& v)
+{
+  Vec8 r = { _mm256_add_ps(p.x, _mm256_mul_ps(f, v.x)),
+             _mm256_add_ps(p.y, _mm256_mul_ps(f, v.y)),
+             _mm256_add_ps(p.z, _mm256_mul_ps(f, v.z)) };
+  return r;
+}
+
+AVX2 inline Vec8 select8(const Vec8& a, const Vec8& b, __m256 mask)
+{
+  Vec8 r = { _mm256_blendv_ps(a.x, b.x, mask), _mm256_blendv_ps(a.y, b.y, mask),
+             _mm256_blendv_ps(a.z, b.z, mask) };
+  return r;
+}
+
+AVX2 inline __m256 negate8(__m256 a)
+{
+  return _mm256_xor_ps(a, _mm256_set1_ps(-0.0f));
+}
+
+// getLowestRoot on eight quadratics, the mask of those with a root
+AVX2 inline __m256 lowestRoot8(__m256 a, __m256 b, __m256 c, __m256 maxR, __m256& root)
+{
+  __m256 zero = _mm256_setzero_ps();
+  __m256 determinant = _mm256_sub_ps(_mm256_mul_ps(b, b),
+                                     _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(4.0f), a), c));
+  __m256 solvable = _mm256_cmp_ps(determinant, zero, _CMP_NLT_UQ);
+
+  __m256 sqrtD = _mm256_sqrt_ps(determinant);
+  __m256 twoA = _mm256_mul_ps(_mm256_set1_ps(2.0f), a);
+  __m256 r1 = _mm256_div_ps(_mm256_sub_ps(negate8(b), sqrtD), twoA);
+  __m256 r2 = _mm256_div_ps(_mm256_add_ps(negate8(b), sqrtD), twoA);
+  __m256 swap = _mm256_cmp_ps(r1, r2, _CMP_GT_OQ);
+  __m256 lower = _mm256_blendv_ps(r1, r2, swap);
+  __m256 upper = _mm256_blendv_ps(r2, r1, swap);
+
+  __m256 lowerOk = _mm256_and_ps(_mm256_cmp_ps(lower, zero, _CMP_GT_OQ),
+                                 _mm256_cmp_ps(lower, maxR, _CMP_LT_OQ));
+  __m256 upperOk = _mm256_and_ps(_mm256_cmp_ps(upper, zero, _CMP_GT_OQ),
+                                 _mm256_cmp_ps(upper, maxR, _CMP_LT_OQ));
+  root = _mm256_blendv_ps(upper, lower, lowerOk);
+  return _mm256_and_ps(solvable, _mm256_or_ps(lowerOk, upperOk));
+}
+
+// the lanes with the given bit of bits set
+AVX2 inline __m256 bit8(__m256i bits, unsigned int bit)
+{
+  __m256i b = _mm256_set1_epi32(1 << bit);
+  return _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(bits, b), b));
+}
+
+// sweptFeatures on the eight triangles from i, given their features as
+// stored and shifted down for each lane's kind of sweep
+AVX2 inline __m256i sweptFeatures8(const TriangleStore& store, unsigned int i, __m256i stored,
+                                   __m256i features, __m256 backFace, const Vec8& velocity)
+{
+  __m256 facing[3];
+  for (int k = 0; k < 3; k++)
+    facing[k] = _mm256_cmp_ps(dot8(load8(store.neighbours[k], i), velocity),
+                              _mm256_setzero_ps(), _CMP_NGT_UQ);
+  __m256i dropped = _mm256_setzero_si256();
+  for (int k = 0; k < 3; k++) {
+    __m256 edge = _mm256_andnot_ps(facing[k], backFace);
+    __m256 vertex = _mm256_andnot_ps(backFace, _mm256_or_ps(
+      _mm256_and_ps(bit8(stored, FEATURES_FAN + 3 + k), facing[k]),
+      _mm256_and_ps(bit8(stored, FEATURES_FAN + (k + 2) % 3), facing[(k + 2) % 3])));
+    dropped = _mm256_or_si256(dropped, _mm256_or_si256(
+      _mm256_and_si256(_mm256_castps_si256(edge), _mm256_set1_epi32(1 << k)),
+      _mm256_and_si256(_mm256_castps_si256(vertex), _mm256_set1_epi32(1 << (3 + k)))));
+  }
+  return _mm256_andnot_si256(dropped, features);
+}
+}
+
+#endif
+
+#endif // SIMD8_H
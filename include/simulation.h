@@ -0,0 +1,91 @@
+#ifndef SIMULATION_H
+#define SIMULATION_H
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "collision.h"
+#include "entity.h"
+#include "timestep.h"
+#include "triplebuffer.h"
+#include "workers.h"
+#include "world.h"
+
+// The characters as they stood after a tick, what the render thread draws
+// from. Published whole and never changed afterwards.
+struct SimulationSnapshot {
+  // where to draw character i at a time on the simulation's clock,
+  // between where it stood before and after the tick, a tick behind but
+  // never anywhere the simulation didn't put it
+  vec3 interpolated(unsigned int i, double time) const;
+
+  // ticks run so far and the clock time of the last one
+  unsigned long long tick;
+  double time;
+  double tickLength;
+  // every character of the group in its order, before and after the tick
+  std::vector<vec3> previousPositions;
+  std::vector<vec3> positions;
+  std::vector<int> grounded;
+  // the player's index in those
+  unsigned int player;
+};
+
+// What the render thread tells the simulation each frame.
+struct PlayerInput {
+  // how fast the movement keys push the player, per second
+  vec3 push;
+};
+
+// Runs the world and a group of characters at a fixed tick rate on a
+// thread of its own, so collision and rendering each get a whole frame
+// where they used to share one. Nothing is shared but two triple buffers:
+// the player's input goes in and snapshots come out, neither side ever
+// waiting on the other. Once started, only the simulation thread touches
+// the world and the characters.
+class SimulationThread {
+public:
+  // player is one of group's characters; with a pool the characters move
+  // across its workers
+  SimulationThread(CollisionWorld *world, CharacterGroup *group, CharacterEntity *player,
+                   double rate = TICK_RATE, WorkerPool *pool = NULL);
+  ~SimulationThread();
+
+  // publishes the characters as they are, then starts ticking
+  void start();
+  // returns once the current tick is done
+  void stop();
+
+  // seconds since start() on the clock snapshots are stamped with
+  double clock() const;
+  // render thread only
+  void setInput(const PlayerInput& input);
+  const SimulationSnapshot& latest();
+
+private:
+  SimulationThread(const SimulationThread&);
+  SimulationThread& operator=(const SimulationThread&);
+
+  void run();
+  void tick(const PlayerInput& input);
+  void publish(double time);
+
+  CollisionWorld *world;
+  CharacterGroup *group;
+  CharacterEntity *player;
+  WorkerPool *pool;
+  FixedTimestep timestep;
+  unsigned long long ticks;
+
+  std::chrono::steady_clock::time_point started;
+  std::thread thread;
+  std::atomic<bool> running;
+  TripleBuffer<PlayerInput> inputs;
+  TripleBuffer<SimulationSnapshot> snapshots;
+};
+
+#endif // SIMULATION_H
@@ -0,0 +1,63 @@
+#ifndef SWEEPPRUNE_H
+#define SWEEPPRUNE_H
+
+#include <utility>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "collision.h"
+
+// One end of a box's interval on an axis. The owner is shifted left one
+// bit with the low bit set for the upper end.
+struct SAPEndpoint {
+  float value;
+  unsigned int owner;
+};
+
+// Incremental sweep-and-prune over moving boxes, e.g. the motion bounds of
+// characters. Each axis keeps the box endpoints sorted; since boxes move
+// little from one tick to the next, an insertion sort restores the order
+// in close to linear time. A lower end passing an upper end may start an
+// overlap, checked against the whole boxes, and an upper end passing a
+// lower end ends one, so only pairs overlapping on all axes are stored.
+class SweepAndPrune {
+public:
+  SweepAndPrune();
+
+  // returns a handle for update() and remove(), handles are reused
+  unsigned int add(const AABB& box);
+  void remove(unsigned int handle);
+  // only records the box, the order is restored by the next sort()
+  void update(unsigned int handle, const AABB& box);
+
+  // sorts the axes after boxes were added, moved or removed; after a large
+  // batch of adds, e.g. at load, the axes are sorted and swept from scratch
+  void sort();
+
+  // appends every pair of boxes overlapping on all three axes, lower
+  // handle first and in handle order, as of the last sort()
+  void pairs(std::vector<std::pair<unsigned int, unsigned int> >& result) const;
+
+private:
+  void sortAxis(int axis);
+  void rebuild();
+  void moveToEnd(int axis, unsigned int owner);
+  void passed(const SAPEndpoint& moving, const SAPEndpoint& other);
+  void link(unsigned int a, unsigned int b);
+  void unlink(unsigned int a, unsigned int b);
+
+  std::vector<SAPEndpoint> axes[3];
+  // position of each endpoint in its axis, indexed like SAPEndpoint::owner
+  std::vector<unsigned int> positions[3];
+  std::vector<AABB> boxes;
+  std::vector<bool> alive;
+  std::vector<unsigned int> freeHandles;
+  // boxes added since the last sort()
+  unsigned int added;
+  // the handles each box overlaps, both ways round, so a pair is found
+  // from either of its boxes and pairs() doesn't depend on hashing
+  std::vector<std::vector<unsigned int> > partners;
+};
+
+#endif // SWEEPPRUNE_H
@@ -0,0 +1,33 @@
+#ifndef TIMESTEP_H
+#define TIMESTEP_H
+
+// ticks per second the simulation runs at, and at most how many a frame
+// catches up on before it gives up on the time it is behind
+#define TICK_RATE 60.0
+#define MAX_TICKS_PER_FRAME 5
+
+// Fixed length simulation ticks out of frames of any length, so what the
+// simulation does and costs doesn't depend on the frame rate. Time carries
+// over from frame to frame until a whole tick is due; a frame that arrives
+// late runs the ticks it missed, up to maxTicks, and drops the rest so a
+// slow machine slows down instead of falling ever further behind.
+class FixedTimestep {
+public:
+  FixedTimestep(double rate = TICK_RATE, unsigned int maxTicks = MAX_TICKS_PER_FRAME);
+
+  // adds the seconds since the last frame and returns the ticks due now
+  unsigned int advance(double frameTime);
+  // how far into the next tick the frame is, 0 to 1, for drawing what
+  // moved between the last two ticks
+  float alpha() const;
+
+  // seconds per tick
+  double tickLength;
+  unsigned int maxTicks;
+  // time not yet simulated, less than a tick between frames
+  double accumulator;
+  // ticks given up on by frames that fell too far behind, for statistics
+  unsigned long long dropped;
+};
+
+#endif // TIMESTEP_H
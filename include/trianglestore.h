@@ -0,0 +1,183 @@
+#ifndef TRIANGLESTORE_H
+#define TRIANGLESTORE_H
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "collision.h"
+#include "kernels.h"
+
+// One triangle as a TriangleStore keeps it, everything worked out once
+// and in one place, e.g. to keep converted triangles around and copy them
+// into stores later without converting again.
+struct ESpaceTriangle {
+  ESpaceTriangle() {}
+  // the triangle scaled by 1 / radius, see TriangleStore::add()
+  ESpaceTriangle(const vec3& p1, const vec3& p2, const vec3& p3,
+                 const vec3& radius = vec3(1.0f));
+
+  // by vertex, then axis
+  float vertices[3][3];
+  float edges[3][3];
+  float edgeLengths[3];
+  float normal[3];
+  float d;
+  float area;
+  float lower[3];
+  float upper[3];
+  float center[3];
+  float reach;
+};
+
+// The normal ESpaceTriangle works out for the triangle, bit for bit, zero
+// if it is degenerate: what TriangleStore::add() takes for a neighbour.
+vec3 eSpaceNormal(const vec3& p1, const vec3& p2, const vec3& p3,
+                  const vec3& radius = vec3(1.0f));
+
+// Where the bits of TriangleStore::features for each kind of sweep start:
+// one reaching the triangle's plane from outside, one already within it
+// and one the triangle faces away from. Bit k of each is edge k, 3 + k
+// vertex k.
+#define FEATURES_OUTSIDE 0
+#define FEATURES_SUNK 6
+#define FEATURES_BACK 12
+// A back face tests the edges of its back group only where the neighbour
+// across them faces the sweep. A front face leaves vertex k to the
+// neighbour across edge k if bit 3 + k of this group is set and that
+// faces the sweep, and to the one across edge (k + 2) % 3, the edge
+// reaching it, if bit (k + 2) % 3 is, as a mirrored instance has it. See
+// MeshAdjacency.
+#define FEATURES_FAN 18
+// every edge and vertex of a front face, what checkTriangle tests
+#define FEATURES_ALL 0xfffu
+
+// Triangles laid out for the narrowphase. Everything checkTriangle works
+// out per triangle that doesn't depend on the sweep is computed once when
+// a triangle is added, and every component has an array of its own so a
+// pass over the triangles only reads what it uses.
+class TriangleStore {
+public:
+  void clear();
+  void reserve(unsigned int count);
+  // adds the triangle scaled by 1 / radius, i.e. in the e-space of an
+  // ellipsoid with that radius, with the eSpaceNormal() of the neighbours
+  // across its edges if its features need any
+  void add(const vec3& p1, const vec3& p2, const vec3& p3,
+           const vec3& radius = vec3(1.0f), unsigned int features = FEATURES_ALL,
+           const vec3 *neighbours = NULL);
+  void add(const ESpaceTriangle& triangle, unsigned int features = FEATURES_ALL,
+           const vec3 *neighbours = NULL);
+  unsigned int size() const;
+
+  vec3 position(unsigned int triangle, int vertex) const;
+
+  // vertex k of every triangle, by axis
+  std::vector<float> vertices[3][3];
+  // p2 - p1, p3 - p2 and p1 - p3 with their squared lengths
+  std::vector<float> edges[3][3];
+  std::vector<float> edgeLengths[3];
+  // unit normal and d of the plane, dot(normal, p) + d is 0 on it
+  std::vector<float> normals[3];
+  std::vector<float> d;
+  // length of cross(p2 - p1, p3 - p1), twice the area
+  std::vector<float> areas;
+  // bounds by axis, empty for degenerate triangles so nothing tests them
+  std::vector<float> lower[3];
+  std::vector<float> upper[3];
+  // centroid and the distance from it to the farthest vertex
+  std::vector<float> centers[3];
+  std::vector<float> reaches;
+  // the edges and vertices tested, see FEATURES_OUTSIDE
+  std::vector<unsigned int> features;
+  // unit normals of the neighbours across each edge, by axis, zero where
+  // the features need none
+  std::vector<float> neighbours[3][3];
+};
+
+// Whether triangle i's bounds touch box.
+inline bool overlapsBox(const TriangleStore& store, unsigned int i, const AABB& box)
+{
+  return store.lower[0][i] <= box.upper[0] && store.upper[0][i] >= box.lower[0] &&
+         store.lower[1][i] <= box.upper[1] && store.upper[1][i] >= box.lower[1] &&
+         store.lower[2][i] <= box.upper[2] && store.upper[2][i] >= box.lower[2];
+}
+
+// The features triangle i tests for a sweep along velocity, those of the
+// group kind starts at shifted down to bits 0 to 5, see FEATURES_FAN.
+// Whether a neighbour faces the sweep is worked out as its own test does.
+inline unsigned int sweptFeatures(const TriangleStore& store, unsigned int i, int kind,
+                                  const vec3& velocity)
+{
+  unsigned int features = store.features[i] >> kind & 0x3f;
+  unsigned int fan = store.features[i] >> FEATURES_FAN & 0x3f;
+  if (kind == FEATURES_BACK ? !features : !fan)
+    return features;
+
+  bool facing[3];
+  for (int k = 0; k < 3; k++) {
+    vec3 normal(store.neighbours[k][0][i], store.neighbours[k][1][i],
+                store.neighbours[k][2][i]);
+    facing[k] = !(dot(normal, velocity) > 0.0f);
+  }
+  for (int k = 0; k < 3; k++) {
+    if (kind == FEATURES_BACK) {
+      if (!facing[k])
+        features &= ~(1u << k);
+    }
+    else if (((fan >> (3 + k) & 1) && facing[k]) ||
+             ((fan >> (k + 2) % 3 & 1) && facing[(k + 2) % 3])) {
+      features &= ~(1u << (3 + k));
+    }
+  }
+  return features;
+}
+
+// Same test as checkTriangle, on triangle index of the store.
+void checkTriangle(CollisionPacket* colPackage,
+                   const TriangleStore& store, unsigned int index);
+
+// Tests the triangles first to first + count - 1 of the store, skipping
+// those whose bounds miss box, usually the bounds of the sweep. Runs the
+// version collisionKernels() picked.
+void checkTriangles(CollisionPacket* colPackage, const TriangleStore& store,
+                    unsigned int first, unsigned int count, const AABB& box);
+void checkTrianglesScalar(CollisionPacket* colPackage, const TriangleStore& store,
+                          unsigned int first, unsigned int count, const AABB& box);
+
+// The same for a sphere in R3, see SphereShape: the packet and the store
+// are not scaled, and the radius is eRadius[0] of the packet.
+void checkSphereTriangles(CollisionPacket* colPackage, const TriangleStore& store,
+                          unsigned int first, unsigned int count, const AABB& box);
+void checkSphereTrianglesScalar(CollisionPacket* colPackage, const TriangleStore& store,
+                                unsigned int first, unsigned int count, const AABB& box);
+
+// A capsule in R3 the same way, see CapsuleShape. Tests every edge and
+// vertex of every front face, like checkTriangle, features aside.
+void checkCapsuleTriangles(CollisionPacket* colPackage, const TriangleStore& store,
+                           unsigned int first, unsigned int count, const AABB& box);
+void checkCapsuleTrianglesScalar(CollisionPacket* colPackage, const TriangleStore& store,
+                                 unsigned int first, unsigned int count, const AABB& box);
+
+// An oriented box in R3, see BoxShape, by separating axes: the face
+// normal, the box axes and their cross products with the edges. A box
+// already overlapping a front face only stops moving further into it.
+void checkBoxTriangles(CollisionPacket* colPackage, const TriangleStore& store,
+                       unsigned int first, unsigned int count, const AABB& box);
+void checkBoxTrianglesScalar(CollisionPacket* colPackage, const TriangleStore& store,
+                             unsigned int first, unsigned int count, const AABB& box);
+
+#ifdef COLLISION_X86
+// Eight triangles per step, with exactly the results of the scalar version.
+// Only call it if the CPU has AVX2.
+void checkTrianglesAVX2(CollisionPacket* colPackage, const TriangleStore& store,
+                        unsigned int first, unsigned int count, const AABB& box);
+void checkSphereTrianglesAVX2(CollisionPacket* colPackage, const TriangleStore& store,
+                              unsigned int first, unsigned int count, const AABB& box);
+void checkCapsuleTrianglesAVX2(CollisionPacket* colPackage, const TriangleStore& store,
+                               unsigned int first, unsigned int count, const AABB& box);
+void checkBoxTrianglesAVX2(CollisionPacket* colPackage, const TriangleStore& store,
+                           unsigned int first, unsigned int count, const AABB& box);
+#endif
+
+#endif // TRIANGLESTORE_H
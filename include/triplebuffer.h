@@ -0,0 +1,45 @@
+#ifndef TRIPLEBUFFER_H
+#define TRIPLEBUFFER_H
+
+#include <atomic>
+
+// Hands the newest of a stream of values from one thread to another
+// without either ever waiting. The writer fills its back slot and swaps it
+// with the middle one; the reader swaps its front slot with the middle one
+// whenever that holds something newer. Values the reader was too slow for
+// are skipped, and a slot never changes while its side holds it, so what
+// read() returns stays intact until the next read(). One writer and one
+// reader only.
+template <class T>
+class TripleBuffer {
+public:
+  // every slot value-initialized, what read() gives before any publish()
+  TripleBuffer() : slots(), middle(1), back(2), front(0) {}
+
+  // the slot to fill, still whatever was published two values ago
+  T& write() { return slots[back]; }
+  // passes the filled slot on, replacing one the reader hasn't taken yet
+  void publish()
+  {
+    back = middle.exchange(back | FRESH, std::memory_order_acq_rel) & INDEX;
+  }
+  // the newest value published, the same as last time if there is none
+  const T& read()
+  {
+    if (middle.load(std::memory_order_relaxed) & FRESH)
+      front = middle.exchange(front, std::memory_order_acq_rel) & INDEX;
+    return slots[front];
+  }
+
+private:
+  enum { INDEX = 3, FRESH = 4 };
+
+  T slots[3];
+  // index of the middle slot, FRESH once the writer put it there
+  alignas(64) std::atomic<unsigned int> middle;
+  // owned by the writer and the reader
+  alignas(64) unsigned int back;
+  alignas(64) unsigned int front;
+};
+
+#endif // TRIPLEBUFFER_H
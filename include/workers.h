@@ -0,0 +1,66 @@
+#ifndef WORKERS_H
+#define WORKERS_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Threads kept around to run loops over many items, e.g. a tick's
+// characters. Each worker starts with an even share of the items and takes
+// grain of them at a time from the front of its share; one that runs out
+// steals the back half of another's, so a worker that drew the crowded
+// corner of a level doesn't hold up the others. The calling thread works
+// too, as worker 0.
+class WorkerPool {
+public:
+  // threadCount workers including the caller, 0 for one per core
+  WorkerPool(unsigned int threadCount = 0);
+  ~WorkerPool();
+
+  unsigned int size() const;
+  // Calls task(i, worker) for every i below count, each exactly once and
+  // worker telling whose thread it runs on, and returns once all are done.
+  // Not reentrant: a task must not run() on the same pool.
+  void run(unsigned int count, unsigned int grain,
+           const std::function<void(unsigned int, unsigned int)>& task);
+
+  // items workers took from others during the last run(), for statistics
+  unsigned int steals;
+
+private:
+  WorkerPool(const WorkerPool&);
+  WorkerPool& operator=(const WorkerPool&);
+
+  // the items a worker has left, on a cache line of its own
+  struct alignas(64) Share {
+    std::mutex lock;
+    unsigned int begin;
+    unsigned int end;
+  };
+
+  void loop(unsigned int worker);
+  void work(unsigned int worker);
+  bool take(unsigned int worker, unsigned int& first, unsigned int& last);
+  bool steal(unsigned int worker);
+
+  unsigned int threadCount;
+  std::unique_ptr<Share[]> shares;
+  std::vector<std::thread> threads;
+
+  // the run() in progress, handed to the threads under mutex
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable done;
+  unsigned int generation;
+  unsigned int busy;
+  bool stopping;
+  const std::function<void(unsigned int, unsigned int)> *task;
+  unsigned int grain;
+  std::atomic<unsigned int> stolen;
+};
+
+#endif // WORKERS_H
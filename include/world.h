@@ -0,0 +1,221 @@
+#ifndef WORLD_H
+#define WORLD_H
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "adjacency.h"
+#include "broadphase.h"
+#include "bvh.h"
+#include "collision.h"
+#include "grid.h"
+#include "kernels.h"
+#include "model.h"
+#include "octree.h"
+#include "qbvh.h"
+#include "trianglestore.h"
+
+// edits of the world remembered for changedSince() to begin with, and
+// the most it grows to, powers of two
+#define WORLD_CHANGE_HISTORY 64
+#define WORLD_CHANGE_HISTORY_MAX 65536
+
+// Which structure a world uses to find the triangles near a sweep. The BVH
+// is fastest for static levels, the loose octree handles frequent edits and
+// the grid suits flat, sprawling maps.
+enum BroadphaseType {
+  BROADPHASE_BVH,
+  BROADPHASE_OCTREE,
+  BROADPHASE_GRID,
+  // BVH packed into four wide, 16-bit quantized nodes for querying
+  BROADPHASE_QUANTIZED
+};
+
+// A run of triangles added together, e.g. the triangles of a prop.
+struct TriangleRange {
+  unsigned int first;
+  unsigned int count;
+  bool alive;
+};
+
+// Bottom level of the instance hierarchy: one model's triangles in model
+// space with a BVH over them, shared by every instance of the model.
+class CollisionMesh {
+public:
+  CollisionMesh(const Model& model, const std::string& cacheDirectory = "");
+
+  // three model space vertices per triangle
+  std::vector<vec3> triangles;
+  MeshAdjacency adjacency;
+  BVH bvh;
+  BVHRebuilder rebuilder;
+};
+
+// A placement of a CollisionMesh in the world.
+struct CollisionInstance {
+  unsigned int mesh;
+  mat4 transform;
+  mat4 inverse;
+  // a negative determinant flips the winding of every triangle
+  bool mirrored;
+  bool alive;
+};
+
+// A triangle of an instance's mesh found by queryInstances()
+struct InstanceCandidate {
+  unsigned int instance;
+  unsigned int triangle;
+};
+
+// Collision geometry gathered from the loaded models, plus any triangle
+// sets added at runtime and instanced meshes. Built once so entities don't
+// have to walk every mesh of every model per check.
+class CollisionWorld {
+public:
+  // With a cacheDirectory the BVH over the models is saved there after the
+  // first build and mapped straight from disk on later runs.
+  CollisionWorld(const std::vector<Model>& models,
+                 BroadphaseType type = BROADPHASE_BVH,
+                 const std::string& cacheDirectory = "");
+  // a world without static geometry, e.g. one made of instances only
+  CollisionWorld(BroadphaseType type = BROADPHASE_BVH,
+                 const std::string& cacheDirectory = "");
+
+  // switches broadphase, building the new one over the current triangles
+  void setBroadphase(BroadphaseType type);
+  // cell size used by BROADPHASE_GRID, rebuilds the grid if it is in use
+  void setGridCellSize(float size);
+
+  // adds three world space vertices per triangle and returns a handle
+  // to remove them with later
+  unsigned int addTriangles(const std::vector<vec3>& vertices);
+  void removeTriangles(unsigned int set);
+  // Moves the vertices of a set, e.g. a door or an elevator. The BVH is
+  // refitted rather than rebuilt, see update().
+  void moveTriangles(unsigned int set, const std::vector<vec3>& vertices);
+
+  // Instances place a shared mesh with a world matrix. Triangles are never
+  // transformed up front, queries move the sweep into the instance's space
+  // instead. Moving an instance refits the instance tree in O(log n).
+  unsigned int addMesh(const Model& model);
+  unsigned int addInstance(unsigned int mesh, const mat4& transform);
+  void setInstanceTransform(unsigned int instance, const mat4& transform);
+  void removeInstance(unsigned int instance);
+  // new model space vertices for an animated mesh, three per triangle as
+  // in CollisionMesh::triangles; refits the mesh tree and its instances
+  // and refolds the adjacency of the triangles that moved
+  void updateMesh(unsigned int mesh, const std::vector<vec3>& vertices);
+
+  // Swaps in any tree rebuilt in the background after refits degraded it
+  // too far. Call once per frame, before the entities move.
+  void update();
+
+  // Every edit above, triangle sets and instances alike, is numbered and
+  // remembered by the box around where the geometry was and is now, so a
+  // character that stopped sweeping can tell whether anything moved near
+  // it. changeCount() is the number of edits so far.
+  unsigned int changeCount() const;
+  // Whether an edit numbered since or later may have touched box, true as
+  // well if more were made since than are remembered. Every edit since
+  // the update() before last is, the history grows to hold them, so one
+  // that asks once a tick never has to assume the worst.
+  bool changedSince(unsigned int since, const AABB& box) const;
+
+  // appends every instance triangle that may touch an ellipsoid of the given
+  // radius moving from start to end, all in R3
+  void queryInstances(const vec3& start, const vec3& end, const vec3& radius,
+                      std::vector<InstanceCandidate>& result) const;
+  // world space vertices of an instance triangle, wound like the original
+  void instanceTriangle(const InstanceCandidate& candidate, vec3 vertices[3]) const;
+
+  // Broadphase on its own: the candidates for the sweep of an e-space
+  // packet (basePoint, velocity and eRadius), world triangles and instances
+  // alike, as spans into the caller's buffer. Nothing is allocated.
+  // Returns the number of spans found, only the first capacity are
+  // written. Spans stay valid until the world changes.
+  unsigned int querySpans(const CollisionPacket& packet, TriangleSpan *spans,
+                          unsigned int capacity) const;
+  // the same for every triangle that may overlap an R3 box
+  unsigned int querySpans(const AABB& box, TriangleSpan *spans,
+                          unsigned int capacity) const;
+  // R3 vertices of the i-th triangle of a span
+  void spanTriangle(const TriangleSpan& span, unsigned int i, vec3 vertices[3]) const;
+  // the same for every triangle of a span, three vertices each
+  void spanTriangles(const TriangleSpan& span, vec3 *vertices) const;
+  // the TriangleStore features of every triangle of a span, matching the
+  // winding spanTriangles() gives
+  void spanFeatures(const TriangleSpan& span, unsigned int *features) const;
+  // MeshAdjacency::neighbourNormals() for the i-th triangle of a span and
+  // its features as spanFeatures() gives them, with the neighbours placed
+  // and wound as spanTriangles() would
+  void spanNeighbours(const TriangleSpan& span, unsigned int i, const vec3& radius,
+                      unsigned int& features, vec3 normals[3]) const;
+  // Adds every triangle of the spans whose bounds overlap box, an R3 box,
+  // to store, scaled by 1 / radius and with its features and the normals
+  // of the neighbours they need. Spans hand out whole leaves or
+  // cells, and grid cells share triangles, so this is what keeps the
+  // narrowphase down to what the sweep may touch, each triangle once.
+  // vertices, features and indices are scratch, grown as needed.
+  void gatherSpans(const TriangleSpan *spans, unsigned int spanCount, const AABB& box,
+                   const vec3& radius, TriangleStore& store, std::vector<vec3>& vertices,
+                   std::vector<unsigned int>& features,
+                   std::vector<unsigned int>& indices) const;
+
+  // appends the index of every triangle that may touch box
+  void query(const AABB& box, std::vector<unsigned int>& result) const;
+  // appends every triangle that may touch an ellipsoid of the given radius
+  // moving from start to end, all in R3
+  void querySweep(const vec3& start, const vec3& end, const vec3& radius,
+                  std::vector<unsigned int>& result) const;
+
+  // three world space vertices per triangle, removed triangles are left
+  // in place until their slots are reused
+  std::vector<vec3> triangles;
+  // adjacency of the static triangles, those added at runtime have none
+  MeshAdjacency adjacency;
+  BroadphaseType broadphaseType;
+  BVH bvh;
+  QuantizedBVH quantized;
+  LooseOctree octree;
+  UniformGrid grid;
+
+  std::vector<std::unique_ptr<CollisionMesh> > meshes;
+  std::vector<CollisionInstance> instances;
+
+private:
+  void build();
+  void buildBVH(const std::vector<unsigned int>& live);
+  void insertRange(const TriangleRange& range);
+  void removeRange(const TriangleRange& range);
+  std::vector<unsigned int> liveTriangles() const;
+  const Broadphase& broadphase() const;
+  bool usesBVH() const;
+  unsigned int querySpans(const vec3& start, const vec3& end, const vec3& radius,
+                          TriangleSpan *spans, unsigned int capacity) const;
+  void placeInstance(unsigned int instance, const mat4& transform);
+  void updateInstanceBounds(unsigned int instance);
+  AABB rangeBounds(const TriangleRange& range) const;
+  void recordChange(const AABB& bounds);
+
+  std::string cacheDirectory;
+  unsigned int staticCount;
+  std::vector<TriangleRange> sets;
+  std::vector<TriangleRange> freeRanges;
+  BVHRebuilder rebuilder;
+
+  // world space bounds of every instance and the tree over them
+  std::vector<AABB> instanceBounds;
+  BVH instanceTree;
+
+  // the latest edits, edit n at n % changes.size()
+  std::vector<AABB> changes;
+  unsigned int changeTotal;
+  // edits before the update() before last and before the last one
+  unsigned int changesKept;
+  unsigned int changesAtUpdate;
+};
+
+#endif // WORLD_H
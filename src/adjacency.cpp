@@ -0,0 +1,329 @@
+#include "adjacency.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "trianglestore.h"
+
+MeshAdjacency::MeshAdjacency()
+{
+  vertexCount = 0;
+  edgeCount = 0;
+}
+
+static TriangleFeatures unlinked()
+{
+  TriangleFeatures features;
+  for (int k = 0; k < 3; k++) {
+    features.vertices[k] = FEATURE_NONE;
+    features.edges[k] = FEATURE_NONE;
+  }
+  // a triangle of its own tests everything, as if there was no adjacency
+  features.owned = 0x3f;
+  features.internal = 0;
+  features.paired = 0;
+  features.fan = 0;
+  return features;
+}
+
+void MeshAdjacency::resize(unsigned int count)
+{
+  triangles.resize(count, unlinked());
+  features.resize(count, FEATURES_ALL);
+  twins.resize(count * 3, FEATURE_NONE);
+}
+
+// orders corners by position, so welded ones end up side by side
+struct CornerOrder {
+  const std::vector<vec3>& points;
+
+  CornerOrder(const std::vector<vec3>& points) : points(points) {}
+
+  bool operator()(unsigned int a, unsigned int b) const
+  {
+    const vec3& p = points[a];
+    const vec3& q = points[b];
+    if (p.x != q.x)
+      return p.x < q.x;
+    if (p.y != q.y)
+      return p.y < q.y;
+    return p.z < q.z;
+  }
+};
+
+static vec3 faceNormal(const std::vector<vec3>& triangles, unsigned int t)
+{
+  vec3 n = cross(triangles[t*3+1] - triangles[t*3], triangles[t*3+2] - triangles[t*3]);
+  float area = length(n);
+  return area > 0.0f ? n / area : vec3(0.0f);
+}
+
+static unsigned int vertexAt(const std::vector<TriangleFeatures>& features, unsigned int corner)
+{
+  return features[corner / 3].vertices[corner % 3];
+}
+
+// the corner after corner c, where c's edge ends
+static unsigned int nextCorner(unsigned int c)
+{
+  return c / 3 * 3 + (c % 3 + 1) % 3;
+}
+
+// whether the edges at corners a and b run between the same vertices in
+// opposite directions
+static bool woundAgainst(const std::vector<TriangleFeatures>& features,
+                         unsigned int a, unsigned int b)
+{
+  return vertexAt(features, a) == vertexAt(features, nextCorner(b)) &&
+         vertexAt(features, nextCorner(a)) == vertexAt(features, b);
+}
+
+// Whether the edge at corner a (triangle * 3 + k) and its twin at corner
+// b meet flat or concave. The twin must run the other way.
+static bool internalEdge(const std::vector<vec3>& triangles,
+                         const std::vector<TriangleFeatures>& features,
+                         unsigned int a, unsigned int b)
+{
+  unsigned int ta = a / 3, tb = b / 3;
+  if (!woundAgainst(features, a, b))
+    return false;
+
+  vec3 na = faceNormal(triangles, ta);
+  vec3 nb = faceNormal(triangles, tb);
+  if (na == vec3(0.0f) || nb == vec3(0.0f))
+    return false;
+
+  // the far corner of b in front of a's plane folds the faces concave
+  vec3 opposite = triangles[tb * 3 + (b % 3 + 2) % 3];
+  if (dot(na, opposite - triangles[a]) > 0.0f)
+    return true;
+  return dot(na, nb) >= FEATURE_FLAT_COSINE;
+}
+
+void MeshAdjacency::build(const std::vector<vec3>& soup, unsigned int count)
+{
+  triangles.assign(count, unlinked());
+
+  // degenerate triangles test nothing, so they can't own anything
+  std::vector<bool> degenerate(count);
+  for (unsigned int t = 0; t < count; t++) {
+    degenerate[t] = faceNormal(soup, t) == vec3(0.0f);
+    triangles[t].owned = 0;
+  }
+
+  // weld corners at the same position into vertices
+  std::vector<unsigned int> corners(count * 3);
+  for (unsigned int i = 0; i < corners.size(); i++)
+    corners[i] = i;
+  std::sort(corners.begin(), corners.end(), CornerOrder(soup));
+
+  std::vector<unsigned int> welded(count * 3);
+  vertexCount = 0;
+  for (unsigned int i = 0; i < corners.size(); i++) {
+    if (i > 0 && soup[corners[i]] != soup[corners[i-1]])
+      vertexCount++;
+    welded[corners[i]] = vertexCount;
+  }
+  if (!corners.empty())
+    vertexCount++;
+
+  for (unsigned int i = 0; i < corners.size(); i++)
+    triangles[i / 3].vertices[i % 3] = welded[i];
+
+  // pair up the edges between the same two vertices; a vertex touching
+  // any edge that isn't internal, or a degenerate one, is tested
+  std::vector<std::pair<unsigned long long, unsigned int> > keys;
+  keys.reserve(count * 3);
+  std::vector<bool> tested(vertexCount, false);
+  for (unsigned int i = 0; i < corners.size(); i++) {
+    unsigned int a = welded[i];
+    unsigned int b = welded[i / 3 * 3 + (i % 3 + 1) % 3];
+    if (a == b) {
+      tested[a] = true;
+      continue;
+    }
+    unsigned long long key = (unsigned long long)MIN(a, b) << 32 | MAX(a, b);
+    keys.push_back(std::make_pair(key, i));
+  }
+  std::sort(keys.begin(), keys.end());
+
+  edgeCount = 0;
+  twins.assign(count * 3, FEATURE_NONE);
+  for (unsigned int i = 0; i < keys.size(); ) {
+    unsigned int end = i + 1;
+    while (end < keys.size() && keys[end].first == keys[i].first)
+      end++;
+
+    bool internal = false, paired = false;
+    if (end - i == 2) {
+      unsigned int a = keys[i].second, b = keys[i+1].second;
+      twins[a] = b;
+      twins[b] = a;
+      internal = internalEdge(soup, triangles, a, b);
+      paired = !degenerate[a / 3] && !degenerate[b / 3] && woundAgainst(triangles, a, b);
+    }
+    // corners come in order, a paired edge is the first one's, any other
+    // edge every user's that isn't degenerate
+    for (unsigned int j = i; j < end; j++) {
+      unsigned int corner = keys[j].second;
+      TriangleFeatures& features = triangles[corner / 3];
+      features.edges[corner % 3] = edgeCount;
+      if (internal)
+        features.internal |= 1u << (corner % 3);
+      if (paired)
+        features.paired |= 1u << (corner % 3);
+      if (!degenerate[corner / 3] && (!paired || j == i))
+        features.owned |= 1u << (corner % 3);
+    }
+    if (!internal) {
+      tested[keys[i].first >> 32] = true;
+      tested[keys[i].first & 0xffffffffu] = true;
+    }
+
+    edgeCount++;
+    i = end;
+  }
+
+  // every corner tests its vertex, but leaves it to the corner before it
+  // in its chain, the twin's across the edge leaving the vertex
+  std::vector<unsigned int> after(corners.size(), FEATURE_NONE);
+  for (unsigned int i = 0; i < corners.size(); i++) {
+    if (!tested[welded[i]])
+      triangles[i / 3].internal |= 1u << (3 + i % 3);
+    if (!degenerate[i / 3])
+      triangles[i / 3].owned |= 1u << (3 + i % 3);
+    if (triangles[i / 3].paired >> (i % 3) & 1) {
+      triangles[i / 3].fan |= 1u << (3 + i % 3);
+      after[nextCorner(twins[i])] = i;
+    }
+  }
+
+  // a chain closing on itself has no first corner, one of it has to test
+  // the vertex whatever the others face
+  std::vector<bool> chained(corners.size(), false);
+  for (unsigned int i = 0; i < corners.size(); i++) {
+    if (triangles[i / 3].fan >> (3 + i % 3) & 1)
+      continue;
+    for (unsigned int c = after[i]; c != FEATURE_NONE; c = after[c])
+      chained[c] = true;
+  }
+  for (unsigned int i = 0; i < corners.size(); i++) {
+    if (chained[i] || !(triangles[i / 3].fan >> (3 + i % 3) & 1))
+      continue;
+    triangles[i / 3].fan &= ~(1u << (3 + i % 3));
+    for (unsigned int c = after[i]; c != i; c = after[c])
+      chained[c] = true;
+  }
+
+  features.resize(count);
+  for (unsigned int t = 0; t < count; t++)
+    features[t] = storeFeatures(triangles[t]);
+}
+
+void MeshAdjacency::refold(const std::vector<vec3>& soup,
+                           const std::vector<unsigned int>& moved)
+{
+  std::vector<bool> isMoved(triangles.size(), false);
+  for (unsigned int i = 0; i < moved.size(); i++)
+    isMoved[moved[i]] = true;
+
+  // an edge folds the other way only if one of its faces moved, if both
+  // did it is looked at once; the lower corner goes first, as build()
+  // passes them
+  bool folded = false;
+  for (unsigned int i = 0; i < moved.size(); i++) {
+    for (unsigned int k = 0; k < 3; k++) {
+      unsigned int corner = moved[i] * 3 + k, twin = twins[corner];
+      if (twin == FEATURE_NONE || (twin < corner && isMoved[twin / 3]))
+        continue;
+      bool internal = internalEdge(soup, triangles, MIN(corner, twin), MAX(corner, twin));
+      if (internal == (bool)(triangles[moved[i]].internal >> k & 1))
+        continue;
+      triangles[corner / 3].internal ^= 1u << (corner % 3);
+      triangles[twin / 3].internal ^= 1u << (twin % 3);
+      features[corner / 3] = storeFeatures(triangles[corner / 3]);
+      features[twin / 3] = storeFeatures(triangles[twin / 3]);
+      folded = true;
+    }
+  }
+  if (!folded)
+    return;
+
+  // a vertex is tested if any edge at it is, whichever triangle that is on
+  std::vector<bool> tested(vertexCount, false);
+  for (unsigned int c = 0; c < triangles.size() * 3; c++) {
+    unsigned int a = vertexAt(triangles, c);
+    unsigned int b = vertexAt(triangles, c / 3 * 3 + (c % 3 + 1) % 3);
+    if (a != FEATURE_NONE && !(triangles[c / 3].internal >> (c % 3) & 1)) {
+      tested[a] = true;
+      tested[b] = true;
+    }
+  }
+  for (unsigned int t = 0; t < triangles.size(); t++) {
+    unsigned int internal = triangles[t].internal & 0x7;
+    for (int k = 0; k < 3; k++) {
+      if (triangles[t].vertices[k] != FEATURE_NONE && !tested[triangles[t].vertices[k]])
+        internal |= 1u << (3 + k);
+    }
+    if (internal != triangles[t].internal) {
+      triangles[t].internal = internal;
+      features[t] = storeFeatures(triangles[t]);
+    }
+  }
+}
+
+void MeshAdjacency::neighbourNormals(const std::vector<vec3>& soup, unsigned int t,
+                                     const vec3& radius, unsigned int& features,
+                                     vec3 normals[3]) const
+{
+  for (int k = 0; k < 3; k++) {
+    normals[k] = vec3(0.0f);
+    if (!needsNeighbour(features, k))
+      continue;
+    unsigned int n = twins[t * 3 + k] / 3 * 3;
+    normals[k] = eSpaceNormal(soup[n], soup[n+1], soup[n+2], radius);
+    if (normals[k] == vec3(0.0f))
+      features = withoutNeighbour(features, k);
+  }
+}
+
+unsigned int storeFeatures(const TriangleFeatures& features)
+{
+  unsigned int kept = features.owned & ~features.internal;
+  return features.owned << FEATURES_OUTSIDE | kept << FEATURES_SUNK |
+         (kept & features.paired) << FEATURES_BACK | features.fan << FEATURES_FAN;
+}
+
+// edges 0 and 2 of three bits swapped
+static unsigned int mirrorEdges(unsigned int bits)
+{
+  return (bits & 0x2) | (bits >> 2 & 0x1) | (bits << 2 & 0x4);
+}
+
+unsigned int mirrorFeatures(unsigned int features)
+{
+  // corners 1 and 2 swap, so do vertices 1 and 2 and edges 0 and 2
+  unsigned int mirrored = 0;
+  for (int group = 0; group < 3; group++) {
+    unsigned int g = features >> (group * 6) & 0x3f;
+    g = (g & 0x0a) | (g >> 2 & 0x01) | (g << 2 & 0x04) | (g >> 1 & 0x10) | (g << 1 & 0x20);
+    mirrored |= g << (group * 6);
+  }
+  // every edge runs the other way, a vertex left to the neighbour across
+  // the edge leaving it is left to the one across the edge reaching it
+  unsigned int fan = features >> FEATURES_FAN;
+  mirrored |= (mirrorEdges(fan >> 3 & 0x7) | mirrorEdges(fan & 0x7) << 3) << FEATURES_FAN;
+  return mirrored;
+}
+
+bool needsNeighbour(unsigned int features, int k)
+{
+  return (features >> (FEATURES_BACK + k) & 1) || (features >> (FEATURES_FAN + k) & 1) ||
+         (features >> (FEATURES_FAN + 3 + k) & 1);
+}
+
+unsigned int withoutNeighbour(unsigned int features, int k)
+{
+  return features & ~(1u << (FEATURES_BACK + k) | 1u << (FEATURES_FAN + k) |
+                      1u << (FEATURES_FAN + 3 + k));
+}
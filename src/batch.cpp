@@ -0,0 +1,121 @@
+#include "batch.h"
+
+#include <algorithm>
+
+CollisionBatch::CollisionBatch()
+{
+  groupSize = 64;
+  groupCount = 0;
+  spans.resize(64);
+}
+
+// the low 10 bits of v spread out to every third bit
+static inline unsigned int spreadBits(unsigned int v)
+{
+  v &= 0x3ff;
+  v = (v | v << 16) & 0x030000ff;
+  v = (v | v << 8) & 0x0300f00f;
+  v = (v | v << 4) & 0x030c30c3;
+  v = (v | v << 2) & 0x09249249;
+  return v;
+}
+
+// Morton code of a point on a 1024^3 grid over bounds
+static inline unsigned int mortonCode(const vec3& point, const AABB& bounds)
+{
+  unsigned int code = 0;
+  for (int a = 0; a < 3; a++) {
+    float extent = bounds.upper[a] - bounds.lower[a];
+    float f = extent > 0.0f ? (point[a] - bounds.lower[a]) / extent : 0.0f;
+    unsigned int cell = (unsigned int)MIN(MAX(f * 1024.0f, 0.0f), 1023.0f);
+    code |= spreadBits(cell) << a;
+  }
+  return code;
+}
+
+void CollisionBatch::check(const CollisionWorld& world, CollisionPacket *packets,
+                           unsigned int count)
+{
+  groupCount = 0;
+  if (count == 0)
+    return;
+
+  AABB bounds;
+  boxes.resize(count);
+  for (unsigned int i = 0; i < count; i++) {
+    const CollisionPacket& packet = packets[i];
+    vec3 start = packet.basePoint * packet.eRadius;
+    vec3 end = (packet.basePoint + packet.velocity) * packet.eRadius;
+    boxes[i] = AABB(min(start, end) - packet.eRadius, max(start, end) + packet.eRadius);
+    bounds.grow(boxes[i]);
+  }
+
+  // characters come in a handful of sizes, a linear search finds them
+  radii.clear();
+  order.resize(count);
+  for (unsigned int i = 0; i < count; i++) {
+    unsigned int radius = 0;
+    while (radius < radii.size() && radii[radius] != packets[i].eRadius)
+      radius++;
+    if (radius == radii.size())
+      radii.push_back(packets[i].eRadius);
+    order[i].first = (unsigned long long)radius << 32 | mortonCode(boxes[i].center(), bounds);
+    order[i].second = i;
+  }
+  std::sort(order.begin(), order.end());
+
+  // A group only grows by sweeps that overlap it a lot, so its candidates
+  // are mostly ones each of its packets needs anyway. Testing a packet
+  // against candidates only its neighbours need costs about as much as
+  // the query it shares.
+  for (unsigned int first = 0; first < count; ) {
+    AABB group = boxes[order[first].second];
+    float area = group.surfaceArea();
+    unsigned int last = first + 1;
+    for (; last < count && last - first < groupSize; last++) {
+      if (order[last].first >> 32 != order[first].first >> 32)
+        break;
+      const AABB& box = boxes[order[last].second];
+      AABB grown = group;
+      grown.grow(box);
+      if (grown.surfaceArea() > BATCH_GROWTH * (area + box.surfaceArea()))
+        break;
+      group = grown;
+      area += box.surfaceArea();
+    }
+
+    checkGroup(world, packets, first, last, group);
+    groupCount++;
+    first = last;
+  }
+}
+
+void CollisionBatch::checkGroup(const CollisionWorld& world, CollisionPacket *packets,
+                                unsigned int first, unsigned int last, const AABB& bounds)
+{
+  unsigned int spanCount = world.querySpans(bounds, &spans[0], spans.size());
+  if (spanCount > spans.size()) {
+    spans.resize(spanCount);
+    world.querySpans(bounds, &spans[0], spans.size());
+  }
+
+  vec3 radius = packets[order[first].second].eRadius;
+  store.clear();
+  world.gatherSpans(&spans[0], spanCount, bounds, radius, store, spanVertices, spanFeatures,
+                    spanIndices);
+
+  // e-space bounds of each sweep, to skip the candidates only others need
+  eBoxes.resize(last - first);
+  for (unsigned int i = first; i < last; i++) {
+    const CollisionPacket& packet = packets[order[i].second];
+    vec3 end = packet.basePoint + packet.velocity;
+    eBoxes[i - first] = AABB(min(packet.basePoint, end) - vec3(1.0f),
+                             max(packet.basePoint, end) + vec3(1.0f));
+  }
+
+  for (unsigned int block = 0; block < store.size(); block += BATCH_BLOCK) {
+    unsigned int blockSize = MIN(store.size() - block, (unsigned int)BATCH_BLOCK);
+    for (unsigned int i = first; i < last; i++)
+      checkTriangles(&packets[order[i].second], store, block, blockSize, eBoxes[i - first]);
+  }
+}
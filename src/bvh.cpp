@@ -0,0 +1,939 @@
+#include "bvh.h"
+
+#include "qbvh.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#include <process.h>
+#endif
+
+// nodes with more triangles than this are binned by all threads together
+#define BVH_PARALLEL_BIN_SIZE (1 << 16)
+// subtrees with more triangles than this are handed to another thread
+#define BVH_TASK_SIZE (1 << 12)
+
+struct BVHBin {
+  AABB bounds;
+  unsigned int count;
+};
+
+// Binned SAH builder. The top of the tree is binned in parallel, below that
+// whole subtrees are built on their own threads while cores are free.
+class BVHBuilder {
+public:
+  BVHBuilder(std::vector<BVHNode>& nodes, std::vector<unsigned int>& indices,
+             const std::vector<AABB>& bounds,
+             const std::vector<vec3>& centroids, unsigned int threadCount)
+    : nodes(nodes), indices(indices), bounds(bounds), centroids(centroids),
+      threadCount(threadCount), nodeCount(1), activeThreads(1) {}
+
+  void subdivide(unsigned int nodeIndex, unsigned int depth);
+
+  std::vector<BVHNode>& nodes;
+  std::vector<unsigned int>& indices;
+  const std::vector<AABB>& bounds;
+  const std::vector<vec3>& centroids;
+  unsigned int threadCount;
+  std::atomic<unsigned int> nodeCount;
+  std::atomic<unsigned int> activeThreads;
+
+private:
+  void computeBins(unsigned int first, unsigned int count,
+                   const AABB& centroidBounds, BVHBin bins[3][BVH_BIN_COUNT]);
+};
+
+static int binIndex(const vec3& centroid, const AABB& centroidBounds, int axis)
+{
+  float extent = centroidBounds.upper[axis] - centroidBounds.lower[axis];
+  int bin = (int)(BVH_BIN_COUNT * (centroid[axis] - centroidBounds.lower[axis]) / extent);
+  return MIN(bin, BVH_BIN_COUNT - 1);
+}
+
+static void binRange(const std::vector<unsigned int>& indices,
+                     const std::vector<AABB>& bounds,
+                     const std::vector<vec3>& centroids,
+                     unsigned int first, unsigned int last,
+                     const AABB& centroidBounds, BVHBin bins[3][BVH_BIN_COUNT])
+{
+  for (int axis = 0; axis < 3; axis++) {
+    for (int b = 0; b < BVH_BIN_COUNT; b++) {
+      bins[axis][b].bounds = AABB();
+      bins[axis][b].count = 0;
+    }
+    if (centroidBounds.upper[axis] <= centroidBounds.lower[axis])
+      continue;
+    for (unsigned int i = first; i < last; i++) {
+      unsigned int t = indices[i];
+      BVHBin& bin = bins[axis][binIndex(centroids[t], centroidBounds, axis)];
+      bin.bounds.grow(bounds[t]);
+      bin.count++;
+    }
+  }
+}
+
+void BVHBuilder::computeBins(unsigned int first, unsigned int count,
+                             const AABB& centroidBounds,
+                             BVHBin bins[3][BVH_BIN_COUNT])
+{
+  if (count < BVH_PARALLEL_BIN_SIZE || threadCount < 2) {
+    binRange(indices, bounds, centroids, first, first + count,
+             centroidBounds, bins);
+    return;
+  }
+
+  // every thread bins its own slice, the results are merged afterwards
+  std::vector<BVHBin> local(threadCount * 3 * BVH_BIN_COUNT);
+  std::vector<std::thread> threads;
+  unsigned int slice = (count + threadCount - 1) / threadCount;
+  for (unsigned int i = 0; i < threadCount; i++) {
+    unsigned int begin = first + MIN(i * slice, count);
+    unsigned int end = first + MIN((i + 1) * slice, count);
+    BVHBin (*threadBins)[BVH_BIN_COUNT] =
+      (BVHBin (*)[BVH_BIN_COUNT])&local[i * 3 * BVH_BIN_COUNT];
+    threads.push_back(std::thread(binRange, std::cref(indices),
+                                  std::cref(bounds), std::cref(centroids),
+                                  begin, end, std::cref(centroidBounds),
+                                  threadBins));
+  }
+  for (unsigned int i = 0; i < threads.size(); i++)
+    threads[i].join();
+
+  for (int axis = 0; axis < 3; axis++) {
+    for (int b = 0; b < BVH_BIN_COUNT; b++) {
+      bins[axis][b].bounds = AABB();
+      bins[axis][b].count = 0;
+      for (unsigned int i = 0; i < threadCount; i++) {
+        const BVHBin& bin = local[(i * 3 + axis) * BVH_BIN_COUNT + b];
+        bins[axis][b].bounds.grow(bin.bounds);
+        bins[axis][b].count += bin.count;
+      }
+    }
+  }
+}
+
+void BVHBuilder::subdivide(unsigned int nodeIndex, unsigned int depth)
+{
+  BVHNode& node = nodes[nodeIndex];
+  unsigned int first = node.left;
+  unsigned int count = node.count;
+
+  AABB nodeBounds, centroidBounds;
+  for (unsigned int i = first; i < first + count; i++) {
+    nodeBounds.grow(bounds[indices[i]]);
+    centroidBounds.grow(centroids[indices[i]]);
+  }
+  node.bounds = nodeBounds;
+
+  if (count == 1)
+    return;
+
+  BVHBin bins[3][BVH_BIN_COUNT];
+  computeBins(first, count, centroidBounds, bins);
+
+  // sweep the bins from both sides and pick the cheapest plane
+  float bestCost = FLT_MAX;
+  int bestAxis = -1, bestSplit = 0;
+  for (int axis = 0; axis < 3; axis++) {
+    if (centroidBounds.upper[axis] <= centroidBounds.lower[axis])
+      continue;
+
+    float rightArea[BVH_BIN_COUNT];
+    unsigned int rightCount[BVH_BIN_COUNT];
+    AABB box;
+    unsigned int n = 0;
+    for (int b = BVH_BIN_COUNT - 1; b > 0; b--) {
+      box.grow(bins[axis][b].bounds);
+      n += bins[axis][b].count;
+      rightArea[b] = n ? box.surfaceArea() : 0.0f;
+      rightCount[b] = n;
+    }
+
+    box = AABB();
+    n = 0;
+    for (int b = 0; b < BVH_BIN_COUNT - 1; b++) {
+      box.grow(bins[axis][b].bounds);
+      n += bins[axis][b].count;
+      if (n == 0 || rightCount[b+1] == 0)
+        continue;
+      float cost = n * box.surfaceArea() + rightCount[b+1] * rightArea[b+1];
+      if (cost < bestCost) {
+        bestCost = cost;
+        bestAxis = axis;
+        bestSplit = b;
+      }
+    }
+  }
+
+  // stop when splitting doesn't pay for the extra traversal step
+  float leafCost = BVH_TRIANGLE_COST * count * nodeBounds.surfaceArea();
+  float splitCost = BVH_TRAVERSAL_COST * nodeBounds.surfaceArea() +
+                    BVH_TRIANGLE_COST * bestCost;
+  if (count <= BVH_LEAF_SIZE && (bestAxis < 0 || splitCost >= leafCost))
+    return;
+
+  unsigned int mid;
+  if (bestAxis < 0) {
+    // every centroid is the same point, just halve the range
+    mid = first + count / 2;
+  }
+  else if (depth >= BVH_MAX_DEPTH / 2) {
+    // degenerate input, fall back to median splits to bound the depth
+    mid = first + count / 2;
+    std::nth_element(indices.begin() + first, indices.begin() + mid,
+                     indices.begin() + first + count,
+                     [&](unsigned int a, unsigned int b) {
+                       return centroids[a][bestAxis] < centroids[b][bestAxis];
+                     });
+  }
+  else {
+    mid = std::partition(indices.begin() + first,
+                         indices.begin() + first + count,
+                         [&](unsigned int t) {
+                           return binIndex(centroids[t], centroidBounds, bestAxis) <= bestSplit;
+                         }) - indices.begin();
+  }
+
+  unsigned int leftIndex = nodeCount.fetch_add(2);
+  BVHNode& leftChild = nodes[leftIndex];
+  BVHNode& rightChild = nodes[leftIndex + 1];
+  leftChild.left = first;
+  leftChild.count = mid - first;
+  rightChild.left = mid;
+  rightChild.count = first + count - mid;
+
+  node.left = leftIndex;
+  node.count = 0;
+
+  // hand the left subtree to another thread if one is free
+  if (count > BVH_TASK_SIZE && activeThreads.fetch_add(1) < threadCount) {
+    std::thread task(&BVHBuilder::subdivide, this, leftIndex, depth + 1);
+    subdivide(leftIndex + 1, depth + 1);
+    task.join();
+    activeThreads--;
+    return;
+  }
+  if (count > BVH_TASK_SIZE)
+    activeThreads--;
+
+  subdivide(leftIndex, depth + 1);
+  subdivide(leftIndex + 1, depth + 1);
+}
+
+BVH::BVH()
+{
+  nodes = NULL;
+  indices = NULL;
+  nodeCount = 0;
+  indexCount = 0;
+  mapping = NULL;
+  mappingSize = 0;
+  areaSum = -1.0f;
+}
+
+BVH::~BVH()
+{
+  clear();
+}
+
+void BVH::clear()
+{
+#ifndef _WIN32
+  if (mapping)
+    munmap(mapping, mappingSize);
+#endif
+  mapping = NULL;
+  mappingSize = 0;
+
+  nodeStorage.clear();
+  indexStorage.clear();
+  parents.clear();
+  primitiveLeaf.clear();
+  nodes = NULL;
+  indices = NULL;
+  nodeCount = 0;
+  indexCount = 0;
+  areaSum = -1.0f;
+}
+
+void BVH::build(const std::vector<vec3>& triangles, unsigned int threadCount)
+{
+  std::vector<unsigned int> triangleIndices(triangles.size() / 3);
+  for (unsigned int i = 0; i < triangleIndices.size(); i++)
+    triangleIndices[i] = i;
+  build(triangles, triangleIndices, threadCount);
+}
+
+void BVH::build(const std::vector<vec3>& triangles,
+                const std::vector<unsigned int>& triangleIndices,
+                unsigned int threadCount)
+{
+  std::vector<AABB> bounds(triangles.size() / 3);
+  for (unsigned int i = 0; i < triangleIndices.size(); i++) {
+    unsigned int t = triangleIndices[i];
+    bounds[t].grow(triangles[t*3]);
+    bounds[t].grow(triangles[t*3+1]);
+    bounds[t].grow(triangles[t*3+2]);
+  }
+  build(bounds, triangleIndices, threadCount);
+}
+
+void BVH::build(const std::vector<AABB>& bounds,
+                const std::vector<unsigned int>& primitives,
+                unsigned int threadCount)
+{
+  unsigned int primitiveCount = primitives.size();
+
+  if (threadCount == 0)
+    threadCount = MAX(std::thread::hardware_concurrency(), 1u);
+
+  clear();
+  indexStorage = primitives;
+
+  // centroids are what gets binned
+  std::vector<vec3> centroids(bounds.size());
+  for (unsigned int i = 0; i < primitiveCount; i++)
+    centroids[primitives[i]] = bounds[primitives[i]].center();
+
+  // a binary tree with leaves of at least one primitive has at most 2n-1
+  // nodes, allocate them all up front so threads can claim them atomically
+  nodeStorage.assign(MAX(2 * primitiveCount, 1u), BVHNode());
+  nodeStorage[0].left = 0;
+  nodeStorage[0].count = primitiveCount;
+
+  BVHBuilder builder(nodeStorage, indexStorage, bounds, centroids, threadCount);
+  builder.subdivide(0, 0);
+
+  nodeStorage.resize(builder.nodeCount);
+
+  nodes = &nodeStorage[0];
+  nodeCount = nodeStorage.size();
+  indices = indexStorage.empty() ? NULL : &indexStorage[0];
+  indexCount = indexStorage.size();
+}
+
+void BVH::detach()
+{
+  if (!mapping)
+    return;
+
+  // copy the mapped tree into our own storage before changing it
+  std::vector<BVHNode> mappedNodes(nodes, nodes + nodeCount);
+  std::vector<unsigned int> mappedIndices(indices, indices + indexCount);
+  clear();
+  nodeStorage.swap(mappedNodes);
+  indexStorage.swap(mappedIndices);
+
+  nodes = &nodeStorage[0];
+  nodeCount = nodeStorage.size();
+  indices = indexStorage.empty() ? NULL : &indexStorage[0];
+  indexCount = indexStorage.size();
+}
+
+// no leaf, for primitives that were left out of the build
+#define BVH_NO_LEAF 0xffffffffu
+
+void BVH::linkParents(unsigned int primitiveCount)
+{
+  // parent links and the leaf of every primitive are only needed here, so
+  // they are worked out on the first partial refit after a build
+  if (parents.size() == nodeCount)
+    return;
+
+  parents.assign(nodeCount, 0);
+  primitiveLeaf.assign(primitiveCount, BVH_NO_LEAF);
+  for (unsigned int i = 0; i < nodeCount; i++) {
+    const BVHNode& node = nodeStorage[i];
+    if (node.count > 0) {
+      for (unsigned int j = node.left; j < node.left + node.count; j++)
+        primitiveLeaf[indexStorage[j]] = i;
+    }
+    else {
+      parents[node.left] = i;
+      parents[node.left + 1] = i;
+    }
+  }
+}
+
+void BVH::setBounds(unsigned int node, const AABB& bounds)
+{
+  BVHNode& n = nodeStorage[node];
+  if (areaSum >= 0.0f)
+    areaSum += (bounds.surfaceArea() - n.bounds.surfaceArea()) * MAX(n.count, 1u);
+  n.bounds = bounds;
+}
+
+void BVH::refitLeaf(unsigned int leaf, const AABB& bounds)
+{
+  setBounds(leaf, bounds);
+
+  // the root is its own parent, and nothing above a node that came out
+  // the same can change either
+  for (unsigned int i = leaf; i != 0;) {
+    i = parents[i];
+    const BVHNode& parent = nodeStorage[i];
+    AABB box = nodeStorage[parent.left].bounds;
+    box.grow(nodeStorage[parent.left + 1].bounds);
+    if (box.lower == parent.bounds.lower && box.upper == parent.bounds.upper)
+      break;
+    setBounds(i, box);
+  }
+}
+
+void BVH::refit(const std::vector<AABB>& bounds, unsigned int primitive)
+{
+  detach();
+  linkParents(bounds.size());
+
+  unsigned int leaf = primitiveLeaf[primitive];
+  if (leaf == BVH_NO_LEAF)
+    return;
+
+  const BVHNode& node = nodeStorage[leaf];
+  AABB box;
+  for (unsigned int i = node.left; i < node.left + node.count; i++)
+    box.grow(bounds[indexStorage[i]]);
+  refitLeaf(leaf, box);
+}
+
+void BVH::refit(const std::vector<vec3>& triangles, unsigned int first, unsigned int count)
+{
+  detach();
+  linkParents(triangles.size() / 3);
+
+  for (unsigned int t = first; t < first + count; t++) {
+    unsigned int leaf = primitiveLeaf[t];
+    if (leaf == BVH_NO_LEAF)
+      continue;
+
+    const BVHNode& node = nodeStorage[leaf];
+    AABB box;
+    for (unsigned int i = node.left; i < node.left + node.count; i++) {
+      box.grow(triangles[indexStorage[i]*3]);
+      box.grow(triangles[indexStorage[i]*3+1]);
+      box.grow(triangles[indexStorage[i]*3+2]);
+    }
+    refitLeaf(leaf, box);
+  }
+}
+
+void BVH::refit(const std::vector<vec3>& triangles)
+{
+  if (indexCount == 0)
+    return;
+  detach();
+
+  // children always come after their parent, so walking the nodes
+  // backwards visits both children before the node itself
+  for (unsigned int i = nodeCount; i-- > 0;) {
+    BVHNode& node = nodeStorage[i];
+    if (node.count > 0) {
+      node.bounds = AABB();
+      for (unsigned int j = node.left; j < node.left + node.count; j++) {
+        unsigned int t = indexStorage[j] * 3;
+        node.bounds.grow(triangles[t]);
+        node.bounds.grow(triangles[t+1]);
+        node.bounds.grow(triangles[t+2]);
+      }
+    }
+    else {
+      node.bounds = nodeStorage[node.left].bounds;
+      node.bounds.grow(nodeStorage[node.left + 1].bounds);
+    }
+  }
+  areaSum = -1.0f;
+}
+
+void BVH::swap(BVH& other)
+{
+  std::swap(nodes, other.nodes);
+  std::swap(indices, other.indices);
+  std::swap(nodeCount, other.nodeCount);
+  std::swap(indexCount, other.indexCount);
+  nodeStorage.swap(other.nodeStorage);
+  indexStorage.swap(other.indexStorage);
+  parents.swap(other.parents);
+  primitiveLeaf.swap(other.primitiveLeaf);
+  std::swap(mapping, other.mapping);
+  std::swap(mappingSize, other.mappingSize);
+  std::swap(areaSum, other.areaSum);
+}
+
+namespace {
+struct AppendVisitor {
+  std::vector<unsigned int>& result;
+  void operator()(unsigned int primitive) { result.push_back(primitive); }
+};
+
+
+struct SpanVisitor {
+  TriangleSpan *spans;
+  unsigned int capacity;
+  unsigned int spanCount;
+  void operator()(const unsigned int *first, unsigned int count)
+  {
+    addSpan(spans, capacity, spanCount, first, count);
+  }
+};
+}
+
+void BVH::query(const AABB& box, std::vector<unsigned int>& result) const
+{
+  AppendVisitor visitor = { result };
+  visit(box, visitor);
+}
+
+unsigned int BVH::querySpans(const vec3& start, const vec3& end, const vec3& radius,
+                             TriangleSpan *spans, unsigned int capacity) const
+{
+  SpanVisitor visitor = { spans, capacity, 0 };
+  visitLeaves(AABB(min(start, end) - radius, max(start, end) + radius), visitor);
+  return visitor.spanCount;
+}
+
+BVHStats BVH::stats() const
+{
+  BVHStats stats;
+  stats.sahCost = 0.0f;
+  stats.nodeCount = nodeCount;
+  stats.leafCount = 0;
+  stats.maxDepth = 0;
+  stats.maxLeafSize = 0;
+  stats.averageLeafSize = 0.0f;
+
+  if (indexCount == 0 || nodes[0].bounds.surfaceArea() <= 0.0f)
+    return stats;
+
+  float rootArea = nodes[0].bounds.surfaceArea();
+  unsigned int leafTriangles = 0;
+
+  // depth first walk, keeping the depth next to the node index
+  std::vector<unsigned int> stack;
+  stack.push_back(0);
+  stack.push_back(0);
+  while (!stack.empty()) {
+    unsigned int depth = stack.back(); stack.pop_back();
+    const BVHNode& node = nodes[stack.back()]; stack.pop_back();
+
+    float area = node.bounds.surfaceArea() / rootArea;
+    stats.maxDepth = MAX(stats.maxDepth, depth);
+    if (node.count > 0) {
+      stats.sahCost += area * node.count * BVH_TRIANGLE_COST;
+      stats.leafCount++;
+      stats.maxLeafSize = MAX(stats.maxLeafSize, node.count);
+      leafTriangles += node.count;
+    }
+    else {
+      stats.sahCost += area * BVH_TRAVERSAL_COST;
+      stack.push_back(node.left);
+      stack.push_back(depth + 1);
+      stack.push_back(node.left + 1);
+      stack.push_back(depth + 1);
+    }
+  }
+
+  if (stats.leafCount > 0)
+    stats.averageLeafSize = (float)leafTriangles / stats.leafCount;
+  return stats;
+}
+
+float BVH::sahCost()
+{
+  if (indexCount == 0 || nodes[0].bounds.surfaceArea() <= 0.0f)
+    return 0.0f;
+
+  if (areaSum < 0.0f) {
+    areaSum = 0.0f;
+    for (unsigned int i = 0; i < nodeCount; i++)
+      areaSum += nodes[i].bounds.surfaceArea() * (nodes[i].count > 0 ?
+                 nodes[i].count * BVH_TRIANGLE_COST : BVH_TRAVERSAL_COST);
+  }
+  return areaSum / nodes[0].bounds.surfaceArea();
+}
+
+BVHRebuilder::BVHRebuilder()
+{
+  buildCost = 0.0f;
+  cost = 0.0f;
+  finished = false;
+  running = false;
+  stale = false;
+  quantize = false;
+  movedAll = false;
+  packed.reset(new QuantizedBVH());
+}
+
+BVHRebuilder::~BVHRebuilder()
+{
+  if (thread.joinable())
+    thread.join();
+}
+
+void BVHRebuilder::reset(BVH& bvh, bool quantize)
+{
+  cancel();
+  buildCost = bvh.sahCost();
+  cost = buildCost;
+  this->quantize = quantize;
+  // the tree's indices changed, the next edit takes a new copy; a running
+  // rebuild keeps the old one until it is done
+  snapshot.reset();
+}
+
+void BVHRebuilder::update(BVH& bvh, const std::vector<vec3>& triangles)
+{
+  bvh.refit(triangles);
+  keep(bvh, triangles, 0, triangles.size() / 3);
+  check(bvh);
+}
+
+void BVHRebuilder::update(BVH& bvh, const std::vector<vec3>& triangles,
+                          unsigned int first, unsigned int count)
+{
+  bvh.refit(triangles, first, count);
+  keep(bvh, triangles, first, count);
+  check(bvh);
+}
+
+// Brings the copy up to date with triangles first to first + count - 1,
+// or notes them for poll() if the running rebuild reads the copy.
+void BVHRebuilder::keep(const BVH& bvh, const std::vector<vec3>& triangles,
+                        unsigned int first, unsigned int count)
+{
+  if (!snapshot) {
+    snapshot = std::make_shared<BVHSnapshot>();
+    snapshot->triangles = triangles;
+    snapshot->indices.assign(bvh.indices, bvh.indices + bvh.indexCount);
+    return;
+  }
+
+  if (snapshot != building) {
+    std::copy(triangles.begin() + first * 3, triangles.begin() + (first + count) * 3,
+              snapshot->triangles.begin() + first * 3);
+    return;
+  }
+
+  // the same set moved every tick is only noted once
+  if (movedAll)
+    return;
+  std::pair<unsigned int, unsigned int> range(first, count);
+  if (std::find(moved.begin(), moved.end(), range) != moved.end())
+    return;
+  moved.push_back(range);
+  if (moved.size() > BVH_REBUILD_RANGES || count == triangles.size() / 3) {
+    moved.clear();
+    movedAll = true;
+  }
+}
+
+void BVHRebuilder::check(BVH& bvh)
+{
+  cost = bvh.sahCost();
+
+  if (running || buildCost <= 0.0f || cost <= buildCost * BVH_REBUILD_RATIO)
+    return;
+
+  // the thread reads the copy, edits from now on go around it
+  building = snapshot;
+  moved.clear();
+  movedAll = false;
+  finished = false;
+  running = true;
+  stale = false;
+  thread = std::thread(&BVHRebuilder::run, this);
+}
+
+void BVHRebuilder::run()
+{
+  // one thread only, the frame keeps going on the others
+  result.build(building->triangles, building->indices, 1);
+  // a refit of nothing links up the parents, and working out the cost
+  // keeps it up to date through the refits poll() does, so the caller
+  // does neither on a whole tree
+  result.refit(building->triangles, 0, 0);
+  result.sahCost();
+  if (quantize) {
+    packed->build(result);
+    packed->refit(result, 0, 0);
+  }
+  finished = true;
+}
+
+bool BVHRebuilder::poll(BVH& bvh, const std::vector<vec3>& triangles, QuantizedBVH *quantized)
+{
+  if (!running || !finished)
+    return false;
+
+  thread.join();
+  running = false;
+
+  // catch up with whatever moved since the thread started, in the copy
+  // as well as the new tree unless that is being dropped
+  bool current = snapshot == building;
+  bool keepResult = current && !stale;
+  building.reset();
+  if (current && movedAll)
+    snapshot->triangles = triangles;
+  if (keepResult && movedAll) {
+    result.refit(triangles);
+    if (quantize)
+      packed->refit(result, 0, triangles.size() / 3);
+  }
+  for (unsigned int i = 0; current && i < moved.size(); i++) {
+    unsigned int first = moved[i].first, count = moved[i].second;
+    std::copy(triangles.begin() + first * 3, triangles.begin() + (first + count) * 3,
+              snapshot->triangles.begin() + first * 3);
+    if (keepResult) {
+      result.refit(triangles, first, count);
+      if (quantize)
+        packed->refit(result, first, count);
+    }
+  }
+  moved.clear();
+  movedAll = false;
+  if (!keepResult) {
+    result.clear();
+    packed->clear();
+    return false;
+  }
+
+  bvh.swap(result);
+  result.clear();
+  if (quantize && quantized)
+    quantized->swap(*packed);
+  packed->clear();
+  buildCost = bvh.sahCost();
+  cost = buildCost;
+  return true;
+}
+
+void BVHRebuilder::cancel()
+{
+  if (running)
+    stale = true;
+}
+
+// Cached trees are the header followed by the nodes and the leaf ordered
+// triangle indices, laid out exactly as they are used in memory.
+struct BVHCacheHeader {
+  char magic[4];
+  unsigned int version;
+  unsigned long long key;
+  unsigned int nodeSize;
+  unsigned int nodeCount;
+  unsigned int indexCount;
+  unsigned int reserved;
+};
+
+bool BVH::save(const std::string& path, unsigned long long key) const
+{
+  BVHCacheHeader header;
+  memcpy(header.magic, "BVHC", 4);
+  header.version = BVH_CACHE_VERSION;
+  header.key = key;
+  header.nodeSize = sizeof(BVHNode);
+  header.nodeCount = nodeCount;
+  header.indexCount = indexCount;
+  header.reserved = 0;
+
+  // write to a temporary file and rename it, so a process starting at the
+  // same time never maps a half written tree. the name is unique to this
+  // writer so two processes saving the same tree don't share it
+#ifndef _WIN32
+  std::string temporary = path + ".XXXXXX";
+  int descriptor = mkstemp(&temporary[0]);
+  if (descriptor < 0)
+    return false;
+  // mkstemp creates it private, a cache is readable like any data file
+  fchmod(descriptor, 0644);
+  FILE *file = fdopen(descriptor, "wb");
+  if (!file) {
+    close(descriptor);
+    remove(temporary.c_str());
+    return false;
+  }
+#else
+  std::string temporary = path + "." + std::to_string(_getpid()) + ".tmp";
+  FILE *file = fopen(temporary.c_str(), "wb");
+  if (!file)
+    return false;
+#endif
+
+  bool written =
+    fwrite(&header, sizeof(header), 1, file) == 1 &&
+    fwrite(nodes, sizeof(BVHNode), nodeCount, file) == nodeCount &&
+    fwrite(indices, sizeof(unsigned int), indexCount, file) == indexCount;
+  written = fclose(file) == 0 && written;
+
+  if (!written || rename(temporary.c_str(), path.c_str()) != 0) {
+    remove(temporary.c_str());
+    return false;
+  }
+  return true;
+}
+
+static bool validHeader(const BVHCacheHeader& header, unsigned long long key,
+                        size_t fileSize)
+{
+  return memcmp(header.magic, "BVHC", 4) == 0 &&
+         header.version == BVH_CACHE_VERSION &&
+         header.key == key &&
+         header.nodeSize == sizeof(BVHNode) &&
+         header.nodeCount > 0 &&
+         fileSize == sizeof(BVHCacheHeader) +
+                     (size_t)header.nodeCount * sizeof(BVHNode) +
+                     (size_t)header.indexCount * sizeof(unsigned int);
+}
+
+// Every node of a loaded tree is checked before it is used, a body that
+// was cut short or scribbled over would otherwise send traversal outside
+// the mapping. Children always come after their parent, so one pass in
+// order finds every node's depth, and each node has a single parent.
+bool BVH::wellFormed(unsigned int triangleCount) const
+{
+  std::vector<unsigned char> depth(nodeCount, 0);
+  std::vector<bool> reached(nodeCount, false);
+  reached[0] = true;
+  for (unsigned int i = 0; i < nodeCount; i++) {
+    const BVHNode& node = nodes[i];
+    if (!reached[i])
+      continue;
+    if (node.count > 0) {
+      if (node.count > BVH_LEAF_SIZE || node.left > indexCount ||
+          node.count > indexCount - node.left)
+        return false;
+      continue;
+    }
+    // traversal keeps a sibling per level on its stack, and both children
+    if (node.left <= i || node.left >= nodeCount - 1 || depth[i] + 2 > BVH_MAX_DEPTH ||
+        reached[node.left] || reached[node.left + 1])
+      return false;
+    for (unsigned int c = node.left; c < node.left + 2; c++) {
+      reached[c] = true;
+      depth[c] = depth[i] + 1;
+    }
+  }
+
+  for (unsigned int i = 0; i < indexCount; i++) {
+    if (indices[i] >= triangleCount)
+      return false;
+  }
+  return true;
+}
+
+bool BVH::load(const std::string& path, unsigned long long key, unsigned int triangleCount)
+{
+#ifndef _WIN32
+  int file = open(path.c_str(), O_RDONLY);
+  if (file < 0)
+    return false;
+
+  struct stat info;
+  if (fstat(file, &info) != 0 || (size_t)info.st_size < sizeof(BVHCacheHeader)) {
+    close(file);
+    return false;
+  }
+
+  size_t size = info.st_size;
+  void *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, file, 0);
+  close(file);
+  if (data == MAP_FAILED)
+    return false;
+
+  const BVHCacheHeader *header = (const BVHCacheHeader*)data;
+  if (!validHeader(*header, key, size)) {
+    munmap(data, size);
+    return false;
+  }
+
+  clear();
+  mapping = data;
+  mappingSize = size;
+
+  // no parsing, the tree is used straight from the mapped pages
+  const char *body = (const char*)data + sizeof(BVHCacheHeader);
+  nodes = (const BVHNode*)body;
+  nodeCount = header->nodeCount;
+  indices = (const unsigned int*)(body + nodeCount * sizeof(BVHNode));
+  indexCount = header->indexCount;
+  if (!wellFormed(triangleCount)) {
+    clear();
+    return false;
+  }
+  return true;
+#else
+  // no mmap here, read the file into the BVH's own storage instead
+  FILE *file = fopen(path.c_str(), "rb");
+  if (!file)
+    return false;
+
+  BVHCacheHeader header;
+  fseek(file, 0, SEEK_END);
+  size_t size = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  if (fread(&header, sizeof(header), 1, file) != 1 || !validHeader(header, key, size)) {
+    fclose(file);
+    return false;
+  }
+
+  clear();
+  nodeStorage.resize(header.nodeCount);
+  indexStorage.resize(header.indexCount);
+  bool read =
+    fread(&nodeStorage[0], sizeof(BVHNode), header.nodeCount, file) == header.nodeCount &&
+    fread(indexStorage.data(), sizeof(unsigned int), header.indexCount, file) == header.indexCount;
+  fclose(file);
+  if (!read) {
+    clear();
+    return false;
+  }
+
+  nodes = &nodeStorage[0];
+  nodeCount = nodeStorage.size();
+  indices = indexStorage.data();
+  indexCount = indexStorage.size();
+  if (!wellFormed(triangleCount)) {
+    clear();
+    return false;
+  }
+  return true;
+#endif
+}
+
+// 64 bit FNV-1a, fed a 32 bit word at a time
+static unsigned long long hashWords(unsigned long long hash, const void *data, size_t size)
+{
+  const unsigned int *words = (const unsigned int*)data;
+  for (size_t i = 0; i < size / 4; i++) {
+    hash ^= words[i];
+    hash *= 0x100000001b3ull;
+  }
+  return hash;
+}
+
+unsigned long long hashBVHInput(const std::vector<vec3>& triangles,
+                                const std::vector<unsigned int>& triangleIndices)
+{
+  unsigned int settings[] = {
+    BVH_CACHE_VERSION, BVH_LEAF_SIZE, BVH_BIN_COUNT, BVH_MAX_DEPTH,
+    (unsigned int)sizeof(BVHNode),
+    (unsigned int)triangles.size(), (unsigned int)triangleIndices.size()
+  };
+
+  unsigned long long hash = 0xcbf29ce484222325ull;
+  hash = hashWords(hash, settings, sizeof(settings));
+  if (!triangles.empty())
+    hash = hashWords(hash, &triangles[0], triangles.size() * sizeof(vec3));
+  if (!triangleIndices.empty())
+    hash = hashWords(hash, &triangleIndices[0], triangleIndices.size() * sizeof(unsigned int));
+  return hash;
+}
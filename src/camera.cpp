@@ -29,19 +29,21 @@ mat4 Camera::GetViewMatrix()
 }
 
 // Processes input received from any keyboard-like input system. Accepts input parameter in the form of camera defined ENUM (to abstract it from windowing systems)
-void Camera::ProcessKeyboard(Camera_Movement direction, float deltaTime)
+vec3 Camera::ProcessKeyboard(Camera_Movement direction, float deltaTime)
 {
   float speed = MovementSpeed * deltaTime;
+  vec3 push(0.0f);
   if (direction == FORWARD)
-      entity->velocity += Front * speed;
+      push += Front * speed;
   if (direction == BACKWARD)
-      entity->velocity -= Front * speed;
+      push -= Front * speed;
   if (direction == LEFT)
-      entity->velocity -= Right * speed;
+      push -= Right * speed;
   if (direction == RIGHT)
-      entity->velocity += Right * speed;
+      push += Right * speed;
   // TO DO fix gravity
   //e->_velocity[1] = 0.0f;
+  return push;
 }
 
 // Processes input received from a mouse input system. Expects the offset value in both the x and y direction.
@@ -1,5 +1,7 @@
 #include "collision.h"
 
+#include "determinism.h"
+
 Plane::Plane(const vec3& origin, const vec3& normal)
 {
   this->origin = origin;
@@ -13,8 +15,7 @@ Plane::Plane(const vec3& origin, const vec3& normal)
 // Construct from triangle:
 Plane::Plane(const vec3& p1, const vec3& p2, const vec3& p3)
 {
-  normal = cross(p2 - p1, p3 - p1);
-  normalize(normal);
+  normal = normalize(cross(p2 - p1, p3 - p1));
 
   origin = p1;
 
@@ -34,6 +35,73 @@ bool Plane::isFrontFacingTo(const vec3& direction) const
 	return (d <= 0);
 }
 
+// An empty box is inverted so that the first grow() sets both corners
+AABB::AABB()
+{
+  lower = vec3(FLT_MAX);
+  upper = vec3(-FLT_MAX);
+}
+
+AABB::AABB(const vec3& lower, const vec3& upper)
+{
+  this->lower = lower;
+  this->upper = upper;
+}
+
+void AABB::grow(const vec3& point)
+{
+  lower = min(lower, point);
+  upper = max(upper, point);
+}
+
+void AABB::grow(const AABB& box)
+{
+  lower = min(lower, box.lower);
+  upper = max(upper, box.upper);
+}
+
+bool AABB::overlaps(const AABB& box) const
+{
+  return lower[0] <= box.upper[0] && upper[0] >= box.lower[0] &&
+         lower[1] <= box.upper[1] && upper[1] >= box.lower[1] &&
+         lower[2] <= box.upper[2] && upper[2] >= box.lower[2];
+}
+
+bool AABB::contains(const AABB& box) const
+{
+  return lower[0] <= box.lower[0] && upper[0] >= box.upper[0] &&
+         lower[1] <= box.lower[1] && upper[1] >= box.upper[1] &&
+         lower[2] <= box.lower[2] && upper[2] >= box.upper[2];
+}
+
+vec3 AABB::center() const
+{
+  return (lower + upper) * 0.5f;
+}
+
+float AABB::surfaceArea() const
+{
+  // empty boxes, e.g. of removed primitives, add nothing
+  if (lower[0] > upper[0] || lower[1] > upper[1] || lower[2] > upper[2])
+    return 0.0f;
+  vec3 e = upper - lower;
+  return 2.0f * (e[0] * e[1] + e[1] * e[2] + e[2] * e[0]);
+}
+
+AABB AABB::transformed(const mat4& m) const
+{
+  AABB box;
+  if (lower[0] > upper[0])
+    return box;
+  for (int i = 0; i < 8; i++) {
+    vec3 corner((i & 1) ? upper[0] : lower[0],
+                (i & 2) ? upper[1] : lower[1],
+                (i & 4) ? upper[2] : lower[2]);
+    box.grow(vec3(m * vec4(corner, 1.0f)));
+  }
+  return box;
+}
+
 bool checkPointInTriangle(const vec3& point,
                           const vec3& p1, const vec3& p2, const vec3& p3)
 {
@@ -334,3 +402,137 @@ void checkTriangle(CollisionPacket* colPackage,
 		}
 	} // if not backface
 }
+
+template <class Shape>
+void checkEllipsoid(CollisionPacket* colPackage,
+                    const vec3& center, const vec3& radius)
+{
+  // Two axis aligned ellipsoids touch when the moving center enters the
+  // ellipsoid with both radii added, exactly so when one is a scaled copy
+  // of the other. Scaled by those radii that is a point against the unit
+  // sphere.
+  vec3 eRadius = colPackage->eRadius;
+  vec3 scale = Shape::spaceScale(eRadius);
+  vec3 combined = eRadius + radius;
+  vec3 base = colPackage->basePoint * scale / combined;
+  vec3 velocity = colPackage->velocity * scale / combined;
+  vec3 offset = base - center / combined;
+
+  float a = dot(velocity, velocity);
+  float b = 2.0f * dot(velocity, offset);
+  float c = dot(offset, offset) - 1.0f;
+  if (a == 0.0f)
+    return;
+
+  float t;
+  if (c < 0.0f) {
+    // already touching, only stop moves further in
+    if (b >= 0.0f)
+      return;
+    t = 0.0f;
+  }
+  else if (!getLowestRoot(a, b, c, 1.0f, &t)) {
+    return;
+  }
+
+  // the surface normal of the combined ellipsoid at the contact, taken
+  // into the packet's space where the slide plane is worked out
+  vec3 normal = normalize((offset + t * velocity) / combined * scale);
+  vec3 contact = colPackage->basePoint + t * colPackage->velocity -
+                 normal * Shape::sweepRadius(eRadius);
+
+  float distToCollision = t * length(colPackage->velocity);
+  if (colPackage->foundCollision == false ||
+      distToCollision < colPackage->nearestDistance) {
+    colPackage->nearestDistance = distToCollision;
+    colPackage->intersectionPoint = contact;
+    colPackage->foundCollision = true;
+  }
+}
+
+template <class Shape>
+void checkCapsule(CollisionPacket* colPackage, const vec3& center, float radius,
+                  float halfHeight)
+{
+  // As in checkEllipsoid, scaled by the radii added the capsule is one of
+  // radius 1 around a vertical segment, and the moving center a point.
+  vec3 eRadius = colPackage->eRadius;
+  vec3 scale = Shape::spaceScale(eRadius);
+  vec3 combined = eRadius + vec3(radius);
+  vec3 base = colPackage->basePoint * scale / combined;
+  vec3 velocity = colPackage->velocity * scale / combined;
+  vec3 offset = base - center / combined;
+  // from the center to either cap's center
+  float half = MAX(halfHeight - radius, 0.0f) / combined[1];
+
+  float a = dot(velocity, velocity);
+  if (a == 0.0f)
+    return;
+
+  float t = 1.0f;
+  vec3 away = offset - vec3(0.0f, MIN(MAX(offset[1], -half), half), 0.0f);
+  if (dot(away, away) < 1.0f) {
+    // already touching, only stop moves further in
+    if (dot(velocity, away) >= 0.0f)
+      return;
+    t = 0.0f;
+  }
+  else {
+    // the side, reached from outside its cylinder between the caps
+    bool found = false;
+    float sideA = velocity[0] * velocity[0] + velocity[2] * velocity[2];
+    float sideB = 2.0f * (velocity[0] * offset[0] + velocity[2] * offset[2]);
+    float sideC = offset[0] * offset[0] + offset[2] * offset[2] - 1.0f;
+    float newT;
+    if (sideA > 0.0f && sideC > 0.0f && getLowestRoot(sideA, sideB, sideC, t, &newT) &&
+        fabsf(offset[1] + newT * velocity[1]) <= half) {
+      t = newT;
+      found = true;
+    }
+    // then the caps, spheres around the ends
+    for (int end = 0; end < 2; end++) {
+      vec3 toCap = offset - vec3(0.0f, end ? half : -half, 0.0f);
+      float b = 2.0f * dot(velocity, toCap);
+      float c = dot(toCap, toCap) - 1.0f;
+      if (c >= 0.0f && getLowestRoot(a, b, c, t, &newT)) {
+        t = newT;
+        found = true;
+      }
+    }
+    if (!found)
+      return;
+    vec3 at = offset + t * velocity;
+    away = at - vec3(0.0f, MIN(MAX(at[1], -half), half), 0.0f);
+  }
+
+  // the normal at the contact, taken into the packet's space where the
+  // slide plane is worked out
+  vec3 normal = normalize(away / combined * scale);
+  vec3 contact = colPackage->basePoint + t * colPackage->velocity -
+                 normal * Shape::sweepRadius(eRadius);
+
+  float distToCollision = t * length(colPackage->velocity);
+  if (colPackage->foundCollision == false ||
+      distToCollision < colPackage->nearestDistance) {
+    colPackage->nearestDistance = distToCollision;
+    colPackage->intersectionPoint = contact;
+    colPackage->foundCollision = true;
+  }
+}
+
+template void checkEllipsoid<EllipsoidShape>(CollisionPacket* colPackage,
+                                             const vec3& center, const vec3& radius);
+template void checkEllipsoid<SphereShape>(CollisionPacket* colPackage,
+                                          const vec3& center, const vec3& radius);
+template void checkEllipsoid<CapsuleShape>(CollisionPacket* colPackage,
+                                           const vec3& center, const vec3& radius);
+template void checkEllipsoid<BoxShape>(CollisionPacket* colPackage,
+                                       const vec3& center, const vec3& radius);
+template void checkCapsule<EllipsoidShape>(CollisionPacket* colPackage, const vec3& center,
+                                           float radius, float halfHeight);
+template void checkCapsule<SphereShape>(CollisionPacket* colPackage, const vec3& center,
+                                        float radius, float halfHeight);
+template void checkCapsule<CapsuleShape>(CollisionPacket* colPackage, const vec3& center,
+                                         float radius, float halfHeight);
+template void checkCapsule<BoxShape>(CollisionPacket* colPackage, const vec3& center,
+                                     float radius, float halfHeight);
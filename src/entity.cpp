@@ -1,165 +1,489 @@
 #include "entity.h"
 
-CharacterEntity::CharacterEntity(std::vector<Model> models, vec3 radius)
+#include "determinism.h"
+
+CharacterEntity::CharacterEntity(CollisionWorld *world, vec3 radius, CharacterShape shape)
 {
   this->radius = radius;
+  this->shape = shape;
   position = vec3(0.0f);
+  previousPosition = position;
   velocity = vec3(0.0f);
+  orientation = mat3(1.0f);
 
-  this->models = models;
+  this->world = world;
+  spans.resize(64);
+  proxy = 0;
   grounded = 0;
+  iterations = 0;
+
+  canSleep = true;
+  asleep = false;
+  stillTicks = 0;
+  restVelocity = velocity;
+  seenChanges = 0;
+}
+
+bool CharacterEntity::isSphere() const
+{
+  return radius[0] == radius[1] && radius[1] == radius[2];
+}
+
+vec3 CharacterEntity::halfExtents() const
+{
+  CollisionPacket packet;
+  packet.eRadius = radius;
+  packet.orientation = orientation;
+  if (shape == SHAPE_BOX)
+    return BoxShape::bounds(packet);
+  if (shape == SHAPE_CAPSULE)
+    return CapsuleShape::bounds(packet);
+  return radius;
+}
+
+vec3 CharacterEntity::interpolatedPosition(float alpha) const
+{
+  return previousPosition + (position - previousPosition) * alpha;
+}
+
+void CharacterEntity::teleport(const vec3& position)
+{
+  this->position = position;
+  previousPosition = position;
+  wake();
+}
+
+bool CharacterEntity::disturbed()
+{
+  if (position != previousPosition)
+    return true;
+  // pushing it down onto what held it up all along changes nothing
+  float size = MIN(MIN(radius[0], radius[1]), radius[2]);
+  vec3 push = velocity - restVelocity;
+  if (length(vec3(push[0], 0.0f, push[2])) > WAKE_SPEED * size ||
+      velocity[1] > WAKE_SPEED * size)
+    return true;
+
+  // what it stands on or leans against is just outside its box
+  vec3 reach = halfExtents() * 1.25f + vec3(length(velocity));
+  if (world->changedSince(seenChanges, AABB(position - reach, position + reach)))
+    return true;
+  seenChanges = world->changeCount();
+  return false;
+}
+
+void CharacterEntity::wake()
+{
+  asleep = false;
+  stillTicks = 0;
+}
+
+// counts the updates it barely moved in and puts it to sleep after enough
+void CharacterEntity::settle()
+{
+  float size = MIN(MIN(radius[0], radius[1]), radius[2]);
+  if (!canSleep || length(position - previousPosition) >= SLEEP_SPEED * size) {
+    stillTicks = 0;
+    return;
+  }
+  // and only once it stands on something, a character pushed down onto
+  // the ground by gravity every other tick is grounded every other tick
+  stillTicks = MIN(stillTicks + 1, (unsigned int)SLEEP_TICKS);
+  if (stillTicks < SLEEP_TICKS || !grounded)
+    return;
+
+  asleep = true;
+  restVelocity = velocity;
+  seenChanges = world->changeCount();
+  // it stays exactly here from now on
+  previousPosition = position;
+}
+
+// the twelve triangles of a box character's faces, wound outwards, scaled
+// by 1 / scale
+static void addBoxFaces(TriangleStore& store, const NearbyCharacter& box, const vec3& scale)
+{
+  for (int a = 0; a < 3; a++) {
+    vec3 u = box.orientation[(a + 1) % 3] * box.radius[(a + 1) % 3];
+    vec3 v = box.orientation[(a + 2) % 3] * box.radius[(a + 2) % 3];
+    for (int side = -1; side <= 1; side += 2) {
+      vec3 outward = box.orientation[a] * (box.radius[a] * side);
+      vec3 center = box.position + outward;
+      vec3 q[4] = { center - u - v, center + u - v, center + u + v, center - u + v };
+      if (dot(cross(u, v), outward) < 0.0f) {
+        vec3 swap = q[1];
+        q[1] = q[3];
+        q[3] = swap;
+      }
+      store.add(q[0], q[1], q[2], scale);
+      store.add(q[0], q[2], q[3], scale);
+    }
+  }
+}
+
+// the narrowphase of each shape
+static inline void sweepTriangles(EllipsoidShape, CollisionPacket* colPackage,
+                                  const TriangleStore& store, const AABB& box)
+{
+  checkTriangles(colPackage, store, 0, store.size(), box);
+}
+
+static inline void sweepTriangles(SphereShape, CollisionPacket* colPackage,
+                                  const TriangleStore& store, const AABB& box)
+{
+  checkSphereTriangles(colPackage, store, 0, store.size(), box);
+}
+
+static inline void sweepTriangles(CapsuleShape, CollisionPacket* colPackage,
+                                  const TriangleStore& store, const AABB& box)
+{
+  checkCapsuleTriangles(colPackage, store, 0, store.size(), box);
 }
 
-void CharacterEntity::collideAndSlide(const vec3& gravity)
+static inline void sweepTriangles(BoxShape, CollisionPacket* colPackage,
+                                  const TriangleStore& store, const AABB& box)
+{
+  checkBoxTriangles(colPackage, store, 0, store.size(), box);
+}
+
+template <class Shape>
+unsigned int CharacterEntity::collideAndSlide(const vec3& gravity)
 {
   // Do collision detection:
-	collisionPackage.R3Position = position;
-	collisionPackage.R3Velocity = velocity;
-  collisionPackage.eRadius = radius;
+  CollisionPacket packet;
+	packet.R3Position = position;
+	packet.R3Velocity = velocity;
+  packet.eRadius = radius;
+  packet.orientation = orientation;
+  // eRadius for e-space, nothing to convert for a sphere
+  vec3 scale = Shape::spaceScale(radius);
 
 	// calculate position and velocity in eSpace
-	vec3 eSpacePosition = collisionPackage.R3Position/
-	collisionPackage.eRadius;
-	vec3 velocity = collisionPackage.R3Velocity/
-	collisionPackage.eRadius;
+	vec3 eSpacePosition = packet.R3Position/
+	scale;
+	vec3 velocity = packet.R3Velocity/
+	scale;
 	// no gravity
     velocity[1] = 0.0f;
 
-	// Iterate until we have our final position.
-	collisionPackage.collisionRecursionDepth = 0;
+	// every slide stays within reach of the start, so gather the
+	// triangles for the whole motion, gravity included, just once
+	vec3 reach = vec3(length(velocity) + length(gravity / scale)) +
+	             Shape::bounds(packet);
+	gatherCandidates<Shape>(AABB(eSpacePosition - reach, eSpacePosition + reach));
 
-	int g = grounded;
-	vec3 finalPosition;
-	finalPosition = collideWithWorld(eSpacePosition, velocity);
-	grounded = g;
+	// Iterate until we have our final position.
+	SlideResult move = collideWithWorld<Shape>(packet, eSpacePosition, velocity);
 
 	// Add gravity pull:
 	// To remove gravity uncomment from here .....
 
 	// Set the new R3 position (convert back from eSpace to R3)
-	collisionPackage.R3Position = finalPosition * collisionPackage.eRadius;
-	collisionPackage.R3Velocity = gravity;
+	packet.R3Position = move.position * scale;
+	packet.R3Velocity = gravity;
 
     // convert velocity to e-space
-	velocity = gravity / collisionPackage.eRadius;
+	velocity = gravity / scale;
 
 	// gravity iteration
-	collisionPackage.collisionRecursionDepth = 0;
-	finalPosition = collideWithWorld(finalPosition, velocity);
+	SlideResult fall = collideWithWorld<Shape>(packet, move.position, velocity);
+	// only the gravity pass says whether we stand on something
+	grounded = fall.grounded;
 
 	// ... to here
 
 	// finally set entity position
-	position = finalPosition * collisionPackage.eRadius;
+	position = fall.position * scale;
+	return move.iterations + fall.iterations;
 }
 
-vec3 CharacterEntity::collideWithWorld(const vec3& pos, const vec3& vel)
+template <class Shape>
+SlideResult CharacterEntity::collideWithWorld(CollisionPacket& packet, const vec3& start,
+                                              const vec3& startVelocity)
 {
 	// All hard-coded distances in this function is
 	// scaled to fit the setting above..
 	float unitScale = unitsPerMeter / 100.0f;
-	float veryCloseDistance = 0.0000005f * unitScale;
-
-	// do we need to worry?
-	if (collisionPackage.collisionRecursionDepth > 5)
-		return pos;
-
-	// Ok, we need to worry:
-	collisionPackage.velocity = vel;
-    collisionPackage.normalizedVelocity = normalize(vel);
-	collisionPackage.basePoint = pos;
-	collisionPackage.foundCollision = false;
-    collisionPackage.nearestDistance = FLT_MAX;
-
-	// Check for collision (calls the collision routines)
-	// Application specific!!
-    checkCollision();
-
-	// If no collision we just move along the velocity
-	if (collisionPackage.foundCollision == false) {
-	  return pos + vel;
+	// and to the sphere being swept, the unit sphere in e-space, so a
+	// sphere slides in R3 just like it would in e-space
+	float radius = Shape::sweepRadius(packet.eRadius);
+	float veryCloseDistance = 0.0000005f * unitScale * radius;
+	vec3 scale = Shape::spaceScale(packet.eRadius);
+
+	SlideResult result;
+	result.position = start;
+	result.iterations = 0;
+	result.grounded = false;
+
+	vec3 pos = start, vel = startVelocity;
+	// every slide is one sweep, as many as the budget allows
+	while (result.iterations < budget.iterations) {
+		result.iterations++;
+
+		// Ok, we need to worry:
+		packet.velocity = vel;
+		packet.normalizedVelocity = normalize(vel);
+		packet.basePoint = pos;
+		packet.foundCollision = false;
+		packet.nearestDistance = FLT_MAX;
+
+		// Check for collision (calls the collision routines)
+		// Application specific!!
+		checkCollision<Shape>(packet);
+
+		// If no collision we just move along the velocity
+		if (packet.foundCollision == false) {
+		  result.position = pos + vel;
+		  return result;
+		}
+
+		// *** Collision occured ***
+
+		// The original destination point
+		vec3 destinationPoint = pos + vel;
+		vec3 newBasePoint = pos;
+		// only update if we are not already very close
+		// and if so we only move very close to intersection..not
+		// to the exact spot.
+		if (packet.nearestDistance >= veryCloseDistance)
+		{
+			vec3 v = (float)MIN(length(vel),  packet.nearestDistance - veryCloseDistance) / radius * vel;
+			newBasePoint = packet.basePoint + v;
+
+			// Adjust polygon intersection point (so sliding
+			// Plane will be unaffected by the fact that we
+			// move slightly less than collision tells us)
+			normalize(v);
+			packet.intersectionPoint -=
+							  veryCloseDistance * v;
+		}
+
+		// Determine the sliding Plane
+		vec3 slidePlaneOrigin =
+				packet.intersectionPoint;
+		vec3 slidePlaneNormal =
+				(newBasePoint-packet.intersectionPoint) / radius;
+		normalize(slidePlaneNormal);
+
+		Plane slidingPlane(slidePlaneOrigin, slidePlaneNormal);
+
+		// Again, sorry about formatting.. but look carefully ;)
+		vec3 newDestinationPoint = destinationPoint -
+		(float)slidingPlane.signedDistanceTo(destinationPoint)*
+		slidePlaneNormal;
+
+		// Generate the slide vectpr, which will become our new
+		// velocity vector for the next iteration
+		vec3 newVelocityVector = newDestinationPoint -
+							packet.intersectionPoint;
+
+		if (packet.intersectionPoint[1] <= pos[1]-Shape::groundDepth(packet.eRadius)+0.1f*radius && vel[1] <= 0.0f)
+			result.grounded = true;
+
+		result.position = newBasePoint;
+
+		// dont slide on if the new velocity is very small, or if less
+		// is left than the budget bothers with
+		if (length(newVelocityVector) < veryCloseDistance ||
+		    length(newVelocityVector * scale) < budget.minDistance) {
+			return result;
+		}
+
+		pos = newBasePoint;
+		vel = newVelocityVector;
 	}
 
-	// *** Collision occured ***
-
-	// The original destination point
-	vec3 destinationPoint = pos + vel;
-	vec3 newBasePoint = pos;
-	// only update if we are not already very close
-	// and if so we only move very close to intersection..not
-	// to the exact spot.
-	if (collisionPackage.nearestDistance >= veryCloseDistance)
-	{
-		vec3 v = (float)MIN(length(vel),  collisionPackage.nearestDistance - veryCloseDistance) * vel;
-		newBasePoint = collisionPackage.basePoint + v;
-
-		// Adjust polygon intersection point (so sliding
-		// Plane will be unaffected by the fact that we
-		// move slightly less than collision tells us)
-		normalize(v);
-		collisionPackage.intersectionPoint -=
-						  veryCloseDistance * v;
-	}
+	return result;
+}
 
-	// Determine the sliding Plane
-	vec3 slidePlaneOrigin =
-			collisionPackage.intersectionPoint;
-	vec3 slidePlaneNormal =
-			newBasePoint-collisionPackage.intersectionPoint;
-	normalize(slidePlaneNormal);
+template <class Shape>
+void CharacterEntity::gatherCandidates(const AABB& box)
+{
+  vec3 scale = Shape::spaceScale(radius);
+  AABB r3Box(box.lower * scale, box.upper * scale);
 
-	Plane slidingPlane(slidePlaneOrigin, slidePlaneNormal);
+  unsigned int spanCount = world->querySpans(r3Box, &spans[0], spans.size());
+  if (spanCount > spans.size()) {
+    spans.resize(spanCount);
+    world->querySpans(r3Box, &spans[0], spans.size());
+  }
 
-	// Again, sorry about formatting.. but look carefully ;)
-	vec3 newDestinationPoint = destinationPoint -
-	(float)slidingPlane.signedDistanceTo(destinationPoint)*
-	slidePlaneNormal;
+  // convert to e-space once, the slides only read these
+  eTriangles.clear();
+  world->gatherSpans(&spans[0], spanCount, r3Box, scale, eTriangles, spanVertices,
+                     spanFeatures, spanIndices);
+  for (unsigned int i = 0; i < nearby.size(); i++) {
+    if (nearby[i].shape == SHAPE_BOX)
+      addBoxFaces(eTriangles, nearby[i], scale);
+  }
+  gathered = box;
+}
 
-	// Generate the slide vectpr, which will become our new
-	// velocity vector for the next iteration
-	vec3 newVelocityVector = newDestinationPoint -
-						collisionPackage.intersectionPoint;
+template <class Shape>
+void CharacterEntity::checkCollision(CollisionPacket& packet)
+{
+  vec3 start = packet.basePoint;
+  vec3 end = start + packet.velocity;
+  vec3 reach = Shape::bounds(packet);
+  AABB sweep(min(start, end) - reach, max(start, end) + reach);
+
+  // a slide can only leave the gathered box through a degenerate sliding
+  // plane, gather again to stay correct
+  if (!gathered.contains(sweep)) {
+    AABB box = gathered;
+    box.grow(sweep);
+    gatherCandidates<Shape>(box);
+  }
 
-	if (collisionPackage.intersectionPoint[1] <= pos[1]-collisionPackage.eRadius[1]+0.1f && vel[1] <= 0.0f)
-		grounded = 1;
+  sweepTriangles(Shape(), &packet, eTriangles, sweep);
 
-	// Recurse:
+  for (unsigned int i = 0; i < nearby.size(); i++) {
+    const NearbyCharacter& other = nearby[i];
+    if (other.shape == SHAPE_CAPSULE)
+      checkCapsule<Shape>(&packet, other.position, other.radius[0], other.radius[1]);
+    else if (other.shape == SHAPE_ELLIPSOID)
+      checkEllipsoid<Shape>(&packet, other.position, other.radius);
+  }
+}
 
-	// dont recurse if the new velocity is very small
-	if (length(newVelocityVector) < veryCloseDistance) {
+void CharacterEntity::update()
+{
+#ifdef COLLISION_DETERMINISTIC
+  FloatEnvironment floats;
+#endif
+  if (asleep) {
+    if (!disturbed()) {
+      iterations = 0;
+      return;
+    }
+    wake();
+  }
 
-		return newBasePoint;
-	}
+  previousPosition = position;
+  vec3 gravity = {0.0f, this->velocity[1], 0.0f};
+  if (shape == SHAPE_CAPSULE)
+    iterations = collideAndSlide<CapsuleShape>(gravity);
+  else if (shape == SHAPE_BOX)
+    iterations = collideAndSlide<BoxShape>(gravity);
+  else if (isSphere())
+    iterations = collideAndSlide<SphereShape>(gravity);
+  else
+    iterations = collideAndSlide<EllipsoidShape>(gravity);
+  settle();
+}
 
-    collisionPackage.collisionRecursionDepth++;
+template unsigned int CharacterEntity::collideAndSlide<EllipsoidShape>(const vec3& gravity);
+template unsigned int CharacterEntity::collideAndSlide<SphereShape>(const vec3& gravity);
+template unsigned int CharacterEntity::collideAndSlide<CapsuleShape>(const vec3& gravity);
+template unsigned int CharacterEntity::collideAndSlide<BoxShape>(const vec3& gravity);
 
-    return collideWithWorld(newBasePoint, newVelocityVector);
+void CharacterGroup::add(CharacterEntity *entity)
+{
+  entity->proxy = sweepAndPrune.add(motionBounds(*entity));
+  if (entity->proxy >= owners.size())
+    owners.resize(entity->proxy + 1);
+  owners[entity->proxy] = entity;
+  entities.push_back(entity);
 }
 
-void CharacterEntity::checkCollision()
+void CharacterGroup::remove(CharacterEntity *entity)
 {
-  // check collision against triangles
-  // **!CHEAP TESTING METHOD PLS REPLACE WITH OCTREE!** //
-
-  for (unsigned int i = 0; i < models.size(); i++){
-    Model model = models.at(i);
-    for (unsigned int j = 0; j < model.meshes.size(); j++) {
-      Mesh mesh = model.meshes.at(j);
-      for (unsigned int i=0; i<mesh.vertices.size();) {
-        vec3 a, b, c;
-        a = mesh.vertices.at(i++).Position / collisionPackage.eRadius;
-        b = mesh.vertices.at(i++).Position / collisionPackage.eRadius;
-        c = mesh.vertices.at(i++).Position / collisionPackage.eRadius;
-        checkTriangle(&collisionPackage, a, b, c);
-      }
+  for (unsigned int i = 0; i < entities.size(); i++) {
+    if (entities[i] == entity) {
+      sweepAndPrune.remove(entity->proxy);
+      owners[entity->proxy] = NULL;
+      entities.erase(entities.begin() + i);
+      entity->nearby.clear();
+      entity->wake();
+      return;
     }
   }
-  // **!CHEAP TESTING METHOD PLS REPLACE WITH OCTREE!** //
 }
 
-void CharacterEntity::update()
+// everywhere the character can get to this tick: the horizontal move and
+// the gravity pass together, padded by its radius
+AABB CharacterGroup::motionBounds(const CharacterEntity& entity) const
 {
-  this->grounded = 0;
-  vec3 gravity = {0.0f, this->velocity[1], 0.0f};
-  collideAndSlide(gravity);
+  const vec3& v = entity.velocity;
+  vec3 reach = entity.halfExtents() + vec3(length(vec3(v[0], 0.0f, v[2])) + fabsf(v[1]));
+  return AABB(entity.position - reach, entity.position + reach);
+}
+
+// Whether an awake character may move out from under or into a sleeper
+// this tick: it has to be going sideways or up fast enough to wake a
+// sleeper itself, and its box swept along its velocity has to reach the
+// sleeper's, with room for the gap left to what that leans against. One
+// standing still next to a sleeper, or pushed down by gravity, doesn't.
+bool CharacterGroup::disturbs(const CharacterEntity& mover, const CharacterEntity& sleeper) const
+{
+  const vec3& v = mover.velocity;
+  float size = MIN(MIN(mover.radius[0], mover.radius[1]), mover.radius[2]);
+  if (length(vec3(v[0], 0.0f, v[2])) <= WAKE_SPEED * size && v[1] <= WAKE_SPEED * size)
+    return false;
+
+  vec3 half = mover.halfExtents(), end = mover.position + v;
+  AABB swept(min(mover.position, end) - half, max(mover.position, end) + half);
+  const vec3& r = sleeper.radius;
+  vec3 reach = sleeper.halfExtents() + vec3(WAKE_SPEED * MIN(MIN(r[0], r[1]), r[2]));
+  return swept.overlaps(AABB(sleeper.position - reach, sleeper.position + reach));
+}
+
+void CharacterGroup::update(WorkerPool *pool)
+{
+#ifdef COLLISION_DETERMINISTIC
+  FloatEnvironment floats;
+#endif
+  // a sleeper's bounds stay what they were when it fell asleep
+  for (unsigned int i = 0; i < entities.size(); i++) {
+    CharacterEntity *entity = entities[i];
+    if (entity->asleep && entity->disturbed())
+      entity->wake();
+    if (!entity->asleep)
+      sweepAndPrune.update(entity->proxy, motionBounds(*entity));
+  }
+  sweepAndPrune.sort();
+
+  pairs.clear();
+  sweepAndPrune.pairs(pairs);
+  // woken after looking at every pair, so a sleeper woken here only wakes
+  // its own sleeping neighbours next tick, if it still touches them then
+  moving.clear();
+  for (unsigned int i = 0; i < pairs.size(); i++) {
+    CharacterEntity *a = owners[pairs[i].first];
+    CharacterEntity *b = owners[pairs[i].second];
+    if (a->asleep == b->asleep)
+      continue;
+    if (disturbs(*(a->asleep ? b : a), *(a->asleep ? a : b)))
+      moving.push_back(a->asleep ? a : b);
+  }
+  for (unsigned int i = 0; i < moving.size(); i++)
+    moving[i]->wake();
+
+  moving.clear();
+  for (unsigned int i = 0; i < entities.size(); i++) {
+    entities[i]->nearby.clear();
+    if (!entities[i]->asleep)
+      moving.push_back(entities[i]);
+    else
+      entities[i]->iterations = 0;
+  }
+  for (unsigned int i = 0; i < pairs.size(); i++) {
+    CharacterEntity *a = owners[pairs[i].first];
+    CharacterEntity *b = owners[pairs[i].second];
+    NearbyCharacter nearA = { a->position, a->radius, a->shape, a->orientation };
+    NearbyCharacter nearB = { b->position, b->radius, b->shape, b->orientation };
+    if (!a->asleep)
+      a->nearby.push_back(nearB);
+    if (!b->asleep)
+      b->nearby.push_back(nearA);
+  }
+
+  if (!pool) {
+    for (unsigned int i = 0; i < moving.size(); i++)
+      moving[i]->update();
+    return;
+  }
+  pool->run(moving.size(), CHARACTER_GRAIN, [this](unsigned int i, unsigned int) {
+    moving[i]->update();
+  });
 }
@@ -0,0 +1,220 @@
+#include "grid.h"
+
+#include <algorithm>
+
+// cell coordinates are packed into 21 bits each around this offset
+#define GRID_COORD_OFFSET (1 << 20)
+#define GRID_COORD_MASK ((1ull << 21) - 1)
+
+UniformGrid::UniformGrid(float cellSize)
+{
+  this->cellSize = cellSize;
+}
+
+void UniformGrid::clear(float cellSize)
+{
+  this->cellSize = cellSize;
+  cells.clear();
+  bounds.clear();
+}
+
+UniformGrid::CellKey UniformGrid::key(int x, int y, int z) const
+{
+  return ((CellKey)(x + GRID_COORD_OFFSET) & GRID_COORD_MASK) |
+         (((CellKey)(y + GRID_COORD_OFFSET) & GRID_COORD_MASK) << 21) |
+         (((CellKey)(z + GRID_COORD_OFFSET) & GRID_COORD_MASK) << 42);
+}
+
+void UniformGrid::cellOf(const vec3& point, int cell[3]) const
+{
+  for (int i = 0; i < 3; i++)
+    cell[i] = (int)floorf(point[i] / cellSize);
+}
+
+void UniformGrid::insert(const std::vector<vec3>& triangles, unsigned int triangle)
+{
+  if (bounds.size() <= triangle)
+    bounds.resize(triangle + 1);
+
+  AABB box;
+  box.grow(triangles[triangle*3]);
+  box.grow(triangles[triangle*3+1]);
+  box.grow(triangles[triangle*3+2]);
+  bounds[triangle] = box;
+
+  // every cell the triangle's bounds overlap lists the triangle
+  int lower[3], upper[3];
+  cellOf(box.lower, lower);
+  cellOf(box.upper, upper);
+  for (int z = lower[2]; z <= upper[2]; z++)
+    for (int y = lower[1]; y <= upper[1]; y++)
+      for (int x = lower[0]; x <= upper[0]; x++)
+        cells[key(x, y, z)].push_back(triangle);
+}
+
+void UniformGrid::remove(unsigned int triangle)
+{
+  if (triangle >= bounds.size() || bounds[triangle].lower[0] > bounds[triangle].upper[0])
+    return;
+
+  int lower[3], upper[3];
+  cellOf(bounds[triangle].lower, lower);
+  cellOf(bounds[triangle].upper, upper);
+  for (int z = lower[2]; z <= upper[2]; z++) {
+    for (int y = lower[1]; y <= upper[1]; y++) {
+      for (int x = lower[0]; x <= upper[0]; x++) {
+        std::unordered_map<CellKey, std::vector<unsigned int> >::iterator cell =
+          cells.find(key(x, y, z));
+        if (cell == cells.end())
+          continue;
+        std::vector<unsigned int>& list = cell->second;
+        list.erase(std::remove(list.begin(), list.end(), triangle), list.end());
+        if (list.empty())
+          cells.erase(cell);
+      }
+    }
+  }
+  bounds[triangle] = AABB();
+}
+
+void UniformGrid::gatherCell(int x, int y, int z, const AABB& box,
+                             std::vector<unsigned int>& result) const
+{
+  std::unordered_map<CellKey, std::vector<unsigned int> >::const_iterator cell =
+    cells.find(key(x, y, z));
+  if (cell == cells.end())
+    return;
+
+  const std::vector<unsigned int>& list = cell->second;
+  for (unsigned int i = 0; i < list.size(); i++) {
+    if (bounds[list[i]].overlaps(box))
+      result.push_back(list[i]);
+  }
+}
+
+// Triangles spanning several cells are found once per cell, so sort the
+// triangles this query added and drop the repeats.
+static void removeDuplicates(std::vector<unsigned int>& result, unsigned int first)
+{
+  std::sort(result.begin() + first, result.end());
+  result.erase(std::unique(result.begin() + first, result.end()), result.end());
+}
+
+void UniformGrid::query(const AABB& box, std::vector<unsigned int>& result) const
+{
+  unsigned int first = result.size();
+
+  int lower[3], upper[3];
+  cellOf(box.lower, lower);
+  cellOf(box.upper, upper);
+  for (int z = lower[2]; z <= upper[2]; z++)
+    for (int y = lower[1]; y <= upper[1]; y++)
+      for (int x = lower[0]; x <= upper[0]; x++)
+        gatherCell(x, y, z, box, result);
+
+  removeDuplicates(result, first);
+}
+
+template <class Visitor>
+void UniformGrid::walkSweep(const vec3& start, const vec3& end, const vec3& radius,
+                            Visitor& visitor) const
+{
+  AABB box(min(start, end) - radius, max(start, end) + radius);
+
+  // cells within reach of the ellipsoid around each cell the center visits,
+  // one extra so a center right on a cell boundary is covered too
+  int reach[3];
+  for (int i = 0; i < 3; i++)
+    reach[i] = (int)floorf(radius[i] / cellSize) + 1;
+
+  int cell[3], last[3], step[3];
+  float tMax[3], tDelta[3];
+  cellOf(start, cell);
+  cellOf(end, last);
+
+  vec3 direction = end - start;
+  for (int i = 0; i < 3; i++) {
+    if (direction[i] > 0.0f) {
+      step[i] = 1;
+      tDelta[i] = cellSize / direction[i];
+      tMax[i] = ((cell[i] + 1) * cellSize - start[i]) / direction[i];
+    }
+    else if (direction[i] < 0.0f) {
+      step[i] = -1;
+      tDelta[i] = -cellSize / direction[i];
+      tMax[i] = (cell[i] * cellSize - start[i]) / direction[i];
+    }
+    else {
+      step[i] = 0;
+      tDelta[i] = FLT_MAX;
+      tMax[i] = FLT_MAX;
+    }
+  }
+
+  // never look outside the cells of the sweep's bounds
+  int boxLower[3], boxUpper[3];
+  cellOf(box.lower, boxLower);
+  cellOf(box.upper, boxUpper);
+
+  // one step per cell boundary crossed, bounded in case of rounding
+  int steps = abs(last[0] - cell[0]) + abs(last[1] - cell[1]) + abs(last[2] - cell[2]);
+  int previous[3][2] = {};
+  for (int s = 0; s <= steps; s++) {
+    int range[3][2];
+    for (int i = 0; i < 3; i++) {
+      range[i][0] = MAX(cell[i] - reach[i], boxLower[i]);
+      range[i][1] = MIN(cell[i] + reach[i], boxUpper[i]);
+    }
+
+    // consecutive neighbourhoods overlap, only gather the new cells
+    for (int z = range[2][0]; z <= range[2][1]; z++) {
+      for (int y = range[1][0]; y <= range[1][1]; y++) {
+        for (int x = range[0][0]; x <= range[0][1]; x++) {
+          if (s > 0 &&
+              x >= previous[0][0] && x <= previous[0][1] &&
+              y >= previous[1][0] && y <= previous[1][1] &&
+              z >= previous[2][0] && z <= previous[2][1])
+            continue;
+          visitor(x, y, z);
+        }
+      }
+    }
+    for (int i = 0; i < 3; i++) {
+      previous[i][0] = range[i][0];
+      previous[i][1] = range[i][1];
+    }
+
+    // advance across the nearest cell boundary
+    int axis = 0;
+    if (tMax[1] < tMax[axis]) axis = 1;
+    if (tMax[2] < tMax[axis]) axis = 2;
+    if (tMax[axis] > 1.0f)
+      break;
+    cell[axis] += step[axis];
+    tMax[axis] += tDelta[axis];
+  }
+}
+
+void UniformGrid::querySweep(const vec3& start, const vec3& end, const vec3& radius,
+                             std::vector<unsigned int>& result) const
+{
+  unsigned int first = result.size();
+  AABB box(min(start, end) - radius, max(start, end) + radius);
+  auto gather = [&](int x, int y, int z) { gatherCell(x, y, z, box, result); };
+  walkSweep(start, end, radius, gather);
+  removeDuplicates(result, first);
+}
+
+unsigned int UniformGrid::querySpans(const vec3& start, const vec3& end, const vec3& radius,
+                                     TriangleSpan *spans, unsigned int capacity) const
+{
+  unsigned int spanCount = 0;
+  auto span = [&](int x, int y, int z) {
+    std::unordered_map<CellKey, std::vector<unsigned int> >::const_iterator cell =
+      cells.find(key(x, y, z));
+    if (cell != cells.end() && !cell->second.empty())
+      addSpan(spans, capacity, spanCount, &cell->second[0], cell->second.size());
+  };
+  walkSweep(start, end, radius, span);
+  return spanCount;
+}
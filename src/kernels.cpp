@@ -0,0 +1,247 @@
+#include "kernels.h"
+
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+
+#include "qbvh.h"
+#include "trianglestore.h"
+
+using std::cout;
+using std::endl;
+
+// Every version adds in the order glm's mat4 * vec4 does, with w = 1,
+// so they all match instance.transform * vec4(p, 1.0f) bit for bit.
+static void transformPointsGeneric(const mat4& m, const vec3 *in, vec3 *out, unsigned int count)
+{
+  for (unsigned int i = 0; i < count; i++) {
+    vec3 p = in[i];
+    for (int a = 0; a < 3; a++)
+      out[i][a] = (m[0][a] * p.x + m[1][a] * p.y) + (m[2][a] * p.z + m[3][a]);
+  }
+}
+
+#ifdef COLLISION_X86
+#include <immintrin.h>
+
+__attribute__((target("sse4.2")))
+static void transformPointsSSE42(const mat4& m, const vec3 *in, vec3 *out, unsigned int count)
+{
+  __m128 column0 = _mm_loadu_ps(&m[0][0]);
+  __m128 column1 = _mm_loadu_ps(&m[1][0]);
+  __m128 column2 = _mm_loadu_ps(&m[2][0]);
+  __m128 column3 = _mm_loadu_ps(&m[3][0]);
+
+  for (unsigned int i = 0; i < count; i++) {
+    __m128 p = _mm_add_ps(
+      _mm_add_ps(_mm_mul_ps(column0, _mm_set1_ps(in[i].x)),
+                 _mm_mul_ps(column1, _mm_set1_ps(in[i].y))),
+      _mm_add_ps(_mm_mul_ps(column2, _mm_set1_ps(in[i].z)), column3));
+    _mm_storel_pi((__m64 *)&out[i].x, p);
+    _mm_store_ss(&out[i].z, _mm_movehl_ps(p, p));
+  }
+}
+
+// Eight points per step. The 24 floats are loaded as they lie and split
+// into x, y and z by shuffles, then interleaved back the same way.
+__attribute__((target("avx2")))
+static void transformPointsAVX2(const mat4& m, const vec3 *in, vec3 *out, unsigned int count)
+{
+  unsigned int i = 0;
+
+  for (; i + 8 <= count; i += 8) {
+    const float *source = &in[i].x;
+    // points 0 and 4, 1 and 5, 2 and 6, 3 and 7 side by side
+    __m256 m03 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(source)),
+                                      _mm_loadu_ps(source + 12), 1);
+    __m256 m14 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(source + 4)),
+                                      _mm_loadu_ps(source + 16), 1);
+    __m256 m25 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(source + 8)),
+                                      _mm_loadu_ps(source + 20), 1);
+    __m256 xy = _mm256_shuffle_ps(m14, m25, _MM_SHUFFLE(2, 1, 3, 2));
+    __m256 yz = _mm256_shuffle_ps(m03, m14, _MM_SHUFFLE(1, 0, 2, 1));
+    __m256 x = _mm256_shuffle_ps(m03, xy, _MM_SHUFFLE(2, 0, 3, 0));
+    __m256 y = _mm256_shuffle_ps(yz, xy, _MM_SHUFFLE(3, 1, 2, 0));
+    __m256 z = _mm256_shuffle_ps(yz, m25, _MM_SHUFFLE(3, 0, 3, 1));
+
+    __m256 p[3];
+    for (int a = 0; a < 3; a++) {
+      p[a] = _mm256_add_ps(
+        _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(m[0][a]), x),
+                      _mm256_mul_ps(_mm256_set1_ps(m[1][a]), y)),
+        _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(m[2][a]), z),
+                      _mm256_set1_ps(m[3][a])));
+    }
+
+    __m256 rxy = _mm256_shuffle_ps(p[0], p[1], _MM_SHUFFLE(2, 0, 2, 0));
+    __m256 ryz = _mm256_shuffle_ps(p[1], p[2], _MM_SHUFFLE(3, 1, 3, 1));
+    __m256 rzx = _mm256_shuffle_ps(p[2], p[0], _MM_SHUFFLE(3, 1, 2, 0));
+    __m256 r03 = _mm256_shuffle_ps(rxy, rzx, _MM_SHUFFLE(2, 0, 2, 0));
+    __m256 r14 = _mm256_shuffle_ps(ryz, rxy, _MM_SHUFFLE(3, 1, 2, 0));
+    __m256 r25 = _mm256_shuffle_ps(rzx, ryz, _MM_SHUFFLE(3, 1, 3, 1));
+    float *target = &out[i].x;
+    _mm256_storeu_ps(target, _mm256_permute2f128_ps(r03, r14, 0x20));
+    _mm256_storeu_ps(target + 8, _mm256_permute2f128_ps(r25, r03, 0x30));
+    _mm256_storeu_ps(target + 16, _mm256_permute2f128_ps(r14, r25, 0x31));
+  }
+
+  transformPointsGeneric(m, in + i, out + i, count - i);
+}
+
+// Sixteen points per step, split and interleaved by two permutes per
+// register: the first picks from the lower 32 floats, the second fills in
+// the rest.
+__attribute__((target("avx512f")))
+static void transformPointsAVX512(const mat4& m, const vec3 *in, vec3 *out, unsigned int count)
+{
+  static const int split[3][2][16] = {
+    { { 0, 3, 6, 9, 12, 15, 18, 21, 24, 27, 30, 0, 0, 0, 0, 0 },
+      { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 17, 20, 23, 26, 29 } },
+    { { 1, 4, 7, 10, 13, 16, 19, 22, 25, 28, 31, 0, 0, 0, 0, 0 },
+      { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 18, 21, 24, 27, 30 } },
+    { { 2, 5, 8, 11, 14, 17, 20, 23, 26, 29, 0, 0, 0, 0, 0, 0 },
+      { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 16, 19, 22, 25, 28, 31 } }
+  };
+  static const int merge[3][2][16] = {
+    { { 0, 16, 0, 1, 17, 0, 2, 18, 0, 3, 19, 0, 4, 20, 0, 5 },
+      { 0, 1, 16, 3, 4, 17, 6, 7, 18, 9, 10, 19, 12, 13, 20, 15 } },
+    { { 21, 0, 6, 22, 0, 7, 23, 0, 8, 24, 0, 9, 25, 0, 10, 26 },
+      { 0, 21, 2, 3, 22, 5, 6, 23, 8, 9, 24, 11, 12, 25, 14, 15 } },
+    { { 0, 11, 27, 0, 12, 28, 0, 13, 29, 0, 14, 30, 0, 15, 31, 0 },
+      { 26, 1, 2, 27, 4, 5, 28, 7, 8, 29, 10, 11, 30, 13, 14, 31 } }
+  };
+  unsigned int i = 0;
+
+  for (; i + 16 <= count; i += 16) {
+    const float *source = &in[i].x;
+    __m512 v0 = _mm512_loadu_ps(source);
+    __m512 v1 = _mm512_loadu_ps(source + 16);
+    __m512 v2 = _mm512_loadu_ps(source + 32);
+
+    __m512 c[3];
+    for (int a = 0; a < 3; a++) {
+      __m512 low = _mm512_permutex2var_ps(v0, _mm512_loadu_si512(split[a][0]), v1);
+      c[a] = _mm512_permutex2var_ps(low, _mm512_loadu_si512(split[a][1]), v2);
+    }
+
+    __m512 p[3];
+    for (int a = 0; a < 3; a++) {
+      p[a] = _mm512_add_ps(
+        _mm512_add_ps(_mm512_mul_ps(_mm512_set1_ps(m[0][a]), c[0]),
+                      _mm512_mul_ps(_mm512_set1_ps(m[1][a]), c[1])),
+        _mm512_add_ps(_mm512_mul_ps(_mm512_set1_ps(m[2][a]), c[2]),
+                      _mm512_set1_ps(m[3][a])));
+    }
+
+    float *target = &out[i].x;
+    for (int r = 0; r < 3; r++) {
+      __m512 low = _mm512_permutex2var_ps(p[0], _mm512_loadu_si512(merge[r][0]), p[1]);
+      _mm512_storeu_ps(target + r * 16,
+                       _mm512_permutex2var_ps(low, _mm512_loadu_si512(merge[r][1]), p[2]));
+    }
+  }
+
+  transformPointsGeneric(m, in + i, out + i, count - i);
+}
+#endif
+
+CollisionISA cpuCollisionISA()
+{
+#ifdef COLLISION_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f"))
+    return COLLISION_AVX512;
+  if (__builtin_cpu_supports("avx2"))
+    return COLLISION_AVX2;
+  if (__builtin_cpu_supports("sse4.2"))
+    return COLLISION_SSE42;
+#endif
+  return COLLISION_GENERIC;
+}
+
+const char *collisionISAName(CollisionISA isa)
+{
+  switch (isa) {
+  case COLLISION_SSE42:
+    return "sse4.2";
+  case COLLISION_AVX2:
+    return "avx2";
+  case COLLISION_AVX512:
+    return "avx512";
+  default:
+    return "generic";
+  }
+}
+
+// The best version of each kernel up to isa. A kernel without a version
+// of its own at a level uses the one below it.
+static CollisionKernels kernelsFor(CollisionISA isa)
+{
+  CollisionKernels kernels;
+  kernels.isa = isa;
+  kernels.checkTriangles = checkTrianglesScalar;
+  kernels.checkSphereTriangles = checkSphereTrianglesScalar;
+  kernels.checkCapsuleTriangles = checkCapsuleTrianglesScalar;
+  kernels.checkBoxTriangles = checkBoxTrianglesScalar;
+  kernels.sweepChildren = sweepChildren;
+  kernels.transformPoints = transformPointsGeneric;
+
+#ifdef COLLISION_X86
+  if (isa >= COLLISION_SSE42) {
+    kernels.sweepChildren = sweepChildrenSSE42;
+    kernels.transformPoints = transformPointsSSE42;
+  }
+  if (isa >= COLLISION_AVX2) {
+    kernels.checkTriangles = checkTrianglesAVX2;
+    kernels.checkSphereTriangles = checkSphereTrianglesAVX2;
+    kernels.checkCapsuleTriangles = checkCapsuleTrianglesAVX2;
+    kernels.checkBoxTriangles = checkBoxTrianglesAVX2;
+    kernels.transformPoints = transformPointsAVX2;
+  }
+  if (isa >= COLLISION_AVX512)
+    kernels.transformPoints = transformPointsAVX512;
+#endif
+  return kernels;
+}
+
+static CollisionISA startupISA()
+{
+  CollisionISA cpu = cpuCollisionISA();
+  const char *name = getenv("COLLISION_ISA");
+  if (!name)
+    return cpu;
+
+  for (int isa = COLLISION_GENERIC; isa <= COLLISION_AVX512; isa++) {
+    if (strcmp(name, collisionISAName((CollisionISA)isa)) != 0)
+      continue;
+    if (isa > cpu) {
+      cout << "WARNING::COLLISION:: CPU can't run COLLISION_ISA " << name << ", using "
+           << collisionISAName(cpu) << endl;
+      return cpu;
+    }
+    return (CollisionISA)isa;
+  }
+
+  cout << "WARNING::COLLISION:: unknown COLLISION_ISA " << name << ", using "
+       << collisionISAName(cpu) << endl;
+  return cpu;
+}
+
+static CollisionKernels& kernelTable()
+{
+  static CollisionKernels kernels = kernelsFor(startupISA());
+  return kernels;
+}
+
+const CollisionKernels& collisionKernels()
+{
+  return kernelTable();
+}
+
+bool setCollisionISA(CollisionISA isa)
+{
+  if (isa > cpuCollisionISA())
+    return false;
+  kernelTable() = kernelsFor(isa);
+  return true;
+}
@@ -1,3 +1,4 @@
+#include <cstdlib>
 #include <iostream>
 #include <vector>
 
@@ -7,10 +8,12 @@
 #include "camera.h"
 #include "model.h"
 #include "shader.h"
+#include "simulation.h"
+#include "world.h"
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 void mouse_callback(GLFWwindow* window, double x, double y);
-void processInput(GLFWwindow *window);
+vec3 processInput(GLFWwindow *window);
 
 // settings
 const unsigned int SCR_WIDTH = 800;
@@ -22,10 +25,6 @@ float lastX = SCR_WIDTH / 2.0f;
 float lastY = SCR_HEIGHT / 2.0f;
 bool firstMouse = true;
 
-// timing
-float deltaTime = 0.0f;
-float lastFrame = 0.0f;
-
 extern CharacterEntity *entity;
 
 std::vector<Model> models;
@@ -82,24 +81,47 @@ int main(int argc, char **argv)
 
   models.push_back(ourModel);
 
+  // where the model is placed, used for both rendering and collision
+  mat4 suitTransform = mat4(1.0f);
+  //suitTransform = translate(suitTransform, vec3(0.0f, -1.75f, 0.0f)); // translate it down so it's at the center of the scene
+  //suitTransform = scale(suitTransform, vec3(0.2f, 0.2f, 0.2f));	// it's a bit too big for our scene, so scale it down
+
+  // the model's triangles are gathered once into a mesh with its own tree,
+  // the built tree is cached on disk for the next start; the instance
+  // places that mesh in the world
+  CollisionWorld world(BROADPHASE_BVH, "./data/cache");
+  world.addInstance(world.addMesh(ourModel), suitTransform);
+
   // size of collision ellipse, experiment with this to change fidelity of detection
   static vec3 boundingEllipse = {0.5f, 1.0f, 0.5f};
-  entity = new CharacterEntity(models, boundingEllipse);
+  entity = new CharacterEntity(&world, boundingEllipse);
 
   // initialize player infront of model
-  entity->position[1] = 10.0f;
-  entity->position[2] = 5.0f;
+  entity->teleport(vec3(0.0f, 10.0f, 5.0f));
 
-  while (!glfwWindowShouldClose(window)) {
-    // per-frame time logic
-    // --------------------
-    float currentFrame = glfwGetTime();
-    deltaTime = (float)currentFrame - (float)lastFrame;
-    lastFrame = currentFrame;
+  // every character moves through the group so they can't walk into
+  // each other, for now that's only the player
+  CharacterGroup characters;
+  characters.add(entity);
+
+  // the simulation ticks at a fixed rate, TICK_RATE unless the first
+  // argument gives another, on a thread of its own; from here on this
+  // thread only reads input and draws
+  double tickRate = argc > 1 ? atof(argv[1]) : TICK_RATE;
+  SimulationThread simulation(&world, &characters, entity,
+                              tickRate > 0.0 ? tickRate : TICK_RATE);
+  simulation.start();
 
+  while (!glfwWindowShouldClose(window)) {
     // input
     // -----
-    processInput(window);
+    PlayerInput input = { processInput(window) };
+    simulation.setInput(input);
+
+    // the newest tick, drawn between it and the one before as far as the
+    // clock is past it
+    const SimulationSnapshot& snapshot = simulation.latest();
+    camera.Position = snapshot.interpolated(snapshot.player, simulation.clock());
 
     // render
     // ------
@@ -109,21 +131,6 @@ int main(int argc, char **argv)
     // don't forget to enable shader before setting uniforms
     ourShader.use();
 
-    entity->update();
-    camera.Position = entity->position;
-    entity->velocity = entity->velocity * 0.7f;
-
-    // TO DO fix gravity
-    /*float y = entity->velocity[1];
-    vec3 temp;
-    temp *= 0.8f;
-    entity->velocity -= temp;
-    entity->velocity[1] = y;
-    entity->velocity[1] -= 0.5f * deltaTime;
-    if (entity->grounded) {
-      entity->velocity[1] = 0.0f;
-    }*/
-
     // view/projection transformations
     mat4 projection = perspective(radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 1000.0f);
     mat4 view = camera.GetViewMatrix();
@@ -131,11 +138,7 @@ int main(int argc, char **argv)
     ourShader.setMat4("u_view", view);
 
     // render the loaded model
-    mat4 model = mat4(1.0f);
-    // bug: collision doesnt work when model is translated/scaled
-    //model = translate(model, vec3(0.0f, -1.75f, 0.0f)); // translate it down so it's at the center of the scene
-    //model = scale(model, vec3(0.2f, 0.2f, 0.2f));	// it's a bit too big for our scene, so scale it down
-    ourShader.setMat4("u_model", model);
+    ourShader.setMat4("u_model", suitTransform);
 
     for (unsigned int i = 0; i < models.size(); i++)
     {
@@ -148,6 +151,7 @@ int main(int argc, char **argv)
     glfwPollEvents();
   }
 
+  simulation.stop();
   glfwTerminate();
   printf("Exiting\n");
 
@@ -177,19 +181,19 @@ void mouse_callback(GLFWwindow* window, double xpos, double ypos)
     camera.ProcessMouseMovement(xoffset, yoffset, true);
 }
 
-void processInput(GLFWwindow *window)
+// escape, and how fast the movement keys push the player, per second
+vec3 processInput(GLFWwindow *window)
 {
+    vec3 push(0.0f);
     if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
         glfwSetWindowShouldClose(window, true);
     if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
-        camera.ProcessKeyboard(FORWARD, deltaTime);
+        push += camera.ProcessKeyboard(FORWARD, 1.0f);
     if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
-        camera.ProcessKeyboard(BACKWARD, deltaTime);
+        push += camera.ProcessKeyboard(BACKWARD, 1.0f);
     if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS)
-        camera.ProcessKeyboard(LEFT, deltaTime);
+        push += camera.ProcessKeyboard(LEFT, 1.0f);
     if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
-        camera.ProcessKeyboard(RIGHT, deltaTime);
+        push += camera.ProcessKeyboard(RIGHT, 1.0f);
+    return push;
 }
-
-
-
@@ -0,0 +1,232 @@
+#include "octree.h"
+
+LooseOctree::LooseOctree()
+{
+  clear(AABB(vec3(-1.0f), vec3(1.0f)));
+}
+
+void LooseOctree::clear(const AABB& box)
+{
+  nodes.clear();
+  freeNodes.clear();
+  bounds.clear();
+  triangleNode.clear();
+  triangleSlot.clear();
+
+  // power of two cells keep the tree stable when the root has to grow
+  vec3 extent = box.upper - box.lower;
+  float size = MAX(MAX(extent[0], extent[1]), extent[2]) * 0.5f;
+  float halfSize = 1.0f;
+  while (halfSize < size)
+    halfSize *= 2.0f;
+
+  OctreeNode node;
+  node.center = size > 0.0f ? box.center() : vec3(0.0f);
+  node.halfSize = halfSize;
+  node.parent = OCTREE_NONE;
+  for (int i = 0; i < 8; i++)
+    node.children[i] = OCTREE_NONE;
+  node.subtreeCount = 0;
+
+  nodes.push_back(node);
+  root = 0;
+}
+
+bool LooseOctree::fits(unsigned int node, const AABB& box) const
+{
+  const OctreeNode& n = nodes[node];
+  vec3 offset = box.center() - n.center;
+  vec3 extent = (box.upper - box.lower) * 0.5f;
+  for (int i = 0; i < 3; i++) {
+    if (fabs(offset[i]) > n.halfSize || extent[i] > n.halfSize)
+      return false;
+  }
+  return true;
+}
+
+void LooseOctree::grow(const AABB& box)
+{
+  // double the root towards the box until the box fits
+  while (!fits(root, box)) {
+    OctreeNode node;
+    node.halfSize = nodes[root].halfSize * 2.0f;
+    node.center = nodes[root].center;
+    vec3 offset = box.center() - nodes[root].center;
+    int octant = 0;
+    for (int i = 0; i < 3; i++) {
+      if (offset[i] >= 0.0f) {
+        node.center[i] += nodes[root].halfSize;
+      }
+      else {
+        node.center[i] -= nodes[root].halfSize;
+        octant |= 1 << i;
+      }
+    }
+    node.parent = OCTREE_NONE;
+    for (int i = 0; i < 8; i++)
+      node.children[i] = OCTREE_NONE;
+    node.children[octant] = root;
+    node.subtreeCount = nodes[root].subtreeCount;
+
+    nodes[root].parent = nodes.size();
+    root = nodes.size();
+    nodes.push_back(node);
+  }
+}
+
+unsigned int LooseOctree::child(unsigned int node, int octant)
+{
+  if (nodes[node].children[octant] != OCTREE_NONE)
+    return nodes[node].children[octant];
+
+  unsigned int index;
+  if (!freeNodes.empty()) {
+    index = freeNodes.back();
+    freeNodes.pop_back();
+  }
+  else {
+    index = nodes.size();
+    nodes.push_back(OctreeNode());
+  }
+
+  // 'nodes' may have been reallocated, so look the parent up again
+  const OctreeNode& parent = nodes[node];
+  OctreeNode& c = nodes[index];
+  c.halfSize = parent.halfSize * 0.5f;
+  c.center = parent.center;
+  for (int i = 0; i < 3; i++)
+    c.center[i] += (octant & (1 << i)) ? c.halfSize : -c.halfSize;
+  c.parent = node;
+  for (int i = 0; i < 8; i++)
+    c.children[i] = OCTREE_NONE;
+  c.subtreeCount = 0;
+  c.triangles.clear();
+
+  nodes[node].children[octant] = index;
+  return index;
+}
+
+void LooseOctree::insert(const std::vector<vec3>& triangles, unsigned int triangle)
+{
+  if (bounds.size() <= triangle) {
+    bounds.resize(triangle + 1);
+    triangleNode.resize(triangle + 1, OCTREE_NONE);
+    triangleSlot.resize(triangle + 1, 0);
+  }
+
+  AABB box;
+  box.grow(triangles[triangle*3]);
+  box.grow(triangles[triangle*3+1]);
+  box.grow(triangles[triangle*3+2]);
+  bounds[triangle] = box;
+
+  grow(box);
+
+  // descend while the triangle still fits the next level's cell
+  vec3 center = box.center();
+  vec3 extent = (box.upper - box.lower) * 0.5f;
+  float size = MAX(MAX(extent[0], extent[1]), extent[2]);
+  unsigned int node = root;
+  for (int depth = 0; depth < OCTREE_MAX_DEPTH; depth++) {
+    if (size > nodes[node].halfSize * 0.5f)
+      break;
+    int octant = 0;
+    for (int i = 0; i < 3; i++) {
+      if (center[i] > nodes[node].center[i])
+        octant |= 1 << i;
+    }
+    node = child(node, octant);
+  }
+
+  triangleNode[triangle] = node;
+  triangleSlot[triangle] = nodes[node].triangles.size();
+  nodes[node].triangles.push_back(triangle);
+
+  for (unsigned int n = node; n != OCTREE_NONE; n = nodes[n].parent)
+    nodes[n].subtreeCount++;
+}
+
+void LooseOctree::remove(unsigned int triangle)
+{
+  if (triangle >= triangleNode.size() || triangleNode[triangle] == OCTREE_NONE)
+    return;
+
+  unsigned int node = triangleNode[triangle];
+  std::vector<unsigned int>& list = nodes[node].triangles;
+
+  // swap with the last triangle of the node so removal is O(1)
+  unsigned int last = list.back();
+  list[triangleSlot[triangle]] = last;
+  triangleSlot[last] = triangleSlot[triangle];
+  list.pop_back();
+  triangleNode[triangle] = OCTREE_NONE;
+
+  // unlink nodes that became empty on the way up
+  for (unsigned int n = node; n != OCTREE_NONE;) {
+    unsigned int parent = nodes[n].parent;
+    if (--nodes[n].subtreeCount == 0 && n != root) {
+      for (int i = 0; i < 8; i++) {
+        if (nodes[parent].children[i] == n)
+          nodes[parent].children[i] = OCTREE_NONE;
+      }
+      freeNodes.push_back(n);
+    }
+    n = parent;
+  }
+}
+
+void LooseOctree::query(const AABB& box, std::vector<unsigned int>& result) const
+{
+  queryNode(root, box, result);
+}
+
+void LooseOctree::queryNode(unsigned int node, const AABB& box,
+                            std::vector<unsigned int>& result) const
+{
+  const OctreeNode& n = nodes[node];
+  if (n.subtreeCount == 0)
+    return;
+
+  vec3 loose = vec3(n.halfSize * 2.0f);
+  if (!AABB(n.center - loose, n.center + loose).overlaps(box))
+    return;
+
+  for (unsigned int i = 0; i < n.triangles.size(); i++) {
+    if (bounds[n.triangles[i]].overlaps(box))
+      result.push_back(n.triangles[i]);
+  }
+
+  for (int i = 0; i < 8; i++) {
+    if (n.children[i] != OCTREE_NONE)
+      queryNode(n.children[i], box, result);
+  }
+}
+
+unsigned int LooseOctree::querySpans(const vec3& start, const vec3& end, const vec3& radius,
+                                     TriangleSpan *spans, unsigned int capacity) const
+{
+  unsigned int spanCount = 0;
+  spanNode(root, AABB(min(start, end) - radius, max(start, end) + radius),
+           spans, capacity, spanCount);
+  return spanCount;
+}
+
+void LooseOctree::spanNode(unsigned int node, const AABB& box, TriangleSpan *spans,
+                           unsigned int capacity, unsigned int& spanCount) const
+{
+  const OctreeNode& n = nodes[node];
+  if (n.subtreeCount == 0)
+    return;
+
+  vec3 loose = vec3(n.halfSize * 2.0f);
+  if (!AABB(n.center - loose, n.center + loose).overlaps(box))
+    return;
+
+  if (!n.triangles.empty())
+    addSpan(spans, capacity, spanCount, &n.triangles[0], n.triangles.size());
+
+  for (int i = 0; i < 8; i++) {
+    if (n.children[i] != OCTREE_NONE)
+      spanNode(n.children[i], box, spans, capacity, spanCount);
+  }
+}
@@ -0,0 +1,532 @@
+#include "qbvh.h"
+
+#include <math.h>
+
+// size of one quantization step relative to the box being divided
+#define QBVH_STEP (1.0f / 65535.0f)
+// slack for the rounding of the segment test, in world units
+#define QBVH_SWEEP_EPSILON 1e-4f
+
+// Boxes are passed around as lower x, y, z followed by upper x, y, z.
+static void toFloats(const AABB& box, float out[6])
+{
+  for (int a = 0; a < 3; a++) {
+    out[a] = box.lower[a];
+    out[3+a] = box.upper[a];
+  }
+}
+
+// The builder and the traversal decode through this same function, so a
+// box the builder checked is exactly the box the traversal tests.
+static inline void decode(const float box[6], const float step[3],
+                          const QBVHNode& node, int slot, float out[6])
+{
+  for (int a = 0; a < 3; a++) {
+    out[a] = box[a] + node.lower[a][slot] * step[a];
+    out[3+a] = box[3+a] - node.upper[a][slot] * step[a];
+  }
+}
+
+static inline void stepsOf(const float box[6], float step[3])
+{
+  for (int a = 0; a < 3; a++)
+    step[a] = (box[3+a] - box[a]) * QBVH_STEP;
+}
+
+// Rounds child outwards onto the steps of box. Whatever the rounding of
+// the decode, stepping back towards 0 ends on the box's own face, which
+// contains the child.
+static void quantize(const float box[6], const AABB& child, QBVHNode& node, int slot)
+{
+  float step[3];
+  stepsOf(box, step);
+
+  for (int a = 0; a < 3; a++) {
+    int lower = 0, upper = 0;
+    if (step[a] > 0.0f) {
+      lower = (int)floorf((child.lower[a] - box[a]) / step[a]);
+      upper = (int)floorf((box[3+a] - child.upper[a]) / step[a]);
+      lower = lower < 0 ? 0 : (lower > 65535 ? 65535 : lower);
+      upper = upper < 0 ? 0 : (upper > 65535 ? 65535 : upper);
+    }
+    node.lower[a][slot] = lower;
+    node.upper[a][slot] = upper;
+
+    float decoded[6];
+    decode(box, step, node, slot, decoded);
+    while (node.lower[a][slot] > 0 && decoded[a] > child.lower[a]) {
+      node.lower[a][slot]--;
+      decode(box, step, node, slot, decoded);
+    }
+    while (node.upper[a][slot] > 0 && decoded[3+a] < child.upper[a]) {
+      node.upper[a][slot]--;
+      decode(box, step, node, slot, decoded);
+    }
+  }
+}
+
+QuantizedBVH::QuantizedBVH()
+{
+}
+
+void QuantizedBVH::clear()
+{
+  nodes.clear();
+  indices.clear();
+  bounds = AABB();
+  sources.clear();
+  parents.clear();
+  boxes.clear();
+  leafSlots.clear();
+}
+
+void QuantizedBVH::build(const BVH& bvh)
+{
+  clear();
+  if (bvh.indexCount == 0)
+    return;
+
+  indices.assign(bvh.indices, bvh.indices + bvh.indexCount);
+  bounds = bvh.nodes[0].bounds;
+
+  // roughly a third of the binary nodes survive the collapse
+  nodes.reserve(bvh.nodeCount / 3 + 1);
+  pack(bvh, 0, bounds);
+}
+
+unsigned int QuantizedBVH::pack(const BVH& bvh, unsigned int node, const AABB& box)
+{
+  // open the largest interior child until there are four, a leaf on its
+  // own becomes the single child of its node
+  unsigned int open[QBVH_WIDTH];
+  int openCount = 0;
+  open[openCount++] = node;
+  while (openCount < QBVH_WIDTH) {
+    int best = -1;
+    float bestArea = -1.0f;
+    for (int i = 0; i < openCount; i++) {
+      const BVHNode& child = bvh.nodes[open[i]];
+      if (child.count == 0 && child.bounds.surfaceArea() > bestArea) {
+        best = i;
+        bestArea = child.bounds.surfaceArea();
+      }
+    }
+    if (best < 0)
+      break;
+    unsigned int left = bvh.nodes[open[best]].left;
+    open[best] = left;
+    open[openCount++] = left + 1;
+  }
+
+  unsigned int index = nodes.size();
+  nodes.push_back(QBVHNode());
+  parents.push_back(QBVH_EMPTY);
+  boxes.push_back(box);
+  for (int i = 0; i < QBVH_WIDTH; i++)
+    sources.push_back(i < openCount ? open[i] : QBVH_EMPTY);
+
+  float parent[6], step[3];
+  toFloats(box, parent);
+  stepsOf(parent, step);
+
+  // quantize every slot first, the recursion below may move nodes
+  for (int i = 0; i < QBVH_WIDTH; i++) {
+    QBVHNode& packed = nodes[index];
+    if (i < openCount) {
+      quantize(parent, bvh.nodes[open[i]].bounds, packed, i);
+    }
+    else {
+      for (int a = 0; a < 3; a++) {
+        packed.lower[a][i] = 65535;
+        packed.upper[a][i] = 65535;
+      }
+      packed.children[i] = QBVH_EMPTY;
+    }
+  }
+
+  for (int i = 0; i < openCount; i++) {
+    const BVHNode& child = bvh.nodes[open[i]];
+    unsigned int reference;
+    if (child.count > 0) {
+      reference = QBVH_LEAF | child.count << 27 | child.left;
+    }
+    else {
+      float decoded[6];
+      decode(parent, step, nodes[index], i, decoded);
+      AABB childBox(vec3(decoded[0], decoded[1], decoded[2]),
+                    vec3(decoded[3], decoded[4], decoded[5]));
+      reference = pack(bvh, open[i], childBox);
+      parents[reference] = index * QBVH_WIDTH + i;
+    }
+    nodes[index].children[i] = reference;
+  }
+
+  return index;
+}
+
+void QuantizedBVH::linkLeaves()
+{
+  // the slot of every triangle's leaf is only needed here, so it is
+  // worked out on the first refit after a build
+  if (!leafSlots.empty())
+    return;
+
+  unsigned int triangleCount = 0;
+  for (unsigned int i = 0; i < indices.size(); i++)
+    triangleCount = MAX(triangleCount, indices[i] + 1);
+  leafSlots.assign(triangleCount, QBVH_EMPTY);
+
+  for (unsigned int slot = 0; slot < nodes.size() * QBVH_WIDTH; slot++) {
+    unsigned int child = nodes[slot / QBVH_WIDTH].children[slot % QBVH_WIDTH];
+    if (child == QBVH_EMPTY || !(child & QBVH_LEAF))
+      continue;
+    unsigned int count = (child >> 27) & QBVH_LEAF_SIZE;
+    unsigned int first = child & 0x07ffffffu;
+    for (unsigned int j = first; j < first + count; j++)
+      leafSlots[indices[j]] = slot;
+  }
+}
+
+void QuantizedBVH::swap(QuantizedBVH& other)
+{
+  nodes.swap(other.nodes);
+  indices.swap(other.indices);
+  std::swap(bounds, other.bounds);
+  sources.swap(other.sources);
+  parents.swap(other.parents);
+  boxes.swap(other.boxes);
+  leafSlots.swap(other.leafSlots);
+}
+
+// Quantizes every slot of node again inside its new box, and below it
+// every child whose box came out different.
+void QuantizedBVH::repack(const BVH& bvh, unsigned int node, const AABB& box)
+{
+  boxes[node] = box;
+  for (int i = 0; i < QBVH_WIDTH; i++) {
+    if (nodes[node].children[i] != QBVH_EMPTY)
+      requantize(bvh, node * QBVH_WIDTH + i);
+  }
+}
+
+void QuantizedBVH::requantize(const BVH& bvh, unsigned int slot)
+{
+  unsigned int node = slot / QBVH_WIDTH;
+  int i = slot % QBVH_WIDTH;
+  float parent[6], step[3], after[6];
+  toFloats(boxes[node], parent);
+  stepsOf(parent, step);
+
+  quantize(parent, bvh.nodes[sources[slot]].bounds, nodes[node], i);
+  decode(parent, step, nodes[node], i, after);
+
+  unsigned int child = nodes[node].children[i];
+  if (child & QBVH_LEAF)
+    return;
+
+  // the child's slots are relative to its box, if that moved they are too
+  AABB childBox(vec3(after[0], after[1], after[2]), vec3(after[3], after[4], after[5]));
+  const AABB& old = boxes[child];
+  if (childBox.lower != old.lower || childBox.upper != old.upper)
+    repack(bvh, child, childBox);
+}
+
+void QuantizedBVH::refit(const BVH& bvh, unsigned int first, unsigned int count)
+{
+  if (nodes.empty())
+    return;
+  linkLeaves();
+
+  for (unsigned int t = first; t < first + count && t < leafSlots.size(); t++) {
+    unsigned int slot = leafSlots[t];
+    if (slot == QBVH_EMPTY)
+      continue;
+
+    // a leaf still inside its quantized box needs nothing, boxes only have
+    // to contain what is below them
+    float parent[6], step[3], decoded[6];
+    toFloats(boxes[slot / QBVH_WIDTH], parent);
+    stepsOf(parent, step);
+    decode(parent, step, nodes[slot / QBVH_WIDTH], slot % QBVH_WIDTH, decoded);
+    AABB leafBox(vec3(decoded[0], decoded[1], decoded[2]),
+                 vec3(decoded[3], decoded[4], decoded[5]));
+    if (leafBox.contains(bvh.nodes[sources[slot]].bounds))
+      continue;
+
+    // climb to the first node whose own box still holds the moved slot and
+    // quantize the slot again there, repacking the subtree below it
+    for (;;) {
+      unsigned int node = slot / QBVH_WIDTH;
+      if (boxes[node].contains(bvh.nodes[sources[slot]].bounds)) {
+        requantize(bvh, slot);
+        break;
+      }
+      if (parents[node] == QBVH_EMPTY) {
+        // outgrew the root, everything is relative to its box
+        bounds = bvh.nodes[0].bounds;
+        repack(bvh, 0, bounds);
+        break;
+      }
+      slot = parents[node];
+    }
+  }
+}
+
+template <class Test, class Visitor>
+void QuantizedBVH::traverse(const Test& test, Visitor& visitor) const
+{
+  if (nodes.empty())
+    return;
+
+  unsigned int stack[QBVH_STACK_SIZE];
+  float stackBoxes[QBVH_STACK_SIZE][6];
+  int stackSize = 0;
+
+  toFloats(bounds, stackBoxes[0]);
+  if (!test(stackBoxes[0]))
+    return;
+  stack[stackSize++] = 0;
+
+  while (stackSize > 0) {
+    stackSize--;
+    const QBVHNode& node = nodes[stack[stackSize]];
+    float childBoxes[QBVH_WIDTH][6] = {};
+    unsigned int mask = test.children(node, stackBoxes[stackSize], childBoxes);
+
+    for (int i = 0; i < QBVH_WIDTH; i++) {
+      if (!(mask >> i & 1))
+        continue;
+
+      unsigned int child = node.children[i];
+      if (child & QBVH_LEAF) {
+        unsigned int count = (child >> 27) & QBVH_LEAF_SIZE;
+        unsigned int first = child & 0x07ffffffu;
+        visitor(&indices[first], count);
+      }
+      else {
+        stack[stackSize] = child;
+        for (int j = 0; j < 6; j++)
+          stackBoxes[stackSize][j] = childBoxes[i][j];
+        stackSize++;
+      }
+    }
+  }
+}
+
+QBVHSweep::QBVHSweep(const vec3& start, const vec3& end, const vec3& radius)
+{
+  for (int a = 0; a < 3; a++) {
+    float delta = end[a] - start[a];
+    this->start[a] = start[a];
+    this->radius[a] = radius[a] + QBVH_SWEEP_EPSILON;
+    // a move shorter than the slack is covered by it
+    moving[a] = fabsf(delta) > QBVH_SWEEP_EPSILON;
+    inverse[a] = moving[a] ? 1.0f / delta : 0.0f;
+  }
+}
+
+// Slab test of the segment against the box grown by the radius.
+bool QBVHSweep::operator()(const float b[6]) const
+{
+  float tmin = 0.0f, tmax = 1.0f;
+  for (int a = 0; a < 3; a++) {
+    float lower = b[a] - radius[a];
+    float upper = b[3+a] + radius[a];
+    if (!moving[a]) {
+      if (start[a] < lower || start[a] > upper)
+        return false;
+      continue;
+    }
+    float t0 = (lower - start[a]) * inverse[a];
+    float t1 = (upper - start[a]) * inverse[a];
+    if (t0 > t1) {
+      float t = t0;
+      t0 = t1;
+      t1 = t;
+    }
+    tmin = t0 > tmin ? t0 : tmin;
+    tmax = t1 < tmax ? t1 : tmax;
+    if (tmin > tmax)
+      return false;
+  }
+  return true;
+}
+
+unsigned int sweepChildren(const QBVHNode& node, const float box[6],
+                           const QBVHSweep& sweep, float childBoxes[][6])
+{
+  float step[3];
+  stepsOf(box, step);
+
+  unsigned int mask = 0;
+  for (int i = 0; i < QBVH_WIDTH; i++) {
+    // unused slots are always the last ones
+    if (node.children[i] == QBVH_EMPTY)
+      break;
+    decode(box, step, node, i, childBoxes[i]);
+    if (sweep(childBoxes[i]))
+      mask |= 1u << i;
+  }
+  return mask;
+}
+
+#ifdef COLLISION_X86
+#include <immintrin.h>
+
+// The decode and the slab test of sweepChildren on the four slots at once,
+// the same float operations in the same order.
+__attribute__((target("sse4.2")))
+unsigned int sweepChildrenSSE42(const QBVHNode& node, const float box[6],
+                                const QBVHSweep& sweep, float childBoxes[][6])
+{
+  float step[3];
+  stepsOf(box, step);
+
+  const __m128 zero = _mm_setzero_ps();
+  __m128 tmin = zero, tmax = _mm_set1_ps(1.0f);
+  __m128 miss = zero;
+  float lowers[3][QBVH_WIDTH], uppers[3][QBVH_WIDTH];
+
+  for (int a = 0; a < 3; a++) {
+    __m128i lowerSteps = _mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i *)node.lower[a]));
+    __m128i upperSteps = _mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i *)node.upper[a]));
+    __m128 lower = _mm_add_ps(_mm_set1_ps(box[a]),
+                              _mm_mul_ps(_mm_cvtepi32_ps(lowerSteps), _mm_set1_ps(step[a])));
+    __m128 upper = _mm_sub_ps(_mm_set1_ps(box[3+a]),
+                              _mm_mul_ps(_mm_cvtepi32_ps(upperSteps), _mm_set1_ps(step[a])));
+    _mm_storeu_ps(lowers[a], lower);
+    _mm_storeu_ps(uppers[a], upper);
+
+    __m128 radius = _mm_set1_ps(sweep.radius[a]);
+    __m128 start = _mm_set1_ps(sweep.start[a]);
+    lower = _mm_sub_ps(lower, radius);
+    upper = _mm_add_ps(upper, radius);
+    if (!sweep.moving[a]) {
+      miss = _mm_or_ps(miss, _mm_or_ps(_mm_cmplt_ps(start, lower), _mm_cmpgt_ps(start, upper)));
+      continue;
+    }
+
+    __m128 inverse = _mm_set1_ps(sweep.inverse[a]);
+    __m128 t0 = _mm_mul_ps(_mm_sub_ps(lower, start), inverse);
+    __m128 t1 = _mm_mul_ps(_mm_sub_ps(upper, start), inverse);
+    __m128 swap = _mm_cmpgt_ps(t0, t1);
+    __m128 near = _mm_blendv_ps(t0, t1, swap);
+    __m128 far = _mm_blendv_ps(t1, t0, swap);
+    tmin = _mm_blendv_ps(tmin, near, _mm_cmpgt_ps(near, tmin));
+    tmax = _mm_blendv_ps(tmax, far, _mm_cmplt_ps(far, tmax));
+    miss = _mm_or_ps(miss, _mm_cmpgt_ps(tmin, tmax));
+  }
+
+  unsigned int mask = 0;
+  for (int i = 0; i < QBVH_WIDTH; i++) {
+    if (node.children[i] == QBVH_EMPTY)
+      break;
+    for (int a = 0; a < 3; a++) {
+      childBoxes[i][a] = lowers[a][i];
+      childBoxes[i][3+a] = uppers[a][i];
+    }
+    mask |= 1u << i;
+  }
+  return mask & ~(unsigned int)_mm_movemask_ps(miss);
+}
+#endif
+
+namespace {
+struct BoxTest {
+  float box[6];
+
+  bool operator()(const float b[6]) const
+  {
+    return b[0] <= box[3] && b[3] >= box[0] &&
+           b[1] <= box[4] && b[4] >= box[1] &&
+           b[2] <= box[5] && b[5] >= box[2];
+  }
+
+  unsigned int children(const QBVHNode& node, const float parent[6],
+                        float childBoxes[][6]) const
+  {
+    float step[3];
+    stepsOf(parent, step);
+
+    unsigned int mask = 0;
+    for (int i = 0; i < QBVH_WIDTH; i++) {
+      if (node.children[i] == QBVH_EMPTY)
+        break;
+      decode(parent, step, node, i, childBoxes[i]);
+      if ((*this)(childBoxes[i]))
+        mask |= 1u << i;
+    }
+    return mask;
+  }
+};
+
+// the sweep with the children test collisionKernels() picked
+struct SweepTest {
+  QBVHSweep sweep;
+  unsigned int (*sweepChildren)(const QBVHNode&, const float[6], const QBVHSweep&, float[][6]);
+
+  SweepTest(const vec3& start, const vec3& end, const vec3& radius)
+    : sweep(start, end, radius), sweepChildren(collisionKernels().sweepChildren)
+  {
+  }
+
+  bool operator()(const float b[6]) const
+  {
+    return sweep(b);
+  }
+
+  unsigned int children(const QBVHNode& node, const float parent[6],
+                        float childBoxes[][6]) const
+  {
+    return sweepChildren(node, parent, sweep, childBoxes);
+  }
+};
+
+struct AppendVisitor {
+  std::vector<unsigned int>& result;
+  void operator()(const unsigned int *first, unsigned int count)
+  {
+    result.insert(result.end(), first, first + count);
+  }
+};
+
+struct SpanVisitor {
+  TriangleSpan *spans;
+  unsigned int capacity;
+  unsigned int spanCount;
+  void operator()(const unsigned int *first, unsigned int count)
+  {
+    addSpan(spans, capacity, spanCount, first, count);
+  }
+};
+}
+
+void QuantizedBVH::query(const AABB& box, std::vector<unsigned int>& result) const
+{
+  BoxTest test;
+  toFloats(box, test.box);
+  AppendVisitor visitor = { result };
+  traverse(test, visitor);
+}
+
+void QuantizedBVH::querySweep(const vec3& start, const vec3& end, const vec3& radius,
+                              std::vector<unsigned int>& result) const
+{
+  SweepTest test(start, end, radius);
+  AppendVisitor visitor = { result };
+  traverse(test, visitor);
+}
+
+unsigned int QuantizedBVH::querySpans(const vec3& start, const vec3& end, const vec3& radius,
+                                      TriangleSpan *spans, unsigned int capacity) const
+{
+  SweepTest test(start, end, radius);
+  SpanVisitor visitor = { spans, capacity, 0 };
+  traverse(test, visitor);
+  return visitor.spanCount;
+}
+
+size_t QuantizedBVH::memoryUsage() const
+{
+  return nodes.size() * sizeof(QBVHNode) + indices.size() * sizeof(unsigned int);
+}
@@ -0,0 +1,893 @@
+#include "trianglestore.h"
+
+#include "determinism.h"
+
+// The capsule and box narrowphases. Like checkEllipsoid they report each
+// hit as the point sweepRadius() from where the sweep's position is at
+// the time of the hit, against the contact normal, so the slide response
+// needs nothing else of the shape.
+
+// What the capsule tests need of the sweep, worked out once per call.
+struct CapsuleTerms {
+  vec3 base;
+  vec3 velocity;
+  float velocitySquaredLength;
+  float speed;
+  float radius;
+  float radiusSquared;
+  // from the position to the center of either cap
+  float half;
+  // base moved to the bottom and the top cap
+  vec3 caps[2];
+
+  CapsuleTerms(const CollisionPacket* colPackage)
+  {
+    base = colPackage->basePoint;
+    velocity = colPackage->velocity;
+    velocitySquaredLength = dot(velocity, velocity);
+    speed = sqrtf(velocitySquaredLength);
+    radius = colPackage->eRadius[0];
+    radiusSquared = radius * radius;
+    half = MAX(colPackage->eRadius[1] - radius, 0.0f);
+    caps[0] = vec3(base[0], base[1] - half, base[2]);
+    caps[1] = vec3(base[0], base[1] + half, base[2]);
+  }
+};
+
+// time of the packet's nearest hit so far, nothing past the sweep's end
+static inline float sweepLimit(const CollisionPacket* colPackage, float speed)
+{
+  if (!colPackage->foundCollision)
+    return 1.0f;
+  return MIN((float)(colPackage->nearestDistance / speed), 1.0f);
+}
+
+static inline void recordShapeHit(CollisionPacket* colPackage, float speed,
+                                  float t, const vec3& collisionPoint)
+{
+  float distToCollision = t * speed;
+  if (colPackage->foundCollision == false ||
+      distToCollision < colPackage->nearestDistance) {
+    colPackage->nearestDistance = distToCollision;
+    colPackage->intersectionPoint = collisionPoint;
+    colPackage->foundCollision = true;
+  }
+}
+
+// The capsule against triangle i of the store, for hits before t: the
+// face, then both caps against the edges and vertices as spheres, then
+// the side against the vertices and edges. A hit of the segment at height
+// h above the position is reported h lower, as if by a sphere there. Like
+// sweepTriangle it tests the edges and vertices the triangle's features
+// pick for the kind of sweep.
+static inline bool sweepCapsuleTriangle(const CapsuleTerms& sweep, const TriangleStore& store,
+                                        unsigned int i, float& t, vec3& collisionPoint)
+{
+  vec3 normal(store.normals[0][i], store.normals[1][i], store.normals[2][i]);
+  float normalDotVelocity = dot(normal, sweep.velocity);
+  bool backFace = normalDotVelocity > 0.0f;
+  if (backFace && !(store.features[i] >> FEATURES_BACK & 0x3f))
+    return false;
+
+  // the segment's end nearest the plane is as far as the radius reaches,
+  // the interval is that of a sphere this big
+  float reach = sweep.radius + sweep.half * fabsf(normal[1]);
+  float signedDistance = dot(normal, sweep.base) + store.d[i];
+  float t0, t1;
+  bool embeddedInPlane = false;
+  if (normalDotVelocity == 0.0f) {
+    if (fabsf(signedDistance) >= reach)
+      return false;
+    embeddedInPlane = true;
+    t0 = 0.0f;
+    t1 = 1.0f;
+  }
+  else {
+    t0 = (-reach - signedDistance) / normalDotVelocity;
+    t1 = (reach - signedDistance) / normalDotVelocity;
+    if (t0 > t1) {
+      float temp = t1;
+      t1 = t0;
+      t0 = temp;
+    }
+    if (t0 > 1.0f || t1 < 0.0f)
+      return false;
+    t0 = MIN(MAX(t0, 0.0f), 1.0f);
+  }
+  if (t0 >= t)
+    return false;
+
+  unsigned int features = sweptFeatures(store, i,
+    backFace ? FEATURES_BACK : t0 > 0.0f ? FEATURES_OUTSIDE : FEATURES_SUNK, sweep.velocity);
+  if (!features && backFace)
+    return false;
+
+  vec3 p[3], edge[3];
+  for (int k = 0; k < 3; k++) {
+    p[k] = store.position(i, k);
+    edge[k] = vec3(store.edges[k][0][i], store.edges[k][1][i], store.edges[k][2][i]);
+  }
+
+  // the end nearest the plane touching the inside of the face, the middle
+  // if the segment lies along it
+  if (!embeddedInPlane && !backFace) {
+    float end = normal[1] > 0.0f ? -sweep.half : normal[1] < 0.0f ? sweep.half : 0.0f;
+    vec3 point = vec3(sweep.base[0], sweep.base[1] + end, sweep.base[2]) -
+                 normal * sweep.radius + t0 * sweep.velocity;
+    vec3 w = point - p[0];
+    vec3 vw = cross(-edge[2], w);
+    vec3 uw = cross(edge[0], w);
+    if (dot(vw, normal) <= 0.0f && dot(uw, normal) >= 0.0f &&
+        length(vw) + length(uw) <= store.areas[i]) {
+      t = t0;
+      collisionPoint = vec3(point[0], point[1] - end, point[2]);
+      return true;
+    }
+  }
+
+  bool found = false;
+  float newT;
+  for (int cap = 0; cap < 2; cap++) {
+    const vec3& base = sweep.caps[cap];
+    float end = base[1] - sweep.base[1];
+
+    for (int k = 0; k < 3; k++) {
+      if (!(features >> (3 + k) & 1))
+        continue;
+      vec3 baseToVertex = base - p[k];
+      float b = 2.0f * dot(sweep.velocity, baseToVertex);
+      float c = dot(baseToVertex, baseToVertex) - sweep.radiusSquared;
+      if (c > 0.0f && b >= 0.0f)
+        continue;
+      if (getLowestRoot(sweep.velocitySquaredLength, b, c, t, &newT)) {
+        t = newT;
+        found = true;
+        collisionPoint = vec3(p[k][0], p[k][1] - end, p[k][2]);
+      }
+    }
+
+    for (int k = 0; k < 3; k++) {
+      if (!(features >> k & 1))
+        continue;
+      vec3 baseToVertex = p[k] - base;
+      float edgeSquaredLength = store.edgeLengths[k][i];
+      float edgeDotVelocity = dot(edge[k], sweep.velocity);
+      float edgeDotBaseToVertex = dot(edge[k], baseToVertex);
+
+      float a = edgeSquaredLength * -sweep.velocitySquaredLength +
+                edgeDotVelocity * edgeDotVelocity;
+      float b = edgeSquaredLength * (2.0f * dot(sweep.velocity, baseToVertex)) -
+                2.0f * edgeDotVelocity * edgeDotBaseToVertex;
+      float c = edgeSquaredLength * (sweep.radiusSquared - dot(baseToVertex, baseToVertex)) +
+                edgeDotBaseToVertex * edgeDotBaseToVertex;
+      if (!getLowestRoot(a, b, c, t, &newT))
+        continue;
+      float f = (edgeDotVelocity * newT - edgeDotBaseToVertex) / edgeSquaredLength;
+      if (f < 0.0f || f > 1.0f)
+        continue;
+      t = newT;
+      found = true;
+      vec3 point = p[k] + f * edge[k];
+      collisionPoint = vec3(point[0], point[1] - end, point[2]);
+    }
+  }
+
+  // the side against a vertex, a circle against a point seen from above,
+  // at a height between the caps
+  float a = sweep.velocity[0] * sweep.velocity[0] + sweep.velocity[2] * sweep.velocity[2];
+  if (a > 0.0f) {
+    for (int k = 0; k < 3; k++) {
+      if (!(features >> (3 + k) & 1))
+        continue;
+      float x = sweep.base[0] - p[k][0];
+      float z = sweep.base[2] - p[k][2];
+      float b = 2.0f * (sweep.velocity[0] * x + sweep.velocity[2] * z);
+      float c = (x * x + z * z) - sweep.radiusSquared;
+      if (c > 0.0f && b >= 0.0f)
+        continue;
+      if (!getLowestRoot(a, b, c, t, &newT))
+        continue;
+      float height = p[k][1] - (sweep.base[1] + newT * sweep.velocity[1]);
+      if (fabsf(height) > sweep.half)
+        continue;
+      t = newT;
+      found = true;
+      collisionPoint = vec3(p[k][0], p[k][1] - height, p[k][2]);
+    }
+  }
+
+  // the side against an edge: the distance between the two lines along
+  // cross(up, edge) changes linearly, starting outside the radius it
+  // reaches it once
+  for (int k = 0; k < 3; k++) {
+    if (!(features >> k & 1))
+      continue;
+    float lengthSquared = edge[k][2] * edge[k][2] + edge[k][0] * edge[k][0];
+    if (!(lengthSquared > 0.0f))
+      continue;
+    vec3 w = p[k] - sweep.base;
+    float s = w[0] * edge[k][2] - w[2] * edge[k][0];
+    float speed = sweep.velocity[0] * edge[k][2] - sweep.velocity[2] * edge[k][0];
+    float distance = sweep.radius * sqrtf(lengthSquared);
+    if (!(fabsf(s) > distance))
+      continue;
+    newT = (s - (s > 0.0f ? distance : -distance)) / speed;
+    if (!(newT >= 0.0f && newT < t))
+      continue;
+    // nearest points of the lines, f along the edge and height along the
+    // segment
+    vec3 r = sweep.base + newT * sweep.velocity - p[k];
+    float f = (dot(edge[k], r) - edge[k][1] * r[1]) / lengthSquared;
+    float height = f * edge[k][1] - r[1];
+    if (f < 0.0f || f > 1.0f || fabsf(height) > sweep.half)
+      continue;
+    t = newT;
+    found = true;
+    vec3 point = p[k] + f * edge[k];
+    collisionPoint = vec3(point[0], point[1] - height, point[2]);
+  }
+  return found;
+}
+
+void checkCapsuleTrianglesScalar(CollisionPacket* colPackage, const TriangleStore& store,
+                                 unsigned int first, unsigned int count, const AABB& box)
+{
+  CapsuleTerms sweep(colPackage);
+  if (sweep.velocitySquaredLength == 0.0f)
+    return;
+
+  float t = sweepLimit(colPackage, sweep.speed);
+  vec3 collisionPoint;
+  bool found = false;
+  for (unsigned int i = first; i < first + count; i++) {
+    if (overlapsBox(store, i, box) && sweepCapsuleTriangle(sweep, store, i, t, collisionPoint))
+      found = true;
+  }
+  if (found)
+    recordShapeHit(colPackage, sweep.speed, t, collisionPoint);
+}
+
+// cross products of a box axis with an edge nearer parallel than this,
+// relative to the edge's squared length, separate nothing the others don't
+#define BOX_PARALLEL 1e-8f
+
+// What the box tests need of the sweep, worked out once per call.
+struct BoxTerms {
+  vec3 base;
+  vec3 velocity;
+  float velocitySquaredLength;
+  float speed;
+  vec3 axes[3];
+  vec3 half;
+  float radius;
+
+  BoxTerms(const CollisionPacket* colPackage)
+  {
+    base = colPackage->basePoint;
+    velocity = colPackage->velocity;
+    velocitySquaredLength = dot(velocity, velocity);
+    speed = sqrtf(velocitySquaredLength);
+    for (int k = 0; k < 3; k++)
+      axes[k] = colPackage->orientation[k];
+    half = colPackage->eRadius;
+    radius = BoxShape::sweepRadius(half);
+  }
+};
+
+// Where along one axis the box starts and stops overlapping the triangle,
+// narrowing first and last to it, and how deep it overlaps now. False if
+// the axis separates them for the whole sweep. The edge of the triangle
+// an axis crosses a box axis with goes with each normal, -1 for the rest.
+struct AxisSweep {
+  float first, last;
+  vec3 firstNormal;
+  int firstEdge;
+  float depth;
+  vec3 depthNormal;
+  int depthEdge;
+};
+
+static inline bool sweepAxis(const BoxTerms& sweep, const vec3 p[3], const vec3& axis,
+                             int edge, AxisSweep& result)
+{
+  float center = dot(sweep.base, axis);
+  float extent = sweep.half[0] * fabsf(dot(sweep.axes[0], axis)) +
+                 sweep.half[1] * fabsf(dot(sweep.axes[1], axis)) +
+                 sweep.half[2] * fabsf(dot(sweep.axes[2], axis));
+  float q0 = dot(p[0], axis), q1 = dot(p[1], axis), q2 = dot(p[2], axis);
+  float lower = MIN(MIN(q0, q1), q2);
+  float upper = MAX(MAX(q0, q1), q2);
+  // how far the box is below and above the triangle along the axis
+  float below = lower - (center + extent);
+  float above = (center - extent) - upper;
+  float speed = dot(sweep.velocity, axis);
+
+  if (speed == 0.0f) {
+    if (below > 0.0f || above > 0.0f)
+      return false;
+  }
+  else {
+    float enter = speed > 0.0f ? below / speed : -above / speed;
+    float leave = speed > 0.0f ? -above / speed : below / speed;
+    if (enter > result.first) {
+      result.first = enter;
+      result.firstNormal = speed > 0.0f ? -axis : axis;
+      result.firstEdge = edge;
+    }
+    result.last = MIN(result.last, leave);
+  }
+
+  float length = sqrtf(dot(axis, axis));
+  float depth = MIN(-below, -above) / length;
+  if (depth < result.depth) {
+    result.depth = depth;
+    result.depthNormal = -below < -above ? -axis : axis;
+    result.depthEdge = edge;
+  }
+  return true;
+}
+
+// The box against triangle i of the store, for hits before t. The first
+// time every axis overlaps is the hit, with the normal of the axis that
+// overlapped last; a box overlapping already stops at once if it moves
+// into the axis it overlaps least along. A hit along an axis crossing an
+// edge is the edge's, taken only if the triangle's features pick the edge
+// for the kind of sweep, so a box sliding over a tessellated floor doesn't
+// catch on its internal edges. A back face only has those hits, from
+// outside.
+static inline bool sweepBoxTriangle(const BoxTerms& sweep, const TriangleStore& store,
+                                    unsigned int i, float& t, vec3& collisionPoint)
+{
+  vec3 normal(store.normals[0][i], store.normals[1][i], store.normals[2][i]);
+  bool backFace = dot(normal, sweep.velocity) > 0.0f;
+  if (backFace && !(store.features[i] >> FEATURES_BACK & 0x3f))
+    return false;
+
+  vec3 p[3], edge[3];
+  for (int k = 0; k < 3; k++) {
+    p[k] = store.position(i, k);
+    edge[k] = vec3(store.edges[k][0][i], store.edges[k][1][i], store.edges[k][2][i]);
+  }
+
+  AxisSweep overlap;
+  overlap.first = -FLT_MAX;
+  overlap.last = FLT_MAX;
+  overlap.firstEdge = -1;
+  overlap.depth = FLT_MAX;
+  overlap.depthEdge = -1;
+  if (!sweepAxis(sweep, p, normal, -1, overlap))
+    return false;
+  // reaching the plane from outside or within it already
+  unsigned int features = sweptFeatures(store, i,
+    backFace ? FEATURES_BACK : overlap.first > 0.0f ? FEATURES_OUTSIDE : FEATURES_SUNK,
+    sweep.velocity);
+  for (int k = 0; k < 3; k++) {
+    if (!sweepAxis(sweep, p, sweep.axes[k], -1, overlap))
+      return false;
+  }
+  for (int k = 0; k < 3; k++) {
+    for (int j = 0; j < 3; j++) {
+      vec3 axis = cross(sweep.axes[k], edge[j]);
+      if (!(dot(axis, axis) > BOX_PARALLEL * store.edgeLengths[j][i]))
+        continue;
+      if (!sweepAxis(sweep, p, axis, j, overlap))
+        return false;
+    }
+  }
+  // overlapping for no time, or only before the sweep
+  if (overlap.first > overlap.last || overlap.last < 0.0f || overlap.first >= t)
+    return false;
+
+  float hitT = 0.0f;
+  vec3 hitNormal = overlap.depthNormal;
+  int hitEdge = overlap.depthEdge;
+  if (overlap.first >= 0.0f) {
+    hitT = overlap.first;
+    hitNormal = overlap.firstNormal;
+    hitEdge = overlap.firstEdge;
+  }
+  else if (!(dot(hitNormal, sweep.velocity) < 0.0f)) {
+    return false;
+  }
+  bool tested = hitEdge >= 0 && (features >> hitEdge & 1);
+  if (backFace ? !(tested && overlap.first >= 0.0f) : hitEdge >= 0 && !tested)
+    return false;
+  if (!(hitT < t))
+    return false;
+  hitNormal = hitNormal / sqrtf(dot(hitNormal, hitNormal));
+
+  t = hitT;
+  collisionPoint = sweep.base + hitT * sweep.velocity - hitNormal * sweep.radius;
+  return true;
+}
+
+void checkBoxTrianglesScalar(CollisionPacket* colPackage, const TriangleStore& store,
+                             unsigned int first, unsigned int count, const AABB& box)
+{
+  BoxTerms sweep(colPackage);
+  if (sweep.velocitySquaredLength == 0.0f)
+    return;
+
+  float t = sweepLimit(colPackage, sweep.speed);
+  vec3 collisionPoint;
+  bool found = false;
+  for (unsigned int i = first; i < first + count; i++) {
+    if (overlapsBox(store, i, box) && sweepBoxTriangle(sweep, store, i, t, collisionPoint))
+      found = true;
+  }
+  if (found)
+    recordShapeHit(colPackage, sweep.speed, t, collisionPoint);
+}
+
+void checkCapsuleTriangles(CollisionPacket* colPackage, const TriangleStore& store,
+                           unsigned int first, unsigned int count, const AABB& box)
+{
+  collisionKernels().checkCapsuleTriangles(colPackage, store, first, count, box);
+}
+
+void checkBoxTriangles(CollisionPacket* colPackage, const TriangleStore& store,
+                       unsigned int first, unsigned int count, const AABB& box)
+{
+  collisionKernels().checkBoxTriangles(colPackage, store, first, count, box);
+}
+
+#ifdef COLLISION_X86
+#include "simd8.h"
+
+// As in the ellipsoid kernel every lane does what the scalar version does,
+// in the same order, and the lanes with hits are taken in order.
+
+namespace {
+AVX2 inline __m256 abs8(__m256 a)
+{
+  return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a);
+}
+
+// v with lane's y lowered by height
+AVX2 inline Vec8 lowered8(const Vec8& v, __m256 height)
+{
+  Vec8 r = { v.x, _mm256_sub_ps(v.y, height), v.z };
+  return r;
+}
+
+AVX2 inline Vec8 negated8(const Vec8& v)
+{
+  Vec8 r = { negate8(v.x), negate8(v.y), negate8(v.z) };
+  return r;
+}
+
+// the lanes' nearest hits, in lane order against the nearest hit so far
+AVX2 inline bool takeLanes(int mask, __m256 laneT, __m256 starts, const Vec8& lanePoint,
+                           float& t, vec3& collisionPoint)
+{
+  float times[8], first[8], x[8], y[8], z[8];
+  _mm256_storeu_ps(times, laneT);
+  _mm256_storeu_ps(first, starts);
+  _mm256_storeu_ps(x, lanePoint.x);
+  _mm256_storeu_ps(y, lanePoint.y);
+  _mm256_storeu_ps(z, lanePoint.z);
+  bool found = false;
+  for (int j = 0; j < 8; j++) {
+    if ((mask >> j & 1) && !(first[j] >= t) && times[j] < t) {
+      t = times[j];
+      collisionPoint = vec3(x[j], y[j], z[j]);
+      found = true;
+    }
+  }
+  return found;
+}
+
+AVX2 inline __m256 boundsMask8(const TriangleStore& store, unsigned int i,
+                               const Vec8& boxLower, const Vec8& boxUpper)
+{
+  Vec8 lower = load8(store.lower, i), upper = load8(store.upper, i);
+  return _mm256_and_ps(
+    _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(lower.x, boxUpper.x, _CMP_LE_OQ),
+                                _mm256_cmp_ps(upper.x, boxLower.x, _CMP_GE_OQ)),
+                  _mm256_and_ps(_mm256_cmp_ps(lower.y, boxUpper.y, _CMP_LE_OQ),
+                                _mm256_cmp_ps(upper.y, boxLower.y, _CMP_GE_OQ))),
+    _mm256_and_ps(_mm256_cmp_ps(lower.z, boxUpper.z, _CMP_LE_OQ),
+                  _mm256_cmp_ps(upper.z, boxLower.z, _CMP_GE_OQ)));
+}
+}
+
+AVX2 void checkCapsuleTrianglesAVX2(CollisionPacket* colPackage, const TriangleStore& store,
+                                    unsigned int first, unsigned int count, const AABB& box)
+{
+  CapsuleTerms sweep(colPackage);
+  if (sweep.velocitySquaredLength == 0.0f)
+    return;
+
+  const __m256 zero = _mm256_setzero_ps();
+  const __m256 one = _mm256_set1_ps(1.0f);
+  const __m256 two = _mm256_set1_ps(2.0f);
+  const __m256 radius = _mm256_set1_ps(sweep.radius);
+  const __m256 radiusSquared = _mm256_set1_ps(sweep.radiusSquared);
+  const __m256 half = _mm256_set1_ps(sweep.half);
+  const __m256 all = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+  const Vec8 base = broadcast8(sweep.base);
+  const Vec8 velocity = broadcast8(sweep.velocity);
+  const __m256 velocitySquaredLength = _mm256_set1_ps(sweep.velocitySquaredLength);
+  const __m256 minusVelocitySquaredLength = negate8(velocitySquaredLength);
+  const Vec8 boxLower = broadcast8(box.lower);
+  const Vec8 boxUpper = broadcast8(box.upper);
+  const float flatSquared = sweep.velocity[0] * sweep.velocity[0] +
+                            sweep.velocity[2] * sweep.velocity[2];
+
+  float t = sweepLimit(colPackage, sweep.speed);
+  vec3 collisionPoint;
+  bool found = false;
+
+  unsigned int end = first + count;
+  unsigned int i = first;
+  for (; i + 8 <= end; i += 8) {
+    __m256 limit = _mm256_set1_ps(t);
+    __m256 valid = boundsMask8(store, i, boxLower, boxUpper);
+    if (_mm256_movemask_ps(valid) == 0)
+      continue;
+
+    // back faces only with features of their own
+    Vec8 normal = load8(store.normals, i);
+    __m256 normalDotVelocity = dot8(normal, velocity);
+    __m256i stored = _mm256_loadu_si256((const __m256i *)&store.features[i]);
+    __m256 backFace = _mm256_cmp_ps(normalDotVelocity, zero, _CMP_GT_OQ);
+    __m256 backOk = _mm256_andnot_ps(
+      _mm256_castsi256_ps(_mm256_cmpeq_epi32(
+        _mm256_and_si256(_mm256_srli_epi32(stored, FEATURES_BACK), _mm256_set1_epi32(0x3f)),
+        _mm256_setzero_si256())),
+      backFace);
+    valid = _mm256_and_ps(valid, _mm256_or_ps(_mm256_andnot_ps(backFace, all), backOk));
+
+    __m256 reach = _mm256_add_ps(radius, _mm256_mul_ps(half, abs8(normal.y)));
+    __m256 signedDistance = _mm256_add_ps(dot8(normal, base), _mm256_loadu_ps(&store.d[i]));
+    __m256 embedded = _mm256_cmp_ps(normalDotVelocity, zero, _CMP_EQ_OQ);
+    __m256 embeddedOk = _mm256_cmp_ps(abs8(signedDistance), reach, _CMP_NGE_UQ);
+
+    __m256 t0 = _mm256_div_ps(_mm256_sub_ps(negate8(reach), signedDistance), normalDotVelocity);
+    __m256 t1 = _mm256_div_ps(_mm256_sub_ps(reach, signedDistance), normalDotVelocity);
+    __m256 swap = _mm256_cmp_ps(t0, t1, _CMP_GT_OQ);
+    __m256 lowerT = _mm256_blendv_ps(t0, t1, swap);
+    __m256 upperT = _mm256_blendv_ps(t1, t0, swap);
+    __m256 intervalOk = _mm256_andnot_ps(
+      _mm256_or_ps(_mm256_cmp_ps(lowerT, one, _CMP_GT_OQ), _mm256_cmp_ps(upperT, zero, _CMP_LT_OQ)),
+      all);
+    lowerT = _mm256_blendv_ps(zero, lowerT, _mm256_cmp_ps(lowerT, zero, _CMP_GT_OQ));
+    lowerT = _mm256_blendv_ps(one, lowerT, _mm256_cmp_ps(lowerT, one, _CMP_LT_OQ));
+    t0 = _mm256_blendv_ps(lowerT, zero, embedded);
+
+    valid = _mm256_and_ps(valid, _mm256_blendv_ps(intervalOk, embeddedOk, embedded));
+    valid = _mm256_and_ps(valid, _mm256_cmp_ps(t0, limit, _CMP_NGE_UQ));
+    if (_mm256_movemask_ps(valid) == 0)
+      continue;
+
+    // the features for each lane's kind of sweep
+    __m256 outside = _mm256_cmp_ps(t0, zero, _CMP_GT_OQ);
+    __m256i shift = _mm256_castps_si256(_mm256_blendv_ps(
+      _mm256_blendv_ps(_mm256_castsi256_ps(_mm256_set1_epi32(FEATURES_SUNK)),
+                       _mm256_castsi256_ps(_mm256_set1_epi32(FEATURES_OUTSIDE)), outside),
+      _mm256_castsi256_ps(_mm256_set1_epi32(FEATURES_BACK)), backFace));
+    __m256i features = sweptFeatures8(store, i, stored, _mm256_srlv_epi32(stored, shift),
+                                      backFace, velocity);
+    __m256 frontFace = _mm256_andnot_ps(backFace, all);
+
+    Vec8 p[3] = { load8(store.vertices[0], i), load8(store.vertices[1], i),
+                  load8(store.vertices[2], i) };
+    Vec8 edge[3] = { load8(store.edges[0], i), load8(store.edges[1], i),
+                     load8(store.edges[2], i) };
+
+    // inside of the face, touched by the end nearest the plane
+    __m256 faceEnd = _mm256_blendv_ps(
+      _mm256_blendv_ps(zero, half, _mm256_cmp_ps(normal.y, zero, _CMP_LT_OQ)),
+      negate8(half), _mm256_cmp_ps(normal.y, zero, _CMP_GT_OQ));
+    Vec8 endBase = { base.x, _mm256_add_ps(base.y, faceEnd), base.z };
+    Vec8 offset = { _mm256_mul_ps(normal.x, radius), _mm256_mul_ps(normal.y, radius),
+                    _mm256_mul_ps(normal.z, radius) };
+    Vec8 point = madd8(sub8(endBase, offset), t0, velocity);
+    Vec8 w = sub8(point, p[0]);
+    Vec8 vw = cross8(negated8(edge[2]), w);
+    Vec8 uw = cross8(edge[0], w);
+    __m256 inside = _mm256_and_ps(
+      _mm256_and_ps(_mm256_cmp_ps(dot8(vw, normal), zero, _CMP_LE_OQ),
+                    _mm256_cmp_ps(dot8(uw, normal), zero, _CMP_GE_OQ)),
+      _mm256_cmp_ps(_mm256_add_ps(_mm256_sqrt_ps(dot8(vw, vw)), _mm256_sqrt_ps(dot8(uw, uw))),
+                    _mm256_loadu_ps(&store.areas[i]), _CMP_LE_OQ));
+    __m256 hit = _mm256_andnot_ps(embedded,
+                                  _mm256_and_ps(_mm256_and_ps(valid, frontFace), inside));
+
+    __m256 laneT = _mm256_blendv_ps(limit, t0, hit);
+    Vec8 lanePoint = lowered8(point, faceEnd);
+    __m256 rest = _mm256_andnot_ps(hit, valid);
+
+    if (_mm256_movemask_ps(rest) != 0) {
+      __m256 root;
+      for (int cap = 0; cap < 2; cap++) {
+        Vec8 capBase = broadcast8(sweep.caps[cap]);
+        __m256 capEnd = _mm256_set1_ps(sweep.caps[cap][1] - sweep.base[1]);
+
+        for (int k = 0; k < 3; k++) {
+          Vec8 baseToVertex = sub8(capBase, p[k]);
+          __m256 b = _mm256_mul_ps(two, dot8(velocity, baseToVertex));
+          __m256 c = _mm256_sub_ps(dot8(baseToVertex, baseToVertex), radiusSquared);
+          __m256 startsOutside = _mm256_cmp_ps(c, zero, _CMP_GT_OQ);
+          __m256 away = _mm256_and_ps(startsOutside, _mm256_cmp_ps(b, zero, _CMP_GE_OQ));
+          __m256 tested = _mm256_and_ps(rest, bit8(features, 3 + k));
+          __m256 vertexHit = _mm256_andnot_ps(away, _mm256_and_ps(tested,
+            lowestRoot8(velocitySquaredLength, b, c, laneT, root)));
+          laneT = _mm256_blendv_ps(laneT, root, vertexHit);
+          lanePoint = select8(lanePoint, lowered8(p[k], capEnd), vertexHit);
+          hit = _mm256_or_ps(hit, vertexHit);
+        }
+
+        for (int k = 0; k < 3; k++) {
+          Vec8 baseToVertex = sub8(p[k], capBase);
+          __m256 edgeSquaredLength = _mm256_loadu_ps(&store.edgeLengths[k][i]);
+          __m256 edgeDotVelocity = dot8(edge[k], velocity);
+          __m256 edgeDotBaseToVertex = dot8(edge[k], baseToVertex);
+
+          __m256 a = _mm256_add_ps(_mm256_mul_ps(edgeSquaredLength, minusVelocitySquaredLength),
+                                   _mm256_mul_ps(edgeDotVelocity, edgeDotVelocity));
+          __m256 b = _mm256_sub_ps(
+            _mm256_mul_ps(edgeSquaredLength, _mm256_mul_ps(two, dot8(velocity, baseToVertex))),
+            _mm256_mul_ps(_mm256_mul_ps(two, edgeDotVelocity), edgeDotBaseToVertex));
+          __m256 c = _mm256_add_ps(
+            _mm256_mul_ps(edgeSquaredLength,
+                          _mm256_sub_ps(radiusSquared, dot8(baseToVertex, baseToVertex))),
+            _mm256_mul_ps(edgeDotBaseToVertex, edgeDotBaseToVertex));
+
+          __m256 tested = _mm256_and_ps(rest, bit8(features, k));
+          __m256 edgeHit = _mm256_and_ps(tested, lowestRoot8(a, b, c, laneT, root));
+          __m256 f = _mm256_div_ps(_mm256_sub_ps(_mm256_mul_ps(edgeDotVelocity, root),
+                                                 edgeDotBaseToVertex), edgeSquaredLength);
+          __m256 offEdge = _mm256_or_ps(_mm256_cmp_ps(f, zero, _CMP_LT_OQ),
+                                        _mm256_cmp_ps(f, one, _CMP_GT_OQ));
+          edgeHit = _mm256_andnot_ps(offEdge, edgeHit);
+          laneT = _mm256_blendv_ps(laneT, root, edgeHit);
+          lanePoint = select8(lanePoint, lowered8(madd8(p[k], f, edge[k]), capEnd), edgeHit);
+          hit = _mm256_or_ps(hit, edgeHit);
+        }
+      }
+
+      // the side against the vertices
+      if (flatSquared > 0.0f) {
+        __m256 a = _mm256_set1_ps(flatSquared);
+        for (int k = 0; k < 3; k++) {
+          __m256 x = _mm256_sub_ps(base.x, p[k].x);
+          __m256 z = _mm256_sub_ps(base.z, p[k].z);
+          __m256 b = _mm256_mul_ps(two, _mm256_add_ps(_mm256_mul_ps(velocity.x, x),
+                                                      _mm256_mul_ps(velocity.z, z)));
+          __m256 c = _mm256_sub_ps(_mm256_add_ps(_mm256_mul_ps(x, x), _mm256_mul_ps(z, z)),
+                                   radiusSquared);
+          __m256 startsOutside = _mm256_cmp_ps(c, zero, _CMP_GT_OQ);
+          __m256 away = _mm256_and_ps(startsOutside, _mm256_cmp_ps(b, zero, _CMP_GE_OQ));
+          __m256 tested = _mm256_and_ps(rest, bit8(features, 3 + k));
+          __m256 vertexHit = _mm256_andnot_ps(away, _mm256_and_ps(tested,
+            lowestRoot8(a, b, c, laneT, root)));
+          __m256 height = _mm256_sub_ps(p[k].y, _mm256_add_ps(base.y,
+                                                              _mm256_mul_ps(root, velocity.y)));
+          vertexHit = _mm256_and_ps(vertexHit, _mm256_cmp_ps(abs8(height), half, _CMP_NGT_UQ));
+          laneT = _mm256_blendv_ps(laneT, root, vertexHit);
+          lanePoint = select8(lanePoint, lowered8(p[k], height), vertexHit);
+          hit = _mm256_or_ps(hit, vertexHit);
+        }
+      }
+
+      // the side against the edges
+      for (int k = 0; k < 3; k++) {
+        __m256 lengthSquared = _mm256_add_ps(_mm256_mul_ps(edge[k].z, edge[k].z),
+                                             _mm256_mul_ps(edge[k].x, edge[k].x));
+        Vec8 w = sub8(p[k], base);
+        __m256 s = _mm256_sub_ps(_mm256_mul_ps(w.x, edge[k].z), _mm256_mul_ps(w.z, edge[k].x));
+        __m256 speed = _mm256_sub_ps(_mm256_mul_ps(velocity.x, edge[k].z),
+                                     _mm256_mul_ps(velocity.z, edge[k].x));
+        __m256 distance = _mm256_mul_ps(radius, _mm256_sqrt_ps(lengthSquared));
+        __m256 side = _mm256_blendv_ps(negate8(distance), distance,
+                                       _mm256_cmp_ps(s, zero, _CMP_GT_OQ));
+        __m256 edgeT = _mm256_div_ps(_mm256_sub_ps(s, side), speed);
+        __m256 edgeHit = _mm256_and_ps(
+          _mm256_and_ps(_mm256_and_ps(rest, bit8(features, k)),
+                        _mm256_cmp_ps(lengthSquared, zero, _CMP_GT_OQ)),
+          _mm256_and_ps(_mm256_cmp_ps(abs8(s), distance, _CMP_GT_OQ),
+                        _mm256_and_ps(_mm256_cmp_ps(edgeT, zero, _CMP_GE_OQ),
+                                      _mm256_cmp_ps(edgeT, laneT, _CMP_LT_OQ))));
+
+        Vec8 r = sub8(madd8(base, edgeT, velocity), p[k]);
+        __m256 f = _mm256_div_ps(_mm256_sub_ps(dot8(edge[k], r), _mm256_mul_ps(edge[k].y, r.y)),
+                                 lengthSquared);
+        __m256 height = _mm256_sub_ps(_mm256_mul_ps(f, edge[k].y), r.y);
+        __m256 outside = _mm256_or_ps(
+          _mm256_or_ps(_mm256_cmp_ps(f, zero, _CMP_LT_OQ), _mm256_cmp_ps(f, one, _CMP_GT_OQ)),
+          _mm256_cmp_ps(abs8(height), half, _CMP_GT_OQ));
+        edgeHit = _mm256_andnot_ps(outside, edgeHit);
+        laneT = _mm256_blendv_ps(laneT, edgeT, edgeHit);
+        lanePoint = select8(lanePoint, lowered8(madd8(p[k], f, edge[k]), height), edgeHit);
+        hit = _mm256_or_ps(hit, edgeHit);
+      }
+    }
+
+    int mask = _mm256_movemask_ps(hit);
+    if (mask != 0 && takeLanes(mask, laneT, t0, lanePoint, t, collisionPoint))
+      found = true;
+  }
+
+  for (; i < end; i++) {
+    if (overlapsBox(store, i, box) && sweepCapsuleTriangle(sweep, store, i, t, collisionPoint))
+      found = true;
+  }
+  if (found)
+    recordShapeHit(colPackage, sweep.speed, t, collisionPoint);
+}
+
+namespace {
+// sweepAxis on eight triangles, for the lanes in used; the mask of those
+// the axis separates for the whole sweep. The edges are floats here.
+struct AxisSweep8 {
+  __m256 first, last;
+  Vec8 firstNormal;
+  __m256 firstEdge;
+  __m256 depth;
+  Vec8 depthNormal;
+  __m256 depthEdge;
+};
+
+AVX2 inline __m256 sweepAxis8(const BoxTerms& sweep, const Vec8 p[3], const Vec8& axis,
+                              float edge, __m256 used, AxisSweep8& result)
+{
+  const __m256 zero = _mm256_setzero_ps();
+  __m256 center = dot8(broadcast8(sweep.base), axis);
+  __m256 extent = _mm256_add_ps(
+    _mm256_add_ps(
+      _mm256_mul_ps(_mm256_set1_ps(sweep.half[0]), abs8(dot8(broadcast8(sweep.axes[0]), axis))),
+      _mm256_mul_ps(_mm256_set1_ps(sweep.half[1]), abs8(dot8(broadcast8(sweep.axes[1]), axis)))),
+    _mm256_mul_ps(_mm256_set1_ps(sweep.half[2]), abs8(dot8(broadcast8(sweep.axes[2]), axis))));
+  __m256 q0 = dot8(p[0], axis), q1 = dot8(p[1], axis), q2 = dot8(p[2], axis);
+  __m256 lower = _mm256_min_ps(_mm256_min_ps(q0, q1), q2);
+  __m256 upper = _mm256_max_ps(_mm256_max_ps(q0, q1), q2);
+  __m256 below = _mm256_sub_ps(lower, _mm256_add_ps(center, extent));
+  __m256 above = _mm256_sub_ps(_mm256_sub_ps(center, extent), upper);
+  __m256 speed = dot8(broadcast8(sweep.velocity), axis);
+
+  __m256 still = _mm256_cmp_ps(speed, zero, _CMP_EQ_OQ);
+  __m256 separated = _mm256_and_ps(_mm256_and_ps(used, still),
+    _mm256_or_ps(_mm256_cmp_ps(below, zero, _CMP_GT_OQ), _mm256_cmp_ps(above, zero, _CMP_GT_OQ)));
+
+  __m256 forward = _mm256_cmp_ps(speed, zero, _CMP_GT_OQ);
+  __m256 enterBelow = _mm256_div_ps(below, speed);
+  __m256 leaveAbove = _mm256_div_ps(negate8(above), speed);
+  __m256 enter = _mm256_blendv_ps(leaveAbove, enterBelow, forward);
+  __m256 leave = _mm256_blendv_ps(enterBelow, leaveAbove, forward);
+  __m256 moving = _mm256_andnot_ps(still, used);
+  __m256 later = _mm256_and_ps(moving, _mm256_cmp_ps(enter, result.first, _CMP_GT_OQ));
+  result.first = _mm256_blendv_ps(result.first, enter, later);
+  result.firstNormal = select8(result.firstNormal, select8(axis, negated8(axis), forward), later);
+  result.firstEdge = _mm256_blendv_ps(result.firstEdge, _mm256_set1_ps(edge), later);
+  result.last = _mm256_blendv_ps(result.last, _mm256_min_ps(result.last, leave), moving);
+
+  __m256 length = _mm256_sqrt_ps(dot8(axis, axis));
+  __m256 depth = _mm256_div_ps(_mm256_min_ps(negate8(below), negate8(above)), length);
+  __m256 deeper = _mm256_and_ps(used, _mm256_cmp_ps(depth, result.depth, _CMP_LT_OQ));
+  result.depth = _mm256_blendv_ps(result.depth, depth, deeper);
+  __m256 fromBelow = _mm256_cmp_ps(negate8(below), negate8(above), _CMP_LT_OQ);
+  result.depthNormal = select8(result.depthNormal, select8(axis, negated8(axis), fromBelow),
+                               deeper);
+  result.depthEdge = _mm256_blendv_ps(result.depthEdge, _mm256_set1_ps(edge), deeper);
+  return separated;
+}
+}
+
+AVX2 void checkBoxTrianglesAVX2(CollisionPacket* colPackage, const TriangleStore& store,
+                                unsigned int first, unsigned int count, const AABB& box)
+{
+  BoxTerms sweep(colPackage);
+  if (sweep.velocitySquaredLength == 0.0f)
+    return;
+
+  const __m256 zero = _mm256_setzero_ps();
+  const __m256 all = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+  const __m256 parallel = _mm256_set1_ps(BOX_PARALLEL);
+  const __m256 radius = _mm256_set1_ps(sweep.radius);
+  const Vec8 base = broadcast8(sweep.base);
+  const Vec8 velocity = broadcast8(sweep.velocity);
+  const Vec8 boxLower = broadcast8(box.lower);
+  const Vec8 boxUpper = broadcast8(box.upper);
+
+  float t = sweepLimit(colPackage, sweep.speed);
+  vec3 collisionPoint;
+  bool found = false;
+
+  unsigned int end = first + count;
+  unsigned int i = first;
+  for (; i + 8 <= end; i += 8) {
+    __m256 valid = boundsMask8(store, i, boxLower, boxUpper);
+    if (_mm256_movemask_ps(valid) == 0)
+      continue;
+    // back faces only with features of their own
+    Vec8 normal = load8(store.normals, i);
+    __m256i stored = _mm256_loadu_si256((const __m256i *)&store.features[i]);
+    __m256 backFace = _mm256_cmp_ps(dot8(normal, velocity), zero, _CMP_GT_OQ);
+    __m256 backOk = _mm256_andnot_ps(
+      _mm256_castsi256_ps(_mm256_cmpeq_epi32(
+        _mm256_and_si256(_mm256_srli_epi32(stored, FEATURES_BACK), _mm256_set1_epi32(0x3f)),
+        _mm256_setzero_si256())),
+      backFace);
+    valid = _mm256_and_ps(valid, _mm256_or_ps(_mm256_andnot_ps(backFace, all), backOk));
+    if (_mm256_movemask_ps(valid) == 0)
+      continue;
+
+    Vec8 p[3] = { load8(store.vertices[0], i), load8(store.vertices[1], i),
+                  load8(store.vertices[2], i) };
+    Vec8 edge[3] = { load8(store.edges[0], i), load8(store.edges[1], i),
+                     load8(store.edges[2], i) };
+
+    AxisSweep8 overlap;
+    overlap.first = _mm256_set1_ps(-FLT_MAX);
+    overlap.last = _mm256_set1_ps(FLT_MAX);
+    overlap.depth = _mm256_set1_ps(FLT_MAX);
+    overlap.firstNormal = broadcast8(vec3(0.0f));
+    overlap.depthNormal = overlap.firstNormal;
+    overlap.firstEdge = _mm256_set1_ps(-1.0f);
+    overlap.depthEdge = overlap.firstEdge;
+
+    __m256 separated = sweepAxis8(sweep, p, normal, -1.0f, all, overlap);
+    // the features for each lane's kind of sweep
+    __m256 outside = _mm256_cmp_ps(overlap.first, zero, _CMP_GT_OQ);
+    __m256i shift = _mm256_castps_si256(_mm256_blendv_ps(
+      _mm256_blendv_ps(_mm256_castsi256_ps(_mm256_set1_epi32(FEATURES_SUNK)),
+                       _mm256_castsi256_ps(_mm256_set1_epi32(FEATURES_OUTSIDE)), outside),
+      _mm256_castsi256_ps(_mm256_set1_epi32(FEATURES_BACK)), backFace));
+    __m256i features = sweptFeatures8(store, i, stored, _mm256_srlv_epi32(stored, shift),
+                                      backFace, velocity);
+    for (int k = 0; k < 3; k++)
+      separated = _mm256_or_ps(separated, sweepAxis8(sweep, p, broadcast8(sweep.axes[k]), -1.0f,
+                                                     all, overlap));
+    for (int k = 0; k < 3; k++) {
+      for (int j = 0; j < 3; j++) {
+        Vec8 axis = cross8(broadcast8(sweep.axes[k]), edge[j]);
+        __m256 used = _mm256_cmp_ps(dot8(axis, axis),
+                                    _mm256_mul_ps(parallel, _mm256_loadu_ps(&store.edgeLengths[j][i])),
+                                    _CMP_GT_OQ);
+        separated = _mm256_or_ps(separated, sweepAxis8(sweep, p, axis, (float)j, used, overlap));
+      }
+    }
+    valid = _mm256_andnot_ps(separated, valid);
+    valid = _mm256_andnot_ps(
+      _mm256_or_ps(_mm256_cmp_ps(overlap.first, overlap.last, _CMP_GT_OQ),
+                   _mm256_cmp_ps(overlap.last, zero, _CMP_LT_OQ)), valid);
+
+    __m256 ahead = _mm256_cmp_ps(overlap.first, zero, _CMP_GE_OQ);
+    __m256 hitT = _mm256_blendv_ps(zero, overlap.first, ahead);
+    Vec8 hitNormal = select8(overlap.depthNormal, overlap.firstNormal, ahead);
+    valid = _mm256_and_ps(valid, _mm256_or_ps(ahead,
+      _mm256_cmp_ps(dot8(hitNormal, velocity), zero, _CMP_LT_OQ)));
+
+    // an edge's hit only if the edge is tested, a back face has no others
+    __m256 hitEdge = _mm256_blendv_ps(overlap.depthEdge, overlap.firstEdge, ahead);
+    __m256 onEdge = _mm256_cmp_ps(hitEdge, zero, _CMP_GE_OQ);
+    __m256 tested = zero;
+    for (int j = 0; j < 3; j++)
+      tested = _mm256_or_ps(tested, _mm256_and_ps(
+        _mm256_cmp_ps(hitEdge, _mm256_set1_ps((float)j), _CMP_EQ_OQ), bit8(features, j)));
+    __m256 frontOk = _mm256_andnot_ps(backFace, _mm256_or_ps(_mm256_andnot_ps(onEdge, all), tested));
+    __m256 backEdgeOk = _mm256_and_ps(_mm256_and_ps(backFace, tested), ahead);
+    valid = _mm256_and_ps(valid, _mm256_or_ps(frontOk, backEdgeOk));
+    int mask = _mm256_movemask_ps(valid);
+    if (mask == 0)
+      continue;
+
+    __m256 length = _mm256_sqrt_ps(dot8(hitNormal, hitNormal));
+    Vec8 unit = { _mm256_div_ps(hitNormal.x, length), _mm256_div_ps(hitNormal.y, length),
+                  _mm256_div_ps(hitNormal.z, length) };
+    Vec8 offset = { _mm256_mul_ps(unit.x, radius), _mm256_mul_ps(unit.y, radius),
+                    _mm256_mul_ps(unit.z, radius) };
+    Vec8 point = sub8(madd8(base, hitT, velocity), offset);
+    if (takeLanes(mask, hitT, hitT, point, t, collisionPoint))
+      found = true;
+  }
+
+  for (; i < end; i++) {
+    if (overlapsBox(store, i, box) && sweepBoxTriangle(sweep, store, i, t, collisionPoint))
+      found = true;
+  }
+  if (found)
+    recordShapeHit(colPackage, sweep.speed, t, collisionPoint);
+}
+#endif
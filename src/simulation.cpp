@@ -0,0 +1,118 @@
+#include "simulation.h"
+
+vec3 SimulationSnapshot::interpolated(unsigned int i, double time) const
+{
+  float alpha = (float)((time - this->time) / tickLength);
+  alpha = MIN(MAX(alpha, 0.0f), 1.0f);
+  return previousPositions[i] + (positions[i] - previousPositions[i]) * alpha;
+}
+
+SimulationThread::SimulationThread(CollisionWorld *world, CharacterGroup *group,
+                                   CharacterEntity *player, double rate, WorkerPool *pool)
+  : timestep(rate)
+{
+  this->world = world;
+  this->group = group;
+  this->player = player;
+  this->pool = pool;
+  ticks = 0;
+  running = false;
+  inputs.write().push = vec3(0.0f);
+  inputs.publish();
+}
+
+SimulationThread::~SimulationThread()
+{
+  stop();
+}
+
+void SimulationThread::start()
+{
+  if (running)
+    return;
+  started = std::chrono::steady_clock::now();
+  timestep.accumulator = 0.0;
+  publish(0.0);
+  running = true;
+  thread = std::thread(&SimulationThread::run, this);
+}
+
+void SimulationThread::stop()
+{
+  if (!running)
+    return;
+  running = false;
+  thread.join();
+}
+
+double SimulationThread::clock() const
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+}
+
+void SimulationThread::setInput(const PlayerInput& input)
+{
+  inputs.write() = input;
+  inputs.publish();
+}
+
+const SimulationSnapshot& SimulationThread::latest()
+{
+  return snapshots.read();
+}
+
+void SimulationThread::run()
+{
+  double last = clock();
+  while (running) {
+    double now = clock();
+    unsigned int due = timestep.advance(now - last);
+    last = now;
+
+    if (due > 0) {
+      // the newest input for every tick of a frame that fell behind
+      PlayerInput input = inputs.read();
+      for (unsigned int i = 0; i < due; i++)
+        tick(input);
+      publish(now - timestep.accumulator);
+    }
+
+    // asleep until the next tick is due
+    std::this_thread::sleep_for(
+      std::chrono::duration<double>(timestep.tickLength - timestep.accumulator));
+  }
+}
+
+// what main used to do once a frame
+void SimulationThread::tick(const PlayerInput& input)
+{
+  float tickLength = (float)timestep.tickLength;
+  player->velocity += input.push * tickLength;
+
+  // pick up collision trees rebuilt in the background for moving geometry
+  world->update();
+  group->update(pool);
+  player->velocity = player->velocity * 0.7f;
+  ticks++;
+}
+
+void SimulationThread::publish(double time)
+{
+  SimulationSnapshot& snapshot = snapshots.write();
+  const std::vector<CharacterEntity*>& entities = group->entities;
+  snapshot.tick = ticks;
+  snapshot.time = time;
+  snapshot.tickLength = timestep.tickLength;
+  snapshot.previousPositions.resize(entities.size());
+  snapshot.positions.resize(entities.size());
+  snapshot.grounded.resize(entities.size());
+  snapshot.player = 0;
+  for (unsigned int i = 0; i < entities.size(); i++) {
+    snapshot.previousPositions[i] = entities[i]->previousPosition;
+    snapshot.positions[i] = entities[i]->position;
+    snapshot.grounded[i] = entities[i]->grounded;
+    if (entities[i] == player)
+      snapshot.player = i;
+  }
+  snapshots.publish();
+}
@@ -0,0 +1,218 @@
+#include "sweepprune.h"
+
+#include <algorithm>
+
+// Endpoint order of the axes, lower ends first on ties so touching boxes
+// overlap like AABB::overlaps.
+static inline bool endpointBefore(const SAPEndpoint& a, const SAPEndpoint& b)
+{
+  return a.value < b.value ||
+         (a.value == b.value && !(a.owner & 1) && (b.owner & 1));
+}
+
+SweepAndPrune::SweepAndPrune()
+{
+  added = 0;
+}
+
+unsigned int SweepAndPrune::add(const AABB& box)
+{
+  unsigned int handle;
+  if (!freeHandles.empty()) {
+    handle = freeHandles.back();
+    freeHandles.pop_back();
+  }
+  else {
+    handle = alive.size();
+    alive.push_back(false);
+    boxes.push_back(AABB());
+    partners.push_back(std::vector<unsigned int>());
+    for (int a = 0; a < 3; a++)
+      positions[a].resize(alive.size() * 2);
+  }
+
+  // new ends go last, lower end first, so the box starts out past every
+  // other one and overlapping none; the sort moves it into place
+  for (int a = 0; a < 3; a++) {
+    for (unsigned int end = 0; end < 2; end++) {
+      SAPEndpoint endpoint;
+      endpoint.value = end ? box.upper[a] : box.lower[a];
+      endpoint.owner = handle << 1 | end;
+      positions[a][endpoint.owner] = axes[a].size();
+      axes[a].push_back(endpoint);
+    }
+  }
+
+  boxes[handle] = box;
+  alive[handle] = true;
+  added++;
+  return handle;
+}
+
+void SweepAndPrune::remove(unsigned int handle)
+{
+  if (handle >= alive.size() || !alive[handle])
+    return;
+
+  // walk both ends past every other one to drop them, the order of the
+  // rest stays sorted
+  for (int a = 0; a < 3; a++) {
+    moveToEnd(a, handle << 1 | 1);
+    moveToEnd(a, handle << 1);
+    axes[a].pop_back();
+    axes[a].pop_back();
+  }
+
+  while (!partners[handle].empty())
+    unlink(handle, partners[handle].back());
+
+  alive[handle] = false;
+  freeHandles.push_back(handle);
+}
+
+void SweepAndPrune::moveToEnd(int axis, unsigned int owner)
+{
+  std::vector<SAPEndpoint>& list = axes[axis];
+  std::vector<unsigned int>& position = positions[axis];
+
+  for (unsigned int i = position[owner]; i + 1 < list.size(); i++) {
+    std::swap(list[i], list[i+1]);
+    position[list[i].owner] = i;
+    position[list[i+1].owner] = i + 1;
+  }
+}
+
+// A lower end moving left past an upper end starts an overlap on this
+// axis, which is a pair if the boxes overlap on the others too. An upper
+// end moving left past a lower end separates the boxes.
+void SweepAndPrune::passed(const SAPEndpoint& moving, const SAPEndpoint& other)
+{
+  unsigned int a = moving.owner >> 1, b = other.owner >> 1;
+  bool lower = !(moving.owner & 1), otherLower = !(other.owner & 1);
+  if (a == b || lower == otherLower)
+    return;
+
+  if (lower) {
+    if (boxes[a].overlaps(boxes[b]))
+      link(a, b);
+  }
+  else {
+    unlink(a, b);
+  }
+}
+
+// a box overlaps a handful of others at most, so the lists are searched
+void SweepAndPrune::link(unsigned int a, unsigned int b)
+{
+  std::vector<unsigned int>& list = partners[a];
+  if (std::find(list.begin(), list.end(), b) != list.end())
+    return;
+  list.push_back(b);
+  partners[b].push_back(a);
+}
+
+void SweepAndPrune::unlink(unsigned int a, unsigned int b)
+{
+  for (int side = 0; side < 2; side++) {
+    std::vector<unsigned int>& list = partners[side ? b : a];
+    unsigned int other = side ? a : b;
+    std::vector<unsigned int>::iterator found = std::find(list.begin(), list.end(), other);
+    if (found != list.end()) {
+      *found = list.back();
+      list.pop_back();
+    }
+  }
+}
+
+void SweepAndPrune::update(unsigned int handle, const AABB& box)
+{
+  if (handle >= alive.size() || !alive[handle])
+    return;
+
+  boxes[handle] = box;
+  for (int a = 0; a < 3; a++) {
+    axes[a][positions[a][handle << 1]].value = box.lower[a];
+    axes[a][positions[a][handle << 1 | 1]].value = box.upper[a];
+  }
+}
+
+void SweepAndPrune::sort()
+{
+  // the insertion sort walks every new end past most of the others
+  if (added > 64 && added * 4 > axes[0].size() / 2) {
+    rebuild();
+  }
+  else {
+    for (int a = 0; a < 3; a++)
+      sortAxis(a);
+  }
+  added = 0;
+}
+
+void SweepAndPrune::rebuild()
+{
+  for (int a = 0; a < 3; a++) {
+    std::sort(axes[a].begin(), axes[a].end(), endpointBefore);
+    for (unsigned int i = 0; i < axes[a].size(); i++)
+      positions[a][axes[a][i].owner] = i;
+  }
+
+  // sweep the x axis keeping the boxes whose interval is open
+  for (unsigned int i = 0; i < partners.size(); i++)
+    partners[i].clear();
+  std::vector<unsigned int> open;
+  std::vector<unsigned int> openIndex(alive.size());
+  for (unsigned int i = 0; i < axes[0].size(); i++) {
+    unsigned int owner = axes[0][i].owner, handle = owner >> 1;
+    if (owner & 1) {
+      unsigned int last = open.back();
+      open[openIndex[handle]] = last;
+      openIndex[last] = openIndex[handle];
+      open.pop_back();
+      continue;
+    }
+    for (unsigned int j = 0; j < open.size(); j++) {
+      if (boxes[handle].overlaps(boxes[open[j]])) {
+        partners[handle].push_back(open[j]);
+        partners[open[j]].push_back(handle);
+      }
+    }
+    openIndex[handle] = open.size();
+    open.push_back(handle);
+  }
+}
+
+void SweepAndPrune::sortAxis(int axis)
+{
+  std::vector<SAPEndpoint>& list = axes[axis];
+  std::vector<unsigned int>& position = positions[axis];
+
+  for (unsigned int i = 1; i < list.size(); i++) {
+    SAPEndpoint endpoint = list[i];
+    unsigned int j = i;
+
+    while (j > 0 && endpointBefore(endpoint, list[j-1])) {
+      const SAPEndpoint& other = list[j-1];
+      passed(endpoint, other);
+
+      list[j] = other;
+      position[other.owner] = j;
+      j--;
+    }
+
+    list[j] = endpoint;
+    position[endpoint.owner] = j;
+  }
+}
+
+void SweepAndPrune::pairs(std::vector<std::pair<unsigned int, unsigned int> >& result) const
+{
+  for (unsigned int a = 0; a < partners.size(); a++) {
+    unsigned int first = result.size();
+    for (unsigned int i = 0; i < partners[a].size(); i++) {
+      if (partners[a][i] > a)
+        result.push_back(std::make_pair(a, partners[a][i]));
+    }
+    std::sort(result.begin() + first, result.end());
+  }
+}
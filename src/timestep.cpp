@@ -0,0 +1,37 @@
+#include "timestep.h"
+
+#include <math.h>
+
+FixedTimestep::FixedTimestep(double rate, unsigned int maxTicks)
+{
+  tickLength = 1.0 / rate;
+  this->maxTicks = maxTicks;
+  accumulator = 0.0;
+  dropped = 0;
+}
+
+unsigned int FixedTimestep::advance(double frameTime)
+{
+  // a clock going backwards, e.g. after a reset, adds nothing
+  if (frameTime > 0.0)
+    accumulator += frameTime;
+
+  unsigned int ticks = 0;
+  while (accumulator >= tickLength && ticks < maxTicks) {
+    accumulator -= tickLength;
+    ticks++;
+  }
+
+  if (accumulator >= tickLength) {
+    double behind = floor(accumulator / tickLength);
+    dropped += (unsigned long long)behind;
+    accumulator -= behind * tickLength;
+  }
+  return ticks;
+}
+
+float FixedTimestep::alpha() const
+{
+  float a = (float)(accumulator / tickLength);
+  return a < 1.0f ? a : 1.0f;
+}
@@ -0,0 +1,568 @@
+#include "trianglestore.h"
+
+#include "determinism.h"
+
+// how much farther than its radius and a triangle's reach a sweep may pass
+// the triangle's centre and still be tested, room for rounding
+#define TRIANGLE_REACH_SLACK 1.001f
+
+void TriangleStore::clear()
+{
+  for (int a = 0; a < 3; a++) {
+    for (int k = 0; k < 3; k++) {
+      vertices[k][a].clear();
+      edges[k][a].clear();
+    }
+    edgeLengths[a].clear();
+    normals[a].clear();
+    lower[a].clear();
+    upper[a].clear();
+    centers[a].clear();
+    for (int k = 0; k < 3; k++)
+      neighbours[k][a].clear();
+  }
+  d.clear();
+  reaches.clear();
+  areas.clear();
+  features.clear();
+}
+
+void TriangleStore::reserve(unsigned int count)
+{
+  for (int a = 0; a < 3; a++) {
+    for (int k = 0; k < 3; k++) {
+      vertices[k][a].reserve(count);
+      edges[k][a].reserve(count);
+    }
+    edgeLengths[a].reserve(count);
+    normals[a].reserve(count);
+    lower[a].reserve(count);
+    upper[a].reserve(count);
+    centers[a].reserve(count);
+    for (int k = 0; k < 3; k++)
+      neighbours[k][a].reserve(count);
+  }
+  d.reserve(count);
+  reaches.reserve(count);
+  areas.reserve(count);
+  features.reserve(count);
+}
+
+ESpaceTriangle::ESpaceTriangle(const vec3& p1, const vec3& p2, const vec3& p3,
+                               const vec3& radius)
+{
+  vec3 p[3] = { p1 / radius, p2 / radius, p3 / radius };
+  vec3 edge[3] = { p[1] - p[0], p[2] - p[1], p[0] - p[2] };
+  vec3 n = cross(edge[0], p[2] - p[0]);
+  area = length(n);
+  bool degenerate = !(area > 0.0f);
+  n = degenerate ? vec3(0.0f) : n / area;
+
+  for (int a = 0; a < 3; a++) {
+    for (int k = 0; k < 3; k++) {
+      vertices[k][a] = p[k][a];
+      edges[k][a] = edge[k][a];
+    }
+    edgeLengths[a] = dot(edge[a], edge[a]);
+    normal[a] = n[a];
+    lower[a] = degenerate ? FLT_MAX : MIN(MIN(p[0][a], p[1][a]), p[2][a]);
+    upper[a] = degenerate ? -FLT_MAX : MAX(MAX(p[0][a], p[1][a]), p[2][a]);
+  }
+  d = -dot(n, p[0]);
+
+  vec3 c = (p[0] + p[1] + p[2]) / 3.0f;
+  for (int a = 0; a < 3; a++)
+    center[a] = c[a];
+  reach = sqrtf(MAX(MAX(dot(p[0] - c, p[0] - c), dot(p[1] - c, p[1] - c)),
+                    dot(p[2] - c, p[2] - c)));
+}
+
+vec3 eSpaceNormal(const vec3& p1, const vec3& p2, const vec3& p3, const vec3& radius)
+{
+  // the same steps as the constructor above
+  vec3 p[3] = { p1 / radius, p2 / radius, p3 / radius };
+  vec3 n = cross(p[1] - p[0], p[2] - p[0]);
+  float area = length(n);
+  return area > 0.0f ? n / area : vec3(0.0f);
+}
+
+void TriangleStore::add(const vec3& p1, const vec3& p2, const vec3& p3,
+                        const vec3& radius, unsigned int features, const vec3 *neighbours)
+{
+  add(ESpaceTriangle(p1, p2, p3, radius), features, neighbours);
+}
+
+void TriangleStore::add(const ESpaceTriangle& triangle, unsigned int features,
+                        const vec3 *neighbours)
+{
+  for (int a = 0; a < 3; a++) {
+    for (int k = 0; k < 3; k++) {
+      vertices[k][a].push_back(triangle.vertices[k][a]);
+      edges[k][a].push_back(triangle.edges[k][a]);
+    }
+    edgeLengths[a].push_back(triangle.edgeLengths[a]);
+    normals[a].push_back(triangle.normal[a]);
+    lower[a].push_back(triangle.lower[a]);
+    upper[a].push_back(triangle.upper[a]);
+    centers[a].push_back(triangle.center[a]);
+    for (int k = 0; k < 3; k++)
+      this->neighbours[k][a].push_back(neighbours ? neighbours[k][a] : 0.0f);
+  }
+  d.push_back(triangle.d);
+  reaches.push_back(triangle.reach);
+  areas.push_back(triangle.area);
+  this->features.push_back(features);
+}
+
+unsigned int TriangleStore::size() const
+{
+  return d.size();
+}
+
+vec3 TriangleStore::position(unsigned int triangle, int vertex) const
+{
+  return vec3(vertices[vertex][0][triangle], vertices[vertex][1][triangle],
+              vertices[vertex][2][triangle]);
+}
+
+// What the triangle tests need of the sweep, worked out once per call
+// rather than once per triangle.
+// The sphere is the unit sphere of an ellipsoid's e-space, or a sphere
+// of its own radius in R3.
+struct SweepTerms {
+  vec3 base;
+  vec3 velocity;
+  float velocitySquaredLength;
+  float inverseVelocitySquaredLength;
+  float speed;
+  float radius;
+  float radiusSquared;
+
+  SweepTerms(const CollisionPacket* colPackage, float radius)
+  {
+    base = colPackage->basePoint;
+    velocity = colPackage->velocity;
+    velocitySquaredLength = dot(velocity, velocity);
+    inverseVelocitySquaredLength = 1.0f / velocitySquaredLength;
+    speed = sqrtf(velocitySquaredLength);
+    this->radius = radius;
+    radiusSquared = radius * radius;
+  }
+
+  // time of the packet's nearest hit so far, nothing past the sweep's end
+  float limit(const CollisionPacket* colPackage) const
+  {
+    if (!colPackage->foundCollision)
+      return 1.0f;
+    return MIN((float)(colPackage->nearestDistance / speed), 1.0f);
+  }
+};
+
+// The swept sphere against the line through p along edge, the edge part
+// of checkTriangle with its length already known.
+static inline bool checkEdge(const SweepTerms& sweep, const vec3& p,
+                             const vec3& edge, float edgeSquaredLength,
+                             float& t, vec3& collisionPoint)
+{
+  vec3 baseToVertex = p - sweep.base;
+  float edgeDotVelocity = dot(edge, sweep.velocity);
+  float edgeDotBaseToVertex = dot(edge, baseToVertex);
+
+  float a = edgeSquaredLength * -sweep.velocitySquaredLength +
+            edgeDotVelocity * edgeDotVelocity;
+  float b = edgeSquaredLength * (2.0f * dot(sweep.velocity, baseToVertex)) -
+            2.0f * edgeDotVelocity * edgeDotBaseToVertex;
+  float c = edgeSquaredLength * (sweep.radiusSquared - dot(baseToVertex, baseToVertex)) +
+            edgeDotBaseToVertex * edgeDotBaseToVertex;
+
+  float newT;
+  if (!getLowestRoot(a, b, c, t, &newT))
+    return false;
+  // within the segment?
+  float f = (edgeDotVelocity * newT - edgeDotBaseToVertex) / edgeSquaredLength;
+  if (f < 0.0f || f > 1.0f)
+    return false;
+  t = newT;
+  collisionPoint = p + f * edge;
+  return true;
+}
+
+// checkTriangle on triangle i of the store, for hits before t, testing
+// the edges and vertices its features pick. Every hit lies within the time
+// the sphere touches the plane, so a triangle whose plane is reached after
+// t is skipped without any of the quadratics.
+static inline bool sweepTriangle(const SweepTerms& sweep, const TriangleStore& store,
+                                 unsigned int i, float& t, vec3& collisionPoint)
+{
+  vec3 normal(store.normals[0][i], store.normals[1][i], store.normals[2][i]);
+
+  // the face only if it faces the sweep
+  float normalDotVelocity = dot(normal, sweep.velocity);
+  bool backFace = normalDotVelocity > 0.0f;
+  if (backFace && !(store.features[i] >> FEATURES_BACK & 0x3f))
+    return false;
+
+  // interval of the sweep touching the plane
+  float signedDistance = dot(normal, sweep.base) + store.d[i];
+  float t0, t1;
+  bool embeddedInPlane = false;
+  if (normalDotVelocity == 0.0f) {
+    if (fabsf(signedDistance) >= sweep.radius)
+      return false;
+    embeddedInPlane = true;
+    t0 = 0.0f;
+    t1 = 1.0f;
+  }
+  else {
+    t0 = (-sweep.radius - signedDistance) / normalDotVelocity;
+    t1 = (sweep.radius - signedDistance) / normalDotVelocity;
+    if (t0 > t1) {
+      float temp = t1;
+      t1 = t0;
+      t0 = temp;
+    }
+    if (t0 > 1.0f || t1 < 0.0f)
+      return false;
+    t0 = MIN(MAX(t0, 0.0f), 1.0f);
+  }
+  if (t0 >= t)
+    return false;
+
+  // a hit is a point of the triangle, so within reach of its centre, and
+  // the sphere touches it between t0 and t1; a sweep that doesn't come
+  // that close in that time needs none of the tests below
+  vec3 center(store.centers[0][i], store.centers[1][i], store.centers[2][i]);
+  float s = dot(center - sweep.base, sweep.velocity) * sweep.inverseVelocitySquaredLength;
+  s = MIN(MAX(s, t0), MIN(t1, t));
+  vec3 gap = sweep.base + s * sweep.velocity - center;
+  float reach = (sweep.radius + store.reaches[i]) * TRIANGLE_REACH_SLACK;
+  if (dot(gap, gap) > reach * reach)
+    return false;
+
+  unsigned int features = sweptFeatures(store, i,
+    backFace ? FEATURES_BACK : t0 > 0.0f ? FEATURES_OUTSIDE : FEATURES_SUNK, sweep.velocity);
+  if (!features && backFace)
+    return false;
+
+  vec3 p[3], edge[3];
+  for (int k = 0; k < 3; k++) {
+    p[k] = store.position(i, k);
+    edge[k] = vec3(store.edges[k][0][i], store.edges[k][1][i], store.edges[k][2][i]);
+  }
+
+  // touching the inside of the face happens first if at all. This is
+  // checkPointInTriangle with u = p2 - p1 and v = p3 - p1, where
+  // cross(u, v) is the normal times the area
+  if (!embeddedInPlane && !backFace) {
+    vec3 point = sweep.base - normal * sweep.radius + t0 * sweep.velocity;
+    vec3 w = point - p[0];
+    vec3 vw = cross(-edge[2], w);
+    vec3 uw = cross(edge[0], w);
+    if (dot(vw, normal) <= 0.0f && dot(uw, normal) >= 0.0f &&
+        length(vw) + length(uw) <= store.areas[i]) {
+      t = t0;
+      collisionPoint = point;
+      return true;
+    }
+  }
+
+  bool found = false;
+  float newT;
+  for (int k = 0; k < 3; k++) {
+    if (!(features >> (3 + k) & 1))
+      continue;
+    vec3 baseToVertex = sweep.base - p[k];
+    float b = 2.0f * dot(sweep.velocity, baseToVertex);
+    float c = dot(baseToVertex, baseToVertex) - sweep.radiusSquared;
+    // starting outside and moving away, both roots are behind
+    if (c > 0.0f && b >= 0.0f)
+      continue;
+    if (getLowestRoot(sweep.velocitySquaredLength, b, c, t, &newT)) {
+      t = newT;
+      found = true;
+      collisionPoint = p[k];
+    }
+  }
+
+  for (int k = 0; k < 3; k++) {
+    if ((features >> k & 1) &&
+        checkEdge(sweep, p[k], edge[k], store.edgeLengths[k][i], t, collisionPoint))
+      found = true;
+  }
+  return found;
+}
+
+static inline void recordHit(CollisionPacket* colPackage, const SweepTerms& sweep,
+                             float t, const vec3& collisionPoint)
+{
+  float distToCollision = t * sweep.speed;
+  if (colPackage->foundCollision == false ||
+      distToCollision < colPackage->nearestDistance) {
+    colPackage->nearestDistance = distToCollision;
+    colPackage->intersectionPoint = collisionPoint;
+    colPackage->foundCollision = true;
+  }
+}
+
+void checkTriangle(CollisionPacket* colPackage,
+                   const TriangleStore& store, unsigned int i)
+{
+  // a sweep without velocity hits nothing
+  SweepTerms sweep(colPackage, 1.0f);
+  if (sweep.velocitySquaredLength == 0.0f)
+    return;
+
+  float t = sweep.limit(colPackage);
+  vec3 collisionPoint;
+  if (sweepTriangle(sweep, store, i, t, collisionPoint))
+    recordHit(colPackage, sweep, t, collisionPoint);
+}
+
+static void scalarTriangles(CollisionPacket* colPackage, const TriangleStore& store,
+                            unsigned int first, unsigned int count, const AABB& box,
+                            float radius)
+{
+  SweepTerms sweep(colPackage, radius);
+  if (sweep.velocitySquaredLength == 0.0f)
+    return;
+
+  float t = sweep.limit(colPackage);
+  vec3 collisionPoint;
+  bool found = false;
+  for (unsigned int i = first; i < first + count; i++) {
+    if (overlapsBox(store, i, box) && sweepTriangle(sweep, store, i, t, collisionPoint))
+      found = true;
+  }
+  if (found)
+    recordHit(colPackage, sweep, t, collisionPoint);
+}
+
+void checkTrianglesScalar(CollisionPacket* colPackage, const TriangleStore& store,
+                          unsigned int first, unsigned int count, const AABB& box)
+{
+  scalarTriangles(colPackage, store, first, count, box, 1.0f);
+}
+
+void checkSphereTrianglesScalar(CollisionPacket* colPackage, const TriangleStore& store,
+                                unsigned int first, unsigned int count, const AABB& box)
+{
+  scalarTriangles(colPackage, store, first, count, box, colPackage->eRadius[0]);
+}
+
+void checkTriangles(CollisionPacket* colPackage, const TriangleStore& store,
+                    unsigned int first, unsigned int count, const AABB& box)
+{
+  collisionKernels().checkTriangles(colPackage, store, first, count, box);
+}
+
+void checkSphereTriangles(CollisionPacket* colPackage, const TriangleStore& store,
+                          unsigned int first, unsigned int count, const AABB& box)
+{
+  collisionKernels().checkSphereTriangles(colPackage, store, first, count, box);
+}
+
+#ifdef COLLISION_X86
+#include "simd8.h"
+
+// Every operation below is the one the scalar version does, in the same
+// order and on floats, so the lanes round exactly like it. FMA stays off
+// for the same reason.
+// The scalar version's reach test only skips triangles that can't be hit,
+// so it is left out without changing what is found.
+AVX2 static void avx2Triangles(CollisionPacket* colPackage, const TriangleStore& store,
+                               unsigned int first, unsigned int count, const AABB& box,
+                               float sweepRadius)
+{
+  SweepTerms sweep(colPackage, sweepRadius);
+  if (sweep.velocitySquaredLength == 0.0f)
+    return;
+
+  const __m256 zero = _mm256_setzero_ps();
+  const __m256 one = _mm256_set1_ps(1.0f);
+  const __m256 two = _mm256_set1_ps(2.0f);
+  const __m256 radius = _mm256_set1_ps(sweep.radius);
+  const __m256 radiusSquared = _mm256_set1_ps(sweep.radiusSquared);
+  const __m256 all = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+  const Vec8 base = broadcast8(sweep.base);
+  const Vec8 velocity = broadcast8(sweep.velocity);
+  const __m256 velocitySquaredLength = _mm256_set1_ps(sweep.velocitySquaredLength);
+  const __m256 minusVelocitySquaredLength = negate8(velocitySquaredLength);
+  const Vec8 boxLower = broadcast8(box.lower);
+  const Vec8 boxUpper = broadcast8(box.upper);
+
+  float t = sweep.limit(colPackage);
+  vec3 collisionPoint;
+  bool found = false;
+
+  unsigned int end = first + count;
+  unsigned int i = first;
+  for (; i + 8 <= end; i += 8) {
+    __m256 limit = _mm256_set1_ps(t);
+
+    // bounds against the box, then the interval the plane is touched in
+    Vec8 lower = load8(store.lower, i), upper = load8(store.upper, i);
+    __m256 valid = _mm256_and_ps(
+      _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(lower.x, boxUpper.x, _CMP_LE_OQ),
+                                  _mm256_cmp_ps(upper.x, boxLower.x, _CMP_GE_OQ)),
+                    _mm256_and_ps(_mm256_cmp_ps(lower.y, boxUpper.y, _CMP_LE_OQ),
+                                  _mm256_cmp_ps(upper.y, boxLower.y, _CMP_GE_OQ))),
+      _mm256_and_ps(_mm256_cmp_ps(lower.z, boxUpper.z, _CMP_LE_OQ),
+                    _mm256_cmp_ps(upper.z, boxLower.z, _CMP_GE_OQ)));
+    // most of a large store lies outside the box
+    if (_mm256_movemask_ps(valid) == 0)
+      continue;
+
+    // back faces only with features of their own
+    Vec8 normal = load8(store.normals, i);
+    __m256 normalDotVelocity = dot8(normal, velocity);
+    __m256i stored = _mm256_loadu_si256((const __m256i *)&store.features[i]);
+    __m256 backFace = _mm256_cmp_ps(normalDotVelocity, zero, _CMP_GT_OQ);
+    __m256 backOk = _mm256_andnot_ps(
+      _mm256_castsi256_ps(_mm256_cmpeq_epi32(
+        _mm256_and_si256(_mm256_srli_epi32(stored, FEATURES_BACK), _mm256_set1_epi32(0x3f)),
+        _mm256_setzero_si256())),
+      backFace);
+    valid = _mm256_and_ps(valid, _mm256_or_ps(_mm256_andnot_ps(backFace, all), backOk));
+
+    __m256 signedDistance = _mm256_add_ps(dot8(normal, base), _mm256_loadu_ps(&store.d[i]));
+    __m256 embedded = _mm256_cmp_ps(normalDotVelocity, zero, _CMP_EQ_OQ);
+    __m256 embeddedOk = _mm256_cmp_ps(_mm256_andnot_ps(_mm256_set1_ps(-0.0f), signedDistance),
+                                      radius, _CMP_NGE_UQ);
+
+    __m256 t0 = _mm256_div_ps(_mm256_sub_ps(negate8(radius), signedDistance), normalDotVelocity);
+    __m256 t1 = _mm256_div_ps(_mm256_sub_ps(radius, signedDistance), normalDotVelocity);
+    __m256 swap = _mm256_cmp_ps(t0, t1, _CMP_GT_OQ);
+    __m256 lowerT = _mm256_blendv_ps(t0, t1, swap);
+    __m256 upperT = _mm256_blendv_ps(t1, t0, swap);
+    __m256 intervalOk = _mm256_andnot_ps(
+      _mm256_or_ps(_mm256_cmp_ps(lowerT, one, _CMP_GT_OQ), _mm256_cmp_ps(upperT, zero, _CMP_LT_OQ)),
+      all);
+    lowerT = _mm256_blendv_ps(zero, lowerT, _mm256_cmp_ps(lowerT, zero, _CMP_GT_OQ));
+    lowerT = _mm256_blendv_ps(one, lowerT, _mm256_cmp_ps(lowerT, one, _CMP_LT_OQ));
+    t0 = _mm256_blendv_ps(lowerT, zero, embedded);
+
+    valid = _mm256_and_ps(valid, _mm256_blendv_ps(intervalOk, embeddedOk, embedded));
+    valid = _mm256_and_ps(valid, _mm256_cmp_ps(t0, limit, _CMP_NGE_UQ));
+    if (_mm256_movemask_ps(valid) == 0)
+      continue;
+
+    // the features for each lane's kind of sweep
+    __m256 outside = _mm256_cmp_ps(t0, zero, _CMP_GT_OQ);
+    __m256i shift = _mm256_castps_si256(_mm256_blendv_ps(
+      _mm256_blendv_ps(_mm256_castsi256_ps(_mm256_set1_epi32(FEATURES_SUNK)),
+                       _mm256_castsi256_ps(_mm256_set1_epi32(FEATURES_OUTSIDE)), outside),
+      _mm256_castsi256_ps(_mm256_set1_epi32(FEATURES_BACK)), backFace));
+    __m256i features = sweptFeatures8(store, i, stored, _mm256_srlv_epi32(stored, shift),
+                                      backFace, velocity);
+    __m256 frontFace = _mm256_andnot_ps(backFace, all);
+
+    Vec8 p[3] = { load8(store.vertices[0], i), load8(store.vertices[1], i),
+                  load8(store.vertices[2], i) };
+    Vec8 edge[3] = { load8(store.edges[0], i), load8(store.edges[1], i),
+                     load8(store.edges[2], i) };
+
+    // inside of the face
+    Vec8 offset = { _mm256_mul_ps(normal.x, radius), _mm256_mul_ps(normal.y, radius),
+                    _mm256_mul_ps(normal.z, radius) };
+    Vec8 point = madd8(sub8(base, offset), t0, velocity);
+    Vec8 w = sub8(point, p[0]);
+    Vec8 minusEdge2 = { negate8(edge[2].x), negate8(edge[2].y), negate8(edge[2].z) };
+    Vec8 vw = cross8(minusEdge2, w);
+    Vec8 uw = cross8(edge[0], w);
+    __m256 inside = _mm256_and_ps(
+      _mm256_and_ps(_mm256_cmp_ps(dot8(vw, normal), zero, _CMP_LE_OQ),
+                    _mm256_cmp_ps(dot8(uw, normal), zero, _CMP_GE_OQ)),
+      _mm256_cmp_ps(_mm256_add_ps(_mm256_sqrt_ps(dot8(vw, vw)), _mm256_sqrt_ps(dot8(uw, uw))),
+                    _mm256_loadu_ps(&store.areas[i]), _CMP_LE_OQ));
+    __m256 hit = _mm256_andnot_ps(embedded,
+                                  _mm256_and_ps(_mm256_and_ps(valid, frontFace), inside));
+
+    __m256 laneT = _mm256_blendv_ps(limit, t0, hit);
+    Vec8 lanePoint = point;
+    __m256 rest = _mm256_andnot_ps(hit, valid);
+
+    if (_mm256_movemask_ps(rest) != 0) {
+      __m256 root;
+      for (int k = 0; k < 3; k++) {
+        Vec8 baseToVertex = sub8(base, p[k]);
+        __m256 b = _mm256_mul_ps(two, dot8(velocity, baseToVertex));
+        __m256 c = _mm256_sub_ps(dot8(baseToVertex, baseToVertex), radiusSquared);
+        __m256 startsOutside = _mm256_cmp_ps(c, zero, _CMP_GT_OQ);
+        __m256 away = _mm256_and_ps(startsOutside, _mm256_cmp_ps(b, zero, _CMP_GE_OQ));
+        __m256 tested = _mm256_and_ps(rest, bit8(features, 3 + k));
+        __m256 vertexHit = _mm256_andnot_ps(away, _mm256_and_ps(tested,
+          lowestRoot8(velocitySquaredLength, b, c, laneT, root)));
+        laneT = _mm256_blendv_ps(laneT, root, vertexHit);
+        lanePoint = select8(lanePoint, p[k], vertexHit);
+        hit = _mm256_or_ps(hit, vertexHit);
+      }
+
+      for (int k = 0; k < 3; k++) {
+        Vec8 baseToVertex = sub8(p[k], base);
+        __m256 edgeSquaredLength = _mm256_loadu_ps(&store.edgeLengths[k][i]);
+        __m256 edgeDotVelocity = dot8(edge[k], velocity);
+        __m256 edgeDotBaseToVertex = dot8(edge[k], baseToVertex);
+
+        __m256 a = _mm256_add_ps(_mm256_mul_ps(edgeSquaredLength, minusVelocitySquaredLength),
+                                 _mm256_mul_ps(edgeDotVelocity, edgeDotVelocity));
+        __m256 b = _mm256_sub_ps(
+          _mm256_mul_ps(edgeSquaredLength, _mm256_mul_ps(two, dot8(velocity, baseToVertex))),
+          _mm256_mul_ps(_mm256_mul_ps(two, edgeDotVelocity), edgeDotBaseToVertex));
+        __m256 c = _mm256_add_ps(
+          _mm256_mul_ps(edgeSquaredLength, _mm256_sub_ps(radiusSquared, dot8(baseToVertex, baseToVertex))),
+          _mm256_mul_ps(edgeDotBaseToVertex, edgeDotBaseToVertex));
+
+        __m256 tested = _mm256_and_ps(rest, bit8(features, k));
+        __m256 edgeHit = _mm256_and_ps(tested, lowestRoot8(a, b, c, laneT, root));
+        __m256 f = _mm256_div_ps(_mm256_sub_ps(_mm256_mul_ps(edgeDotVelocity, root),
+                                               edgeDotBaseToVertex), edgeSquaredLength);
+        __m256 offEdge = _mm256_or_ps(_mm256_cmp_ps(f, zero, _CMP_LT_OQ),
+                                      _mm256_cmp_ps(f, one, _CMP_GT_OQ));
+        edgeHit = _mm256_andnot_ps(offEdge, edgeHit);
+        laneT = _mm256_blendv_ps(laneT, root, edgeHit);
+        lanePoint = select8(lanePoint, madd8(p[k], f, edge[k]), edgeHit);
+        hit = _mm256_or_ps(hit, edgeHit);
+      }
+    }
+
+    int mask = _mm256_movemask_ps(hit);
+    if (mask == 0)
+      continue;
+
+    // take the lanes in order like the scalar loop would, each against
+    // the nearest hit of the lanes before it
+    float times[8], starts[8], x[8], y[8], z[8];
+    _mm256_storeu_ps(times, laneT);
+    _mm256_storeu_ps(starts, t0);
+    _mm256_storeu_ps(x, lanePoint.x);
+    _mm256_storeu_ps(y, lanePoint.y);
+    _mm256_storeu_ps(z, lanePoint.z);
+    for (int j = 0; j < 8; j++) {
+      if ((mask >> j & 1) && !(starts[j] >= t) && times[j] < t) {
+        t = times[j];
+        collisionPoint = vec3(x[j], y[j], z[j]);
+        found = true;
+      }
+    }
+  }
+
+  for (; i < end; i++) {
+    if (overlapsBox(store, i, box) && sweepTriangle(sweep, store, i, t, collisionPoint))
+      found = true;
+  }
+  if (found)
+    recordHit(colPackage, sweep, t, collisionPoint);
+}
+
+void checkTrianglesAVX2(CollisionPacket* colPackage, const TriangleStore& store,
+                        unsigned int first, unsigned int count, const AABB& box)
+{
+  avx2Triangles(colPackage, store, first, count, box, 1.0f);
+}
+
+void checkSphereTrianglesAVX2(CollisionPacket* colPackage, const TriangleStore& store,
+                              unsigned int first, unsigned int count, const AABB& box)
+{
+  avx2Triangles(colPackage, store, first, count, box, colPackage->eRadius[0]);
+}
+#endif
@@ -0,0 +1,152 @@
+#include "workers.h"
+
+#include "collision.h"
+
+WorkerPool::WorkerPool(unsigned int threadCount)
+{
+  if (threadCount == 0)
+    threadCount = MAX(std::thread::hardware_concurrency(), 1u);
+  this->threadCount = threadCount;
+  shares.reset(new Share[threadCount]);
+  for (unsigned int i = 0; i < threadCount; i++)
+    shares[i].begin = shares[i].end = 0;
+
+  steals = 0;
+  generation = 0;
+  busy = 0;
+  stopping = false;
+  task = NULL;
+  grain = 1;
+  stolen = 0;
+
+  for (unsigned int i = 1; i < threadCount; i++)
+    threads.push_back(std::thread(&WorkerPool::loop, this, i));
+}
+
+WorkerPool::~WorkerPool()
+{
+  {
+    std::lock_guard<std::mutex> guard(mutex);
+    stopping = true;
+  }
+  wake.notify_all();
+  for (unsigned int i = 0; i < threads.size(); i++)
+    threads[i].join();
+}
+
+unsigned int WorkerPool::size() const
+{
+  return threadCount;
+}
+
+void WorkerPool::run(unsigned int count, unsigned int grain,
+                     const std::function<void(unsigned int, unsigned int)>& task)
+{
+  steals = 0;
+  if (count == 0)
+    return;
+
+  // the threads are all asleep between runs, so the shares are ours
+  for (unsigned int i = 0; i < threadCount; i++) {
+    shares[i].begin = (unsigned int)((unsigned long long)count * i / threadCount);
+    shares[i].end = (unsigned int)((unsigned long long)count * (i + 1) / threadCount);
+  }
+  this->task = &task;
+  this->grain = MAX(grain, 1u);
+  stolen = 0;
+
+  if (threadCount > 1) {
+    {
+      std::lock_guard<std::mutex> guard(mutex);
+      generation++;
+      busy = threadCount - 1;
+    }
+    wake.notify_all();
+  }
+
+  work(0);
+
+  if (threadCount > 1) {
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this] { return busy == 0; });
+  }
+  steals = stolen;
+  this->task = NULL;
+}
+
+void WorkerPool::loop(unsigned int worker)
+{
+  unsigned int seen = 0;
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      wake.wait(lock, [this, seen] { return stopping || generation != seen; });
+      if (stopping)
+        return;
+      seen = generation;
+    }
+
+    work(worker);
+
+    std::lock_guard<std::mutex> guard(mutex);
+    if (--busy == 0)
+      done.notify_one();
+  }
+}
+
+// Returns once there is nothing left to take or steal. Items another
+// worker stole but hasn't started are that worker's to finish.
+void WorkerPool::work(unsigned int worker)
+{
+  for (;;) {
+    unsigned int first, last;
+    if (!take(worker, first, last)) {
+      if (!steal(worker))
+        return;
+      continue;
+    }
+    for (unsigned int i = first; i < last; i++)
+      (*task)(i, worker);
+  }
+}
+
+// the next grain items from the front of the worker's own share
+bool WorkerPool::take(unsigned int worker, unsigned int& first, unsigned int& last)
+{
+  Share& share = shares[worker];
+  std::lock_guard<std::mutex> guard(share.lock);
+  if (share.begin == share.end)
+    return false;
+  first = share.begin;
+  last = MIN(share.begin + grain, share.end);
+  share.begin = last;
+  return true;
+}
+
+// Moves the back half of the first other share that isn't empty into the
+// worker's own, which is empty. One lock at a time, so thieves never wait
+// on each other in a circle.
+bool WorkerPool::steal(unsigned int worker)
+{
+  for (unsigned int k = 1; k < threadCount; k++) {
+    Share& victim = shares[(worker + k) % threadCount];
+    unsigned int first, last;
+    {
+      std::lock_guard<std::mutex> guard(victim.lock);
+      unsigned int left = victim.end - victim.begin;
+      if (left == 0)
+        continue;
+      last = victim.end;
+      first = victim.end - (left + 1) / 2;
+      victim.end = first;
+    }
+
+    stolen += last - first;
+    Share& own = shares[worker];
+    std::lock_guard<std::mutex> guard(own.lock);
+    own.begin = first;
+    own.end = last;
+    return true;
+  }
+  return false;
+}
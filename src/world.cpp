@@ -0,0 +1,676 @@
+#include "world.h"
+
+#include <algorithm>
+#include <cstdio>
+
+#ifndef _WIN32
+#include <sys/stat.h>
+#endif
+
+static void gatherTriangles(const Model& model, std::vector<vec3>& triangles)
+{
+  for (unsigned int j = 0; j < model.meshes.size(); j++) {
+    const Mesh& mesh = model.meshes[j];
+    for (unsigned int k = 0; k + 2 < mesh.indices.size(); k += 3) {
+      triangles.push_back(mesh.vertices[mesh.indices[k]].Position);
+      triangles.push_back(mesh.vertices[mesh.indices[k+1]].Position);
+      triangles.push_back(mesh.vertices[mesh.indices[k+2]].Position);
+    }
+  }
+}
+
+// Loads the tree from cacheDirectory if it was built before, otherwise
+// builds it and stores it there.
+static void buildCached(BVH& bvh, const std::vector<vec3>& triangles,
+                        const std::vector<unsigned int>& live,
+                        const std::string& cacheDirectory)
+{
+  if (cacheDirectory.empty()) {
+    bvh.build(triangles, live);
+    return;
+  }
+
+  unsigned long long key = hashBVHInput(triangles, live);
+  char name[32];
+  snprintf(name, sizeof(name), "%016llx.bvh", key);
+  std::string path = cacheDirectory + "/" + name;
+
+  if (bvh.load(path, key, triangles.size() / 3))
+    return;
+
+  bvh.build(triangles, live);
+#ifndef _WIN32
+  mkdir(cacheDirectory.c_str(), 0755);
+#endif
+  if (!bvh.save(path, key))
+    cout << "WARNING::COLLISION:: couldn't write BVH cache " << path << endl;
+}
+
+CollisionMesh::CollisionMesh(const Model& model, const std::string& cacheDirectory)
+{
+  gatherTriangles(model, triangles);
+  adjacency.build(triangles, triangles.size() / 3);
+
+  std::vector<unsigned int> all(triangles.size() / 3);
+  for (unsigned int i = 0; i < all.size(); i++)
+    all[i] = i;
+  buildCached(bvh, triangles, all, cacheDirectory);
+  rebuilder.reset(bvh);
+}
+
+CollisionWorld::CollisionWorld(const std::vector<Model>& models, BroadphaseType type,
+                               const std::string& cacheDirectory)
+{
+  this->cacheDirectory = cacheDirectory;
+
+  for (unsigned int i = 0; i < models.size(); i++)
+    gatherTriangles(models[i], triangles);
+  staticCount = triangles.size() / 3;
+  adjacency.build(triangles, staticCount);
+
+  broadphaseType = type;
+  build();
+  changes.resize(WORLD_CHANGE_HISTORY);
+  changeTotal = 0;
+  changesKept = 0;
+  changesAtUpdate = 0;
+}
+
+CollisionWorld::CollisionWorld(BroadphaseType type, const std::string& cacheDirectory)
+{
+  this->cacheDirectory = cacheDirectory;
+  staticCount = 0;
+  broadphaseType = type;
+  build();
+  changes.resize(WORLD_CHANGE_HISTORY);
+  changeTotal = 0;
+  changesKept = 0;
+  changesAtUpdate = 0;
+}
+
+void CollisionWorld::setBroadphase(BroadphaseType type)
+{
+  if (type == broadphaseType)
+    return;
+  broadphaseType = type;
+  build();
+}
+
+void CollisionWorld::setGridCellSize(float size)
+{
+  grid.cellSize = size;
+  if (broadphaseType == BROADPHASE_GRID)
+    build();
+}
+
+std::vector<unsigned int> CollisionWorld::liveTriangles() const
+{
+  std::vector<unsigned int> live;
+  for (unsigned int i = 0; i < staticCount; i++)
+    live.push_back(i);
+  for (unsigned int i = 0; i < sets.size(); i++) {
+    if (!sets[i].alive)
+      continue;
+    for (unsigned int j = 0; j < sets[i].count; j++)
+      live.push_back(sets[i].first + j);
+  }
+  return live;
+}
+
+void CollisionWorld::build()
+{
+  std::vector<unsigned int> live = liveTriangles();
+
+  // only the broadphase in use holds any triangles
+  bvh.clear();
+  quantized.clear();
+  octree.clear(AABB());
+  grid.clear(grid.cellSize);
+
+  if (usesBVH()) {
+    buildBVH(live);
+    rebuilder.reset(bvh, broadphaseType == BROADPHASE_QUANTIZED);
+    if (broadphaseType == BROADPHASE_QUANTIZED)
+      quantized.build(bvh);
+  }
+  else if (broadphaseType == BROADPHASE_OCTREE) {
+    AABB bounds;
+    for (unsigned int i = 0; i < live.size(); i++) {
+      bounds.grow(triangles[live[i]*3]);
+      bounds.grow(triangles[live[i]*3+1]);
+      bounds.grow(triangles[live[i]*3+2]);
+    }
+    octree.clear(bounds);
+    for (unsigned int i = 0; i < live.size(); i++)
+      octree.insert(triangles, live[i]);
+  }
+  else {
+    for (unsigned int i = 0; i < live.size(); i++)
+      grid.insert(triangles, live[i]);
+  }
+}
+
+void CollisionWorld::buildBVH(const std::vector<unsigned int>& live)
+{
+  // only the model geometry is worth caching, not every runtime edit
+  if (live.size() == staticCount)
+    buildCached(bvh, triangles, live, cacheDirectory);
+  else
+    bvh.build(triangles, live);
+}
+
+// The octree and the grid take single triangles as they come, the BVH
+// has to be rebuilt.
+void CollisionWorld::insertRange(const TriangleRange& range)
+{
+  for (unsigned int i = 0; i < range.count; i++) {
+    if (broadphaseType == BROADPHASE_OCTREE)
+      octree.insert(triangles, range.first + i);
+    else if (broadphaseType == BROADPHASE_GRID)
+      grid.insert(triangles, range.first + i);
+  }
+  if (usesBVH())
+    build();
+}
+
+void CollisionWorld::removeRange(const TriangleRange& range)
+{
+  for (unsigned int i = 0; i < range.count; i++) {
+    if (broadphaseType == BROADPHASE_OCTREE)
+      octree.remove(range.first + i);
+    else if (broadphaseType == BROADPHASE_GRID)
+      grid.remove(range.first + i);
+  }
+  if (usesBVH())
+    build();
+}
+
+unsigned int CollisionWorld::addTriangles(const std::vector<vec3>& vertices)
+{
+  TriangleRange range;
+  range.count = vertices.size() / 3;
+  range.alive = true;
+
+  // reuse the first freed slot range that is big enough
+  range.first = triangles.size() / 3;
+  for (unsigned int i = 0; i < freeRanges.size(); i++) {
+    if (freeRanges[i].count >= range.count) {
+      range.first = freeRanges[i].first;
+      freeRanges[i].first += range.count;
+      freeRanges[i].count -= range.count;
+      if (freeRanges[i].count == 0)
+        freeRanges.erase(freeRanges.begin() + i);
+      break;
+    }
+  }
+  if (range.first * 3 == triangles.size()) {
+    triangles.resize(triangles.size() + range.count * 3);
+    adjacency.resize(triangles.size() / 3);
+  }
+
+  for (unsigned int i = 0; i < range.count * 3; i++)
+    triangles[range.first * 3 + i] = vertices[i];
+
+  sets.push_back(range);
+  insertRange(range);
+  recordChange(rangeBounds(range));
+
+  return sets.size() - 1;
+}
+
+void CollisionWorld::removeTriangles(unsigned int set)
+{
+  if (set >= sets.size() || !sets[set].alive)
+    return;
+
+  TriangleRange& range = sets[set];
+  range.alive = false;
+  if (range.count > 0)
+    freeRanges.push_back(range);
+
+  removeRange(range);
+  recordChange(rangeBounds(range));
+}
+
+void CollisionWorld::moveTriangles(unsigned int set, const std::vector<vec3>& vertices)
+{
+  if (set >= sets.size() || !sets[set].alive)
+    return;
+
+  const TriangleRange& range = sets[set];
+  AABB changed = rangeBounds(range);
+  if (!usesBVH()) {
+    for (unsigned int i = 0; i < range.count; i++) {
+      if (broadphaseType == BROADPHASE_OCTREE)
+        octree.remove(range.first + i);
+      else
+        grid.remove(range.first + i);
+    }
+  }
+
+  for (unsigned int i = 0; i < range.count * 3 && i < vertices.size(); i++)
+    triangles[range.first * 3 + i] = vertices[i];
+  changed.grow(rangeBounds(range));
+  recordChange(changed);
+
+  if (usesBVH()) {
+    rebuilder.update(bvh, triangles, range.first, range.count);
+    if (broadphaseType == BROADPHASE_QUANTIZED)
+      quantized.refit(bvh, range.first, range.count);
+  }
+  else {
+    insertRange(range);
+  }
+}
+
+const Broadphase& CollisionWorld::broadphase() const
+{
+  if (broadphaseType == BROADPHASE_OCTREE)
+    return octree;
+  if (broadphaseType == BROADPHASE_GRID)
+    return grid;
+  if (broadphaseType == BROADPHASE_QUANTIZED)
+    return quantized;
+  return bvh;
+}
+
+// the quantized tree is packed from the binary one, which is kept for refits
+bool CollisionWorld::usesBVH() const
+{
+  return broadphaseType == BROADPHASE_BVH || broadphaseType == BROADPHASE_QUANTIZED;
+}
+
+void CollisionWorld::query(const AABB& box, std::vector<unsigned int>& result) const
+{
+  broadphase().query(box, result);
+}
+
+void CollisionWorld::querySweep(const vec3& start, const vec3& end, const vec3& radius,
+                                std::vector<unsigned int>& result) const
+{
+  broadphase().querySweep(start, end, radius, result);
+}
+
+unsigned int CollisionWorld::addMesh(const Model& model)
+{
+  meshes.push_back(std::unique_ptr<CollisionMesh>(new CollisionMesh(model, cacheDirectory)));
+  return meshes.size() - 1;
+}
+
+unsigned int CollisionWorld::addInstance(unsigned int mesh, const mat4& transform)
+{
+  CollisionInstance instance;
+  instance.mesh = mesh;
+  instance.alive = true;
+  instances.push_back(instance);
+  instanceBounds.push_back(AABB());
+
+  unsigned int index = instances.size() - 1;
+  placeInstance(index, transform);
+
+  // new instances change the shape of the tree, so rebuild it; removed
+  // ones stay in with empty bounds, so every instance has a leaf to refit
+  std::vector<unsigned int> all(instances.size());
+  for (unsigned int i = 0; i < all.size(); i++)
+    all[i] = i;
+  instanceTree.build(instanceBounds, all, 1);
+
+  return index;
+}
+
+void CollisionWorld::setInstanceTransform(unsigned int instance, const mat4& transform)
+{
+  placeInstance(instance, transform);
+  instanceTree.refit(instanceBounds, instance);
+}
+
+// the matrices and world space bounds of an instance, the tree is left
+// to the caller
+void CollisionWorld::placeInstance(unsigned int instance, const mat4& transform)
+{
+  CollisionInstance& i = instances[instance];
+  i.transform = transform;
+  i.inverse = glm::inverse(transform);
+  i.mirrored = glm::determinant(glm::mat3(transform)) < 0.0f;
+
+  const BVH& bvh = meshes[i.mesh]->bvh;
+  AABB changed = instanceBounds[instance];
+  if (i.alive && bvh.nodeCount > 0)
+    instanceBounds[instance] = bvh.nodes[0].bounds.transformed(transform);
+  else
+    instanceBounds[instance] = AABB();
+  changed.grow(instanceBounds[instance]);
+  recordChange(changed);
+}
+
+// after the instance's mesh moved or the instance was removed
+void CollisionWorld::updateInstanceBounds(unsigned int instance)
+{
+  placeInstance(instance, instances[instance].transform);
+  instanceTree.refit(instanceBounds, instance);
+}
+
+void CollisionWorld::updateMesh(unsigned int mesh, const std::vector<vec3>& vertices)
+{
+  CollisionMesh& m = *meshes[mesh];
+  std::vector<unsigned int> moved;
+  for (unsigned int t = 0; t < m.triangles.size() / 3 && t * 3 + 2 < vertices.size(); t++) {
+    if (m.triangles[t*3] == vertices[t*3] && m.triangles[t*3+1] == vertices[t*3+1] &&
+        m.triangles[t*3+2] == vertices[t*3+2])
+      continue;
+    for (int k = 0; k < 3; k++)
+      m.triangles[t*3+k] = vertices[t*3+k];
+    moved.push_back(t);
+  }
+  if (moved.empty())
+    return;
+  m.rebuilder.update(m.bvh, m.triangles);
+  // the pose may have folded edges of the moved triangles the other way
+  m.adjacency.refold(m.triangles, moved);
+
+  for (unsigned int i = 0; i < instances.size(); i++) {
+    if (instances[i].mesh == mesh)
+      updateInstanceBounds(i);
+  }
+}
+
+void CollisionWorld::update()
+{
+  // the rebuilder packs the quantized copy along with the tree
+  if (usesBVH())
+    rebuilder.poll(bvh, triangles, broadphaseType == BROADPHASE_QUANTIZED ? &quantized : NULL);
+
+  // a rebuilt tree covers the same triangles, instance bounds still hold
+  for (unsigned int i = 0; i < meshes.size(); i++)
+    meshes[i]->rebuilder.poll(meshes[i]->bvh, meshes[i]->triangles);
+  // a character that looked after the last update() looks again after
+  // this one, it can only miss what came before that
+  changesKept = changesAtUpdate;
+  changesAtUpdate = changeTotal;
+}
+
+unsigned int CollisionWorld::changeCount() const
+{
+  return changeTotal;
+}
+
+bool CollisionWorld::changedSince(unsigned int since, const AABB& box) const
+{
+  unsigned int mask = changes.size() - 1;
+  if (changeTotal - since > changes.size())
+    return true;
+  for (unsigned int i = since; i != changeTotal; i++) {
+    if (changes[i & mask].overlaps(box))
+      return true;
+  }
+  return false;
+}
+
+// the box around a set's triangles as they are now
+AABB CollisionWorld::rangeBounds(const TriangleRange& range) const
+{
+  AABB bounds;
+  for (unsigned int i = 0; i < range.count * 3; i++)
+    bounds.grow(triangles[range.first * 3 + i]);
+  return bounds;
+}
+
+void CollisionWorld::recordChange(const AABB& bounds)
+{
+  // grow rather than forget an edit since the update() before last
+  unsigned int kept = changeTotal - changesKept;
+  if (kept >= changes.size() && changes.size() < WORLD_CHANGE_HISTORY_MAX) {
+    std::vector<AABB> grown(changes.size() * 2);
+    for (unsigned int i = changeTotal - MIN(kept, (unsigned int)changes.size()); i != changeTotal; i++)
+      grown[i & (grown.size() - 1)] = changes[i & (changes.size() - 1)];
+    changes.swap(grown);
+  }
+  changes[changeTotal & (changes.size() - 1)] = bounds;
+  changeTotal++;
+}
+
+void CollisionWorld::removeInstance(unsigned int instance)
+{
+  if (instance >= instances.size() || !instances[instance].alive)
+    return;
+
+  // an empty box never overlaps anything, the slot stays in the tree
+  instances[instance].alive = false;
+  updateInstanceBounds(instance);
+}
+
+namespace {
+struct InstanceVisitor {
+  const CollisionWorld& world;
+  const AABB& sweep;
+  std::vector<InstanceCandidate>& result;
+
+  void operator()(unsigned int instance)
+  {
+    const CollisionInstance& i = world.instances[instance];
+    if (!i.alive)
+      return;
+
+    // look the sweep up in the mesh's own space
+    AABB local = sweep.transformed(i.inverse);
+    TriangleVisitor visitor = { instance, result };
+    world.meshes[i.mesh]->bvh.visit(local, visitor);
+  }
+
+  struct TriangleVisitor {
+    unsigned int instance;
+    std::vector<InstanceCandidate>& result;
+    void operator()(unsigned int triangle)
+    {
+      InstanceCandidate candidate = { instance, triangle };
+      result.push_back(candidate);
+    }
+  };
+};
+}
+
+void CollisionWorld::queryInstances(const vec3& start, const vec3& end, const vec3& radius,
+                                    std::vector<InstanceCandidate>& result) const
+{
+  AABB sweep(min(start, end) - radius, max(start, end) + radius);
+  InstanceVisitor visitor = { *this, sweep, result };
+  instanceTree.visit(sweep, visitor);
+}
+
+void CollisionWorld::instanceTriangle(const InstanceCandidate& candidate, vec3 vertices[3]) const
+{
+  const CollisionInstance& instance = instances[candidate.instance];
+  const std::vector<vec3>& local = meshes[instance.mesh]->triangles;
+  unsigned int t = candidate.triangle * 3;
+
+  collisionKernels().transformPoints(instance.transform, &local[t], vertices, 3);
+
+  // keep the triangle front facing the same way it was modelled
+  if (instance.mirrored) {
+    vec3 temp = vertices[1];
+    vertices[1] = vertices[2];
+    vertices[2] = temp;
+  }
+}
+
+namespace {
+struct InstanceSpanVisitor {
+  const CollisionWorld& world;
+  const AABB& sweep;
+  TriangleSpan *spans;
+  unsigned int capacity;
+  unsigned int spanCount;
+
+  void operator()(unsigned int instance)
+  {
+    const CollisionInstance& i = world.instances[instance];
+    if (!i.alive)
+      return;
+
+    AABB local = sweep.transformed(i.inverse);
+    auto leaf = [&](const unsigned int *first, unsigned int count) {
+      addSpan(spans, capacity, spanCount, first, count, instance);
+    };
+    world.meshes[i.mesh]->bvh.visitLeaves(local, leaf);
+  }
+};
+}
+
+unsigned int CollisionWorld::querySpans(const CollisionPacket& packet, TriangleSpan *spans,
+                                        unsigned int capacity) const
+{
+  vec3 start = packet.basePoint * packet.eRadius;
+  vec3 end = (packet.basePoint + packet.velocity) * packet.eRadius;
+  return querySpans(start, end, packet.eRadius, spans, capacity);
+}
+
+unsigned int CollisionWorld::querySpans(const AABB& box, TriangleSpan *spans,
+                                        unsigned int capacity) const
+{
+  // a box is a sweep that doesn't move
+  vec3 center = box.center();
+  return querySpans(center, center, box.upper - center, spans, capacity);
+}
+
+unsigned int CollisionWorld::querySpans(const vec3& start, const vec3& end, const vec3& radius,
+                                        TriangleSpan *spans, unsigned int capacity) const
+{
+  unsigned int spanCount = broadphase().querySpans(start, end, radius, spans, capacity);
+
+  AABB sweep(min(start, end) - radius, max(start, end) + radius);
+  InstanceSpanVisitor visitor = { *this, sweep, spans, capacity, spanCount };
+  instanceTree.visit(sweep, visitor);
+  return visitor.spanCount;
+}
+
+void CollisionWorld::spanTriangle(const TriangleSpan& span, unsigned int i, vec3 vertices[3]) const
+{
+  if (span.instance == SPAN_WORLD) {
+    unsigned int t = span.indices[i] * 3;
+    vertices[0] = triangles[t];
+    vertices[1] = triangles[t+1];
+    vertices[2] = triangles[t+2];
+    return;
+  }
+
+  InstanceCandidate candidate = { span.instance, span.indices[i] };
+  instanceTriangle(candidate, vertices);
+}
+
+void CollisionWorld::spanTriangles(const TriangleSpan& span, vec3 *vertices) const
+{
+  const std::vector<vec3>& source = span.instance == SPAN_WORLD ?
+    triangles : meshes[instances[span.instance].mesh]->triangles;
+  for (unsigned int i = 0; i < span.count; i++) {
+    unsigned int t = span.indices[i] * 3;
+    vertices[i*3] = source[t];
+    vertices[i*3+1] = source[t+1];
+    vertices[i*3+2] = source[t+2];
+  }
+  if (span.instance == SPAN_WORLD)
+    return;
+
+  // the whole span through the instance's transform in one batch
+  const CollisionInstance& instance = instances[span.instance];
+  collisionKernels().transformPoints(instance.transform, vertices, vertices, span.count * 3);
+  if (instance.mirrored) {
+    for (unsigned int i = 0; i < span.count; i++) {
+      vec3 temp = vertices[i*3+1];
+      vertices[i*3+1] = vertices[i*3+2];
+      vertices[i*3+2] = temp;
+    }
+  }
+}
+
+void CollisionWorld::spanFeatures(const TriangleSpan& span, unsigned int *features) const
+{
+  const MeshAdjacency& source = span.instance == SPAN_WORLD ?
+    adjacency : meshes[instances[span.instance].mesh]->adjacency;
+  for (unsigned int i = 0; i < span.count; i++)
+    features[i] = source.features[span.indices[i]];
+  if (span.instance != SPAN_WORLD && instances[span.instance].mirrored) {
+    for (unsigned int i = 0; i < span.count; i++)
+      features[i] = mirrorFeatures(features[i]);
+  }
+}
+
+void CollisionWorld::spanNeighbours(const TriangleSpan& span, unsigned int i, const vec3& radius,
+                                    unsigned int& features, vec3 normals[3]) const
+{
+  if (span.instance == SPAN_WORLD) {
+    adjacency.neighbourNormals(triangles, span.indices[i], radius, features, normals);
+    return;
+  }
+
+  const CollisionInstance& instance = instances[span.instance];
+  const std::vector<unsigned int>& twins = meshes[instance.mesh]->adjacency.twins;
+  for (int k = 0; k < 3; k++) {
+    normals[k] = vec3(0.0f);
+    if (!needsNeighbour(features, k))
+      continue;
+    // edges 0 and 2 of a mirrored triangle are the model's 2 and 0
+    unsigned int edge = instance.mirrored ? 2 - k : k;
+    InstanceCandidate neighbour = { span.instance, twins[span.indices[i] * 3 + edge] / 3 };
+    vec3 vertices[3];
+    instanceTriangle(neighbour, vertices);
+    normals[k] = eSpaceNormal(vertices[0], vertices[1], vertices[2], radius);
+    if (normals[k] == vec3(0.0f))
+      features = withoutNeighbour(features, k);
+  }
+}
+
+static inline bool overlapsTriangle(const AABB& box, const vec3& a, const vec3& b,
+                                    const vec3& c)
+{
+  return AABB(min(min(a, b), c), max(max(a, b), c)).overlaps(box);
+}
+
+void CollisionWorld::gatherSpans(const TriangleSpan *spans, unsigned int spanCount,
+                                 const AABB& box, const vec3& radius, TriangleStore& store,
+                                 std::vector<vec3>& vertices,
+                                 std::vector<unsigned int>& features,
+                                 std::vector<unsigned int>& indices) const
+{
+  // the world's triangles by index, so the grid's repeats show
+  indices.clear();
+  for (unsigned int i = 0; i < spanCount; i++) {
+    if (spans[i].instance != SPAN_WORLD)
+      continue;
+    for (unsigned int j = 0; j < spans[i].count; j++) {
+      unsigned int t = spans[i].indices[j];
+      if (overlapsTriangle(box, triangles[t*3], triangles[t*3+1], triangles[t*3+2]))
+        indices.push_back(t);
+    }
+  }
+  if (broadphaseType == BROADPHASE_GRID) {
+    std::sort(indices.begin(), indices.end());
+    indices.erase(std::unique(indices.begin(), indices.end()), indices.end());
+  }
+
+  vec3 neighbours[3];
+  for (unsigned int i = 0; i < indices.size(); i++) {
+    unsigned int t = indices[i];
+    unsigned int tested = adjacency.features[t];
+    adjacency.neighbourNormals(triangles, t, radius, tested, neighbours);
+    store.add(triangles[t*3], triangles[t*3+1], triangles[t*3+2], radius, tested, neighbours);
+  }
+
+  // instance triangles only exist transformed, a span at a time
+  for (unsigned int i = 0; i < spanCount; i++) {
+    if (spans[i].instance == SPAN_WORLD)
+      continue;
+    if (features.size() < spans[i].count)
+      features.resize(spans[i].count);
+    spanFeatures(spans[i], &features[0]);
+    if (vertices.size() < spans[i].count * 3)
+      vertices.resize(spans[i].count * 3);
+    spanTriangles(spans[i], &vertices[0]);
+    for (unsigned int j = 0; j < spans[i].count; j++) {
+      const vec3 *v = &vertices[j*3];
+      if (!overlapsTriangle(box, v[0], v[1], v[2]))
+        continue;
+      spanNeighbours(spans[i], j, radius, features[j], neighbours);
+      store.add(v[0], v[1], v[2], radius, features[j], neighbours);
+    }
+  }
+}